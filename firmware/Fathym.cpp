@@ -9,8 +9,15 @@ void mqttReceiveHandler(char * topic, byte * payload, unsigned int length) {
   }
 }
 
+// Handler that receives chunks of MQTT messages too large for the packet buffer
+void mqttChunkHandler(char * topic, uint32_t offset, uint8_t * chunk, uint16_t length, uint32_t total) {
+  if (instance != NULL) {
+      instance->receiveChunk(topic, offset, chunk, length, total);
+  }
+}
+
 // Constructor
-Fathym::Fathym() {
+Fathym::Fathym() : _sampleTimer(FATHYM_SYSTEM_SAMPLE_RATE * 1000UL, &Fathym::sampleDue, *this) {
   init("", FATHYM_DEFAULT_PORT, "", "");
 }
 
@@ -23,10 +30,44 @@ void Fathym::init(char * server, uint16_t port, char * username, char * password
   _port = port;
   _username = username;
   _password = password;
+  _mqtt = NULL;
   _lastTimeSync = 0;
+  _lastLatencyReport = 0;
+  _publishRate = 0;
+  _effectiveRate = 0;
+  _cleanCycles = 0;
+  _lastReconnects = _lastWriteErrors = _lastAcks = _lastPings = 0;
+  _lastWake = 0;
+  _lastFreeMemory = 0;
+  _nameReceived = false;
+  _nameSubscribed = false;
+  _lastNameRequest = 0;
+  _baselineRate = FATHYM_BASELINE_RATE;
+  _lastPublish = 0;
+  _publishRequested = false;
+  _requestFailed = false;
+  memset(&_system, 0, sizeof(_system));
+  _sampleDue = false;
   _keepAlive = MQTT_KEEPALIVE;
   _subscribed = false;
+  _caPem = NULL;
+#if MQTT_USE_TLS
+  _tls = NULL;
+#endif
+  _chunkHandler = NULL;
   _error = ERROR_NONE;
+  _bootId = 0;
+  _sequence = 0;
+  _announcedSchema = 0;
+  _schemaAnnounced = false;
+  _stats.firstPublishMillis = 0;
+  resetStats();
+
+  // Runtime settings (may be replaced by saved ones in setup)
+  _decimals = FATHYM_DEFAULT_DECIMAL_PLACES;
+  _systemFields = (FATHYM_ADD_UPTIME ? FATHYM_SYSTEM_UPTIME : 0) |
+    (FATHYM_ADD_FREE_MEMORY ? FATHYM_SYSTEM_FREE_MEMORY : 0) |
+    (FATHYM_ADD_TIMESTAMP ? FATHYM_SYSTEM_TIMESTAMP : 0);
 
   // Publishing rate
   setPublishRate(FATHYM_PUBLISH_RATE); // this makes sure the keep alive is greater than publish rate
@@ -36,30 +77,41 @@ void Fathym::init(char * server, uint16_t port, char * username, char * password
     pinMode(FATHYM_DEBUG_LED_PIN, OUTPUT);
   }
 
-  // Setup internal JSON buffer
-  _json = &_jsonBuffer.createObject();
-  JsonObject & json = *_json;
+  // Timestamp series samples with the device uptime
+  _message.setClock(millis);
+  _channelCount = 0;
+  _groupCount = 0;
+#if FATHYM_CONCURRENT_VALUES
+  _pending.setClock(millis);
+#endif
 
-  // Assign the Photon's device ID for the ID in published messages
-  _id = System.deviceID();
-  json[FATHYM_ID_PROPERTY] = _id.c_str();
+  // Assign the Photon's device ID for the ID in published messages (the only String, used once)
+  strncpy(_id, System.deviceID().c_str(), sizeof(_id) - 1);
+  _id[sizeof(_id) - 1] = 0;
+  _name[0] = 0;
 
   // Set the send/receive topics using the device ID
-  _sendTopic = String("fathym.devices.from.") + _id;
-  _receiveTopic = String("fathym.devices.to.") + _id;
+  FathymWriter sendTopic(_sendTopic, sizeof(_sendTopic));
+  sendTopic.write("fathym.devices.from.");
+  sendTopic.write(_id);
+  sendTopic.finish();
 
-  // If adding a time stamp, setup time zone
+  FathymWriter receiveTopic(_receiveTopic, sizeof(_receiveTopic));
+  receiveTopic.write("fathym.devices.to.");
+  receiveTopic.write(_id);
+  receiveTopic.finish();
+
+  // Setup time zone (always, since time stamps can be switched on at runtime)
+  Time.zone(FATHYM_TIMEZONE_OFFSET);
+
+  // If adding a time stamp, start with the current one
+  _timeStamp[0] = 0;
   if (FATHYM_ADD_TIMESTAMP) {
-    Time.zone(FATHYM_TIMEZONE_OFFSET);
-    time_t time = Time.now();
-    _timeStamp = Time.format(time, TIME_FORMAT_ISO8601_FULL);
+    formatTime(Time.now(), _timeStamp);
   }
 
-  // If configured to add the device's name make an entry into the message
-  if (FATHYM_ADD_DEVICE_NAME) {
-    json[FATHYM_DEVICE_NAME_PROPERTY] = _name.c_str();
-    _name == NULL;
-  }
+  // Pre-serialize the device ID (and name once it is known) that starts every message
+  buildPrefix();
 
   // Initialize storage
   //_flash = Devices::createDefaultStore();
@@ -67,20 +119,130 @@ void Fathym::init(char * server, uint16_t port, char * username, char * password
 
 // Handler that retrieves the device's name from the cloud
 void Fathym::nameHandler(const char * topic, const char * data) {
-  _name = String(data);
+  if (data == NULL || data[0] == 0) return;
+
+  _nameReceived = true;
+  if (strncmp(_name, data, sizeof(_name) - 1) == 0) return;
+
+  strncpy(_name, data, sizeof(_name) - 1);
+  _name[sizeof(_name) - 1] = 0;
+  buildPrefix();
+  saveName();
+}
+
+// Asks the cloud for the device name; the reply arrives at nameHandler
+void Fathym::requestName(void) {
+  // Subscriptions stay in place (and are sent when the cloud connects), so only subscribe once
+  if (!_nameSubscribed) {
+    _nameSubscribed = Particle.subscribe("spark/device/name", &Fathym::nameHandler, this);
+  }
+
+  if (Particle.connected()) {
+    Particle.publish("spark/device/name");
+    _lastNameRequest = millis();
+  }
+}
+
+// Restores the device name last reported by the cloud
+void Fathym::loadName(void) {
+  FathymName saved;
+  EEPROM.get(FATHYM_NAME_ADDRESS, saved);
+  if (saved.magic != FATHYM_NAME_MAGIC) return;
+
+  saved.name[FATHYM_MAX_NAME_SIZE - 1] = 0;
+  strcpy(_name, saved.name);
+  buildPrefix();
+}
+
+// Saves the device name for the next boot (only writing when it changed)
+void Fathym::saveName(void) {
+  FathymName name;
+  memset(&name, 0, sizeof(name));
+  name.magic = FATHYM_NAME_MAGIC;
+  strcpy(name.name, _name);
+
+  FathymName saved;
+  EEPROM.get(FATHYM_NAME_ADDRESS, saved);
+  if (memcmp(&saved, &name, sizeof(name)) != 0) {
+    EEPROM.put(FATHYM_NAME_ADDRESS, name);
+  }
 }
 
 // Starts the Fathym library (should be called in setup() function of your main project file)
 void Fathym::setup(void) {
+  // Restore settings changed at runtime
+  if (FATHYM_PERSIST_CONFIG) {
+    loadConfig();
+  }
+
+  // Start a new message sequence under a new boot id
+  if (FATHYM_ADD_SEQUENCE) {
+    nextBoot();
+  }
+
+  // Start with the device name from the last boot, and ask the cloud for the current one
+  if (FATHYM_ADD_DEVICE_NAME) {
+    loadName();
+    requestName();
+  }
+
   // If configured to use batteries, set it up
   #ifdef FATHYM_USE_BATTERY_POWER
   lipo.begin(); // start up the battery monitor
   lipo.quickStart(); // recalibrate for battery SoC
   #endif
+
+  // Take the first system sample now so the first publish has values, then keep sampling at the sample rate
+  sampleSystem();
+  _sampleTimer.start();
+}
+
+// Marks the system fields as due for sampling (runs on the timer thread, which must not touch I2C)
+void Fathym::sampleDue(void) {
+  _sampleDue = true;
+}
+
+// Samples the system fields if the sample timer has asked for it since the last sample
+void Fathym::sampleIfDue(void) {
+  if (_sampleDue) {
+    sampleSystem();
+  }
+}
+
+// Samples the system fields (free memory, battery gauge) into the cache read by publishing. This runs on
+// the application thread, so the fuel gauge's I2C transactions can't interleave with the sketch's.
+void Fathym::sampleSystem(void) {
+  unsigned long start = micros();
+  _sampleDue = false;
+
+  if (_systemFields & FATHYM_SYSTEM_FREE_MEMORY) {
+    _system.freeMemory = System.freeMemory();
+  }
+
+  #ifdef FATHYM_USE_BATTERY_POWER
+
+  // Each reading is an I2C transaction with the fuel gauge
+  if (FATHYM_USE_BATTERY_POWER && FATHYM_MONITOR_BATTERY) {
+    if (FATHYM_ADD_BATTERY_VOLTAGE) {
+      _system.batteryVoltage = lipo.getVoltage();
+    }
+
+    if (FATHYM_ADD_BATTERY_CHARGE) {
+      _system.batteryCharge = lipo.getSOC();
+    }
+  }
+
+  #endif // FATHYM_USE_BATTERY_POWER
+
+  _system.sampledAt = millis();
+  _stats.sampleMicros = micros() - start;
 }
 
 // Begins a Fathym message update cycle; performs connection maintenance and prepares the connection for publishing.
 void Fathym::beginUpdate(void) {
+  unsigned long start = micros();
+  _stats.cycles++;
+
   // If the error state exists is non-critical, clear it
   if (_error != ERROR_NONE && _error < ERROR_CRITICAL) {
     _error = ERROR_NONE;
@@ -92,21 +254,28 @@ void Fathym::beginUpdate(void) {
   // Record the time at which the update began
   _lastBeginUpdate = uptime;
 
+  // Take the system sample the timer asked for since the last cycle
+  sampleIfDue();
+
+  // Watch for heap allocations made by a running cycle, which fragment the heap over long uptimes
+  if (FATHYM_ADD_STATS) {
+    uint32_t freeMemory = System.freeMemory();
+    if (_lastFreeMemory != 0) {
+      _stats.heapDelta = (int32_t)(_lastFreeMemory - freeMemory);
+    }
+    _lastFreeMemory = freeMemory;
+  }
+
   // If it is time to resync device time to cloud network time, do so...
   if ((uptime - _lastTimeSync) / 60000 >= FATHYM_RESYNC_TIME_MINS) {
     Particle.syncTime();
     _lastTimeSync = uptime;
   }
 
-  // If we're using the device name, but don't have it yet, attempt to retrive the name
-  if (FATHYM_ADD_DEVICE_NAME && _name == NULL) {
-    while (_name == NULL) {
-      flash(3, 33);
-      // Subscribe to receive device name from Particle cloud
-      Particle.subscribe("spark/", &Fathym::nameHandler, this);
-      Particle.publish("spark/device/name");
-      delay(2000); // wait a little bit to receive the name
-    }
+  // If we're using the device name, but haven't heard it from the cloud yet, ask for it without waiting
+  if (FATHYM_ADD_DEVICE_NAME && !_nameReceived &&
+      (_lastNameRequest == 0 || uptime - _lastNameRequest >= FATHYM_NAME_RETRY_RATE * 1000UL)) {
+    requestName();
   }
 
   // If connected, update the underlying MQTT client message processing
@@ -120,26 +289,56 @@ void Fathym::beginUpdate(void) {
   else {
     reconnect();
   }
+
+  _stats.updateMicros = micros() - start;
 }
 
 // Ends a Fathym message update cycle.
 void Fathym::endUpdate(void) {
   if (FATHYM_AUTO_PUBLISH) {
-    // Publish the current message data
-    publish();
+    // Once rules are set, only publish when one fires or the baseline rate is due; in between, the
+    // values set each cycle keep updating (and aggregating into) the message. Bring in what was
+    // captured (or set concurrently) this cycle first, so a rule it fires publishes now.
+    if (_rules.count() > 0) {
+      drainChannels();
+    }
+
+    if (_rules.count() == 0 || _publishRequested || _lastPublish == 0 || millis() - _lastPublish >= _baselineRate * 1000UL) {
+      // Publish the current message data
+      bool published = publish();
+
+      // Slow down or speed back up depending on how the network is coping
+      if (FATHYM_ADAPTIVE_RATE) {
+        adaptRate(published);
+      }
+    }
+
+    // Publish the groups that are due
+    publishGroups();
+
+    // If set to report network latency and it is time to do so, publish it
+    if (FATHYM_ADD_LATENCY && millis() - _lastLatencyReport >= FATHYM_LATENCY_REPORT_RATE * 1000UL) {
+      publishLatency();
+    }
 
     // Start with the ideal update delay in milliseconds
-    unsigned long updateDelay = _publishRate * 1000; // convert from seconds to milliseconds
+    unsigned long updateDelay = _effectiveRate * 1000UL; // convert from seconds to milliseconds
 
     // Get current time
     unsigned long now = millis();
 
     // Get the delta time between the beginning of the update and now
-    long deltaTime = now - _lastBeginUpdate;
+    unsigned long deltaTime = now - _lastBeginUpdate;
 
     // Adjust the ideal delay by the delta time compensated amount
-    updateDelay -= deltaTime;
-    if (updateDelay < 0) updateDelay = 0;
+    if (deltaTime >= updateDelay) updateDelay = 0;
+    else updateDelay -= deltaTime;
+
+    // If configured to sleep between publishes and the wait is long enough to be worth it, sleep through it
+    if (FATHYM_SLEEP_MODE != FATHYM_SLEEP_NONE && updateDelay >= FATHYM_MIN_SLEEP * 1000UL) {
+      sleep(updateDelay);
+      return;
+    }
 
     // Set the target time to delay until before next publish
     unsigned long targetTime = now + updateDelay;
@@ -148,6 +347,22 @@ void Fathym::endUpdate(void) {
     // Wait until the next publish time but split it into chunks
     // so MQTT communications can update throughout.
     while (lastTime <= targetTime) {
+      // Send alerts as soon as they are raised instead of waiting for the next publish
+      if (alertPending()) {
+        publishAlerts();
+      }
+
+      // A publish requested while waiting (e.g. from an interrupt) starts the next cycle right away
+      if (requestWaiting()) {
+        return;
+      }
+
+      // Keep the system sample fresh through long waits
+      sampleIfDue();
+
+      // Groups keep their own rates, which can be faster than the publish rate
+      publishGroups();
+
       // Update MQTT communications
       int mqttMsgPerUpdate = MQTT_MESSAGES_PER_UPDATE;
       if (mqttMsgPerUpdate < 0) mqttMsgPerUpdate = 1; // make sure there is a positive number
@@ -163,7 +378,7 @@ void Fathym::endUpdate(void) {
       // Use whichever delay has the smallest increment
       long mqttUpdateRate = MQTT_UPDATE_RATE;
       if (mqttUpdateRate < 0) mqttUpdateRate = 1000; // make sure there is a positive update rate and if not, default to 1 second
-      long pubDelay = updateDelay < mqttUpdateRate ? updateDelay : mqttUpdateRate;
+      long pubDelay = updateDelay < (unsigned long)mqttUpdateRate ? (long)updateDelay : mqttUpdateRate;
 
       // Compensate for overdelay past the target delay time
       unsigned long nextTime = now + pubDelay;
@@ -176,7 +391,7 @@ void Fathym::endUpdate(void) {
       }
 
       // Delay until next loop
-      if (pubDelay > 0) delay((unsigned long)pubDelay);
+      if (pubDelay > 0) waitForAlert((unsigned long)pubDelay);
 
       // Update the last time to the current time
       lastTime = millis();
@@ -199,21 +414,52 @@ bool Fathym::connect(char * server, uint16_t port, char * username, char * passw
 
   // If the MQTT client hasn't been created yet, create it
   if (_mqtt == NULL) {
-    _mqtt = new MQTT(_server, _port, mqttReceiveHandler);
+    _mqtt = new MQTTSized<FATHYM_MQTT_TX_SIZE, FATHYM_MQTT_RX_SIZE>(_server, _port, mqttReceiveHandler);
     _mqtt->setKeepAlive(_keepAlive);
+    _mqtt->prepareTopic(_sendTopic);
+    _mqtt->addChunkCallback(mqttChunkHandler);
+
+#if MQTT_USE_TLS
+    // Run over TLS, keeping the session between connections so reconnects can resume it
+    _tls = new MQTTTlsTransport(new MQTTTcpTransport(), _server, _caPem);
+    _mqtt->setTransport(_tls);
+#elif MQTT_USE_SN
+    // Run over MQTT-SN/UDP through a gateway instead of a TCP connection
+    MQTTSnUdpTransport * sn = new MQTTSnUdpTransport();
+    if (FATHYM_SN_TOPIC_ID != 0) {
+      sn->setPredefinedTopic(_sendTopic, FATHYM_SN_TOPIC_ID);
+    }
+    sn->setConnectionless(FATHYM_SN_CONNECTIONLESS);
+    _mqtt->setTransport(sn);
+#endif
+
+    // Persistent sessions keep our subscription and queued messages on the broker between connections
+    _mqtt->setCleanSession(!FATHYM_PERSISTENT_SESSION);
+
+    // When waking from sleep, skip the DNS lookup on every reconnect
+    _mqtt->setAddressCaching(FATHYM_SLEEP_MODE != FATHYM_SLEEP_NONE);
   }
 
-  // Connect using the MQTT client
-  _mqtt->connect(_server, _username, _password);
+  // Connect using the MQTT client, identified by the device ID so the broker can keep its session
+  unsigned long start = millis();
+  _mqtt->connect(_id, _username, _password);
+  _stats.connectMillis = millis() - start;
 
   // Check for a valid connection state and report accordingly
   if (_mqtt->isConnected()) {
-    // Subscribe to receive messages
-    if (!_subscribed) {
-        _subscribed = _mqtt->subscribe(_receiveTopic);
+    // Announce the schema again on a new session
+    if (!FATHYM_PERSISTENT_SESSION) {
+      _schemaAnnounced = false;
     }
 
-    flash(8, 50);
+    // Subscribe to receive messages on every connect. MQTT 3.1 can't tell us whether the broker kept a
+    // persistent session, and subscribing again is harmless when it did.
+    _subscribed = _mqtt->subscribe(_receiveTopic);
+
+    // Reconnecting after sleep is routine, so only flash when staying awake
+    if (FATHYM_SLEEP_MODE == FATHYM_SLEEP_NONE) {
+      flash(8, 50);
+    }
     return true;
   }
   else {
@@ -225,17 +471,70 @@ bool Fathym::connect(char * server, uint16_t port, char * username, char * passw
 
 // Reconnects to the last known connection.
 bool Fathym::reconnect(void) {
+  _stats.reconnects++;
   _subscribed = false;
-  flash(4, 250);
+
+  // Reconnecting after sleep is routine, so only flash when staying awake
+  if (FATHYM_SLEEP_MODE == FATHYM_SLEEP_NONE) {
+    flash(4, 250);
+  }
+
   return connect(_server, _port, _username, _password);
 }
 
+// Sleeps the radio (or the MCU and radio) for the given number of milliseconds, ending the MQTT session cleanly first
+void Fathym::sleep(unsigned long duration) {
+  if (_mqtt != NULL && _mqtt->isConnected()) {
+    // Process anything still waiting, then say goodbye so the broker doesn't treat it as a dropped connection
+    _mqtt->loop();
+    _mqtt->disconnect();
+  }
+
+  // Record how long this cycle was awake
+  unsigned long now = millis();
+  _stats.awakeMillis = now - _lastWake;
+  _stats.sleeps++;
+
+  // Don't let the sample timer fire mid-sleep
+  _sampleTimer.stop();
+
+  if (FATHYM_SLEEP_MODE == FATHYM_SLEEP_STOP) {
+    // Stops the MCU and radio; execution continues here on wake up
+    System.sleep(FATHYM_WAKE_PIN, FATHYM_WAKE_EDGE, duration / 1000);
+  }
+  else {
+    // Turns the radio off for the duration while the application waits, waking it early for an alert
+    System.sleep(duration / 1000);
+    waitForAlert(duration);
+    if (_alerts.raised()) {
+      WiFi.on();
+      WiFi.connect();
+    }
+  }
+
+  _lastWake = millis();
+
+  // If the system sample went stale while asleep, refresh it before the next publish
+  if (_lastWake - _system.sampledAt >= FATHYM_SYSTEM_SAMPLE_RATE * 1000UL) {
+    sampleSystem();
+  }
+  _sampleTimer.start();
+
+  // Give the radio a chance to come back before the next cycle tries to reconnect
+  waitFor(WiFi.ready, FATHYM_WAKE_TIMEOUT);
+}
+
 // Determines whether or not Fathym is currently connected to the configured message broker.
 bool Fathym::isConnected(void) {
   if (_mqtt == NULL) return false;
   return _mqtt->isConnected();
 }
 
+// Sets the CA certificate (PEM, kept by reference) used to verify the broker over TLS; call before connect
+void Fathym::setCertificate(const char * caPem) {
+  _caPem = caPem;
+}
+
 // Sets the MQTT connection keep alive time in seconds
 void Fathym::setKeepAlive(uint16_t seconds) {
   // No change, nothing to do
@@ -250,19 +549,19 @@ void Fathym::setKeepAlive(uint16_t seconds) {
   // MQTT object is not initialized yet
   if (_mqtt == NULL) return;
 
-  // Set keep alive on underlying MQTT instance
+  // Set keep alive on underlying MQTT instance, which pings at the shorter of the old and new keep alive
+  // until the new one is agreed with the broker on the next connect (so no reconnect is needed here)
   _mqtt->setKeepAlive(_keepAlive);
-
-  // Reconnect after keep alive update to initiate new keep alive with broker
-  reconnect();
 }
 
 // Sets the publishing rate in seconds when auto-publishing is enabled.
 void Fathym::setPublishRate(uint16_t seconds) {
   if (_publishRate == seconds) return; // no change, nothing to do
 
-  // Update the rate
+  // Update the rate, starting over from it if the adaptive rate had backed off
   _publishRate = seconds;
+  _effectiveRate = seconds;
+  _cleanCycles = 0;
 
   // Make sure that the MQTT keep alive time is greater than the update cycle
   // otherwise the connection will continuously time out after one publish
@@ -271,6 +570,178 @@ void Fathym::setPublishRate(uint16_t seconds) {
   }
 }
 
+// Sets the publish rate in seconds used while publish rules are set and none of them fire
+void Fathym::setBaselineRate(uint16_t seconds) {
+  _baselineRate = seconds;
+}
+
+// Publishes as soon as the named value meets the condition (FATHYM_RULE_ABOVE, FATHYM_RULE_BELOW
+// or FATHYM_RULE_CHANGE per second) and again once it clears; routine publishing drops to the baseline rate
+bool Fathym::publishWhen(const char * name, uint8_t condition, float threshold) {
+  return publishWhen(name, condition, threshold, 0);
+}
+
+// Publishes as soon as the named value meets the condition and again once it has gone back past the
+// threshold by more than the hysteresis, so a noisy value doesn't publish on every sample
+bool Fathym::publishWhen(const char * name, uint8_t condition, float threshold, float hysteresis) {
+  return _rules.add(name, condition, threshold, hysteresis);
+}
+
+// Removes the publish rules of the named value
+void Fathym::removeRules(const char * name) {
+  _rules.remove(name);
+}
+
+// Publishes the message at the end of the current update cycle, or right after the wait if waiting
+// (safe from an interrupt)
+void Fathym::requestPublish(void) {
+  _publishRequested = true;
+}
+
+// Keeps a requested publish that failed for the next cycle, which starts after the normal (backed off) delay
+void Fathym::retryRequest(void) {
+  _publishRequested = true;
+  _requestFailed = true;
+}
+
+// Whether a requested publish should cut the wait between publishes short (not one that just failed,
+// which would otherwise be retried in a tight loop while the connection can't take it)
+bool Fathym::requestWaiting(void) {
+  return _publishRequested && !_requestFailed && isConnected();
+}
+
+// Gets the publish rate in seconds currently in use (slower than the one set while backing off from congestion)
+uint16_t Fathym::getPublishRate(void) {
+  return _effectiveRate;
+}
+
+// Backs the publish rate off when the last cycle showed congestion, otherwise steps back towards the configured rate
+void Fathym::adaptRate(bool published) {
+  if (_mqtt == NULL) return;
+
+  const MQTT::MQTT_STATS & mqtt = _mqtt->getStats();
+  uint32_t acks = _mqtt->getAckHistogram().count();
+  uint32_t pings = _mqtt->getRttHistogram().count();
+
+  bool congested = !published ||
+    _stats.reconnects != _lastReconnects ||
+    mqtt.writeErrors != _lastWriteErrors ||
+    _stats.publishMicros / 1000 > FATHYM_ADAPTIVE_SLOW_MILLIS ||
+    (acks != _lastAcks && mqtt.lastAckMillis > FATHYM_ADAPTIVE_SLOW_MILLIS) ||
+    (pings != _lastPings && mqtt.lastRttMillis > FATHYM_ADAPTIVE_SLOW_MILLIS);
+
+  _lastReconnects = _stats.reconnects;
+  _lastWriteErrors = mqtt.writeErrors;
+  _lastAcks = acks;
+  _lastPings = pings;
+
+  if (congested) {
+    // Back off quickly: double the time between publishes
+    _cleanCycles = 0;
+    if (_effectiveRate < FATHYM_ADAPTIVE_MAX_RATE) {
+      uint32_t rate = (uint32_t)_effectiveRate * 2;
+      _effectiveRate = rate > FATHYM_ADAPTIVE_MAX_RATE ? FATHYM_ADAPTIVE_MAX_RATE : rate;
+      _stats.backoffs++;
+    }
+  }
+  else if (_effectiveRate > _publishRate && ++_cleanCycles >= FATHYM_ADAPTIVE_RECOVERY_CYCLES) {
+    // Recover gradually: close a quarter of the gap back to the configured rate
+    _cleanCycles = 0;
+    uint16_t step = (_effectiveRate - _publishRate) / 4 + 1;
+    _effectiveRate -= step;
+  }
+}
+
+// Sets the default number of decimal places for values set without one
+void Fathym::setDecimalPlaces(uint8_t decimals) {
+  if (decimals > FATHYM_WRITER_MAX_DECIMALS) decimals = FATHYM_WRITER_MAX_DECIMALS;
+  _decimals = decimals;
+}
+
+// Sets which FATHYM_SYSTEM_* fields are included in each message
+void Fathym::setSystemFields(uint8_t fields) {
+  // Drop the values of fields being switched off so they aren't sent again
+  uint8_t removed = _systemFields & ~fields;
+  if (removed & FATHYM_SYSTEM_UPTIME) remove(FATHYM_UPTIME_PROPERTY);
+  if (removed & FATHYM_SYSTEM_FREE_MEMORY) remove(FATHYM_FREE_MEMORY_PROPERTY);
+  if (removed & FATHYM_SYSTEM_TIMESTAMP) remove(FATHYM_TIMESTAMP_PROPERTY);
+
+  uint8_t added = fields & ~_systemFields;
+  _systemFields = fields;
+
+  // Free memory is otherwise only sampled while the field is on, so don't publish a stale value until the next sample
+  if (added & FATHYM_SYSTEM_FREE_MEMORY) {
+    _system.freeMemory = System.freeMemory();
+  }
+}
+
+// Saves the runtime settings to EEPROM (only writing when they changed, to spare the flash); false if the write failed
+bool Fathym::saveConfig(void) {
+  FathymConfig config;
+  config.magic = FATHYM_CONFIG_MAGIC;
+  config.publishRate = _publishRate;
+  config.keepAlive = _keepAlive;
+  config.decimals = _decimals;
+  config.systemFields = _systemFields;
+
+  FathymConfig saved;
+  EEPROM.get(FATHYM_CONFIG_ADDRESS, saved);
+  if (memcmp(&saved, &config, sizeof(config)) == 0) {
+    return true;
+  }
+
+  // Read the settings back to make sure the write took
+  EEPROM.put(FATHYM_CONFIG_ADDRESS, config);
+  EEPROM.get(FATHYM_CONFIG_ADDRESS, saved);
+  return memcmp(&saved, &config, sizeof(config)) == 0;
+}
+
+// Restores runtime settings saved to EEPROM, if there are valid ones
+bool Fathym::loadConfig(void) {
+  FathymConfig config;
+  EEPROM.get(FATHYM_CONFIG_ADDRESS, config);
+  if (config.magic != FATHYM_CONFIG_MAGIC || !validConfig(config.publishRate, config.keepAlive, config.decimals)) {
+    return false;
+  }
+
+  setPublishRate(config.publishRate);
+  setKeepAlive(config.keepAlive);
+  setDecimalPlaces(config.decimals);
+  setSystemFields(config.systemFields);
+  return true;
+}
+
+// Counts up the boot id kept in EEPROM and starts numbering messages from 1 again
+void Fathym::nextBoot(void) {
+  FathymBoot boot;
+  EEPROM.get(FATHYM_BOOT_ADDRESS, boot);
+  if (boot.magic != FATHYM_BOOT_MAGIC) {
+    boot.magic = FATHYM_BOOT_MAGIC;
+    boot.id = 0;
+  }
+
+  boot.id++;
+  EEPROM.put(FATHYM_BOOT_ADDRESS, boot);
+  _bootId = boot.id;
+  _sequence = 0;
+}
+
+// Numbers the message being written with the next sequence number of this boot
+void Fathym::writeSequence(FathymWriter & writer) {
+  writeSequence(writer, _sequence);
+}
+
+// Writes the number following the given sequence number with the boot id. The sequence is only counted
+// up once the message is final, so messages that are never sent (debug prints, overflows) don't leave gaps.
+void Fathym::writeSequence(FathymWriter & writer, uint32_t sequence) {
+  writer.write(',');
+  writer.writeKey(FATHYM_BOOT_PROPERTY);
+  writer.writeUnsigned(_bootId);
+  writer.write(',');
+  writer.writeKey(FATHYM_SEQUENCE_PROPERTY);
+  writer.writeUnsigned(sequence + 1);
+}
+
 // Publishes a raw mesage payload to the connected message broker/server on the given topic.
 bool Fathym::publishRaw(const char * topic, const char * payload) {
   if (!isConnected()) {
@@ -291,85 +762,111 @@ bool Fathym::publishRaw(const char * topic, const char * payload) {
 
 // Publish the current message data to the connected message broker/server
 bool Fathym::publish(void) {
-  return publish(_sendTopic); // publish to the default send topic for the device
+  return publishMessage(NULL); // publish to the default send topic for the device
 }
 
 // Publish the current message data to the connected message broker/server
 bool Fathym::publish(const char * topic) {
+  return publishMessage(topic);
+}
+
+// Publish the current message data to the given topic, or the pre-encoded default send topic if NULL
+bool Fathym::publishMessage(const char * topic) {
   if (!isConnected()) {
     return false;
   }
 
-  JsonObject & json = *_json;
+  // Alerts jump ahead of routine data
+  if (alertPending()) {
+    publishAlerts();
+  }
+
   const char * payload;
+  size_t maxDataSize = FATHYM_MAX_MESSAGE_SIZE; // leave some size for the MQTT header
+  char buffer[maxDataSize]; // create a buffer of the max payload size
 
   // If there is no current error state, publish data
   if (_error == ERROR_NONE) {
-    // If configured to add the device's cloud name, include it
-    if (FATHYM_ADD_DEVICE_NAME) {
-      json[FATHYM_DEVICE_NAME_PROPERTY] = _name.c_str();
-    }
-
-    // If set to include the device uptime, include it
-    if (FATHYM_ADD_UPTIME) {
-      json[FATHYM_UPTIME_PROPERTY] = millis();
-      //set(FATHYM_UPTIME_PROPERTY, (long)millis(), "ms");
-    }
-
-    // If set to include device free memory, include it
-    if (FATHYM_ADD_FREE_MEMORY) {
-      json[FATHYM_FREE_MEMORY_PROPERTY] = System.freeMemory();
-      //set(FATHYM_FREE_MEMORY_PROPERTY, (int)System.freeMemory(), "bytes");
-    }
+    setSystemValues();
+  }
 
-    // Include battery information as configured
-    #ifdef FATHYM_USE_BATTERY_POWER
-
-    if (FATHYM_USE_BATTERY_POWER && FATHYM_MONITOR_BATTERY) {
-        // If set to include battery voltage, include it
-        if (FATHYM_ADD_BATTERY_VOLTAGE) {
-          json[FATHYM_BATTERY_VOLTAGE_PROPERTY] = lipo.getVoltage();
-          //set(FATHYM_BATTERY_VOLTAGE_PROPERTY, (float)lipo.getVoltage(), "v");
-        }
-
-        // If set to include battery charge level, include it
-        if (FATHYM_ADD_BATTERY_CHARGE) {
-          json[FATHYM_BATTERY_CHARGE_PROPERTY] = lipo.getSOC();
-          //set(FATHYM_BATTERY_CHARGE_PROPERTY, (float)lipo.getSOC(), "%");
-        }
-    }
+  // Bring in the values set since the last publish (possibly from interrupts or other threads) and the
+  // latest captured samples, even when publishing an error, so the double buffer never stays full
+  drainChannels();
 
-    #endif // FATHYM_USE_BATTERY_POWER
+  // This publish takes care of any publish requested so far
+  bool requested = _publishRequested.exchange(false);
+  _requestFailed = false;
 
-    // If set to use time stamp, add the current time stamp
-    if (FATHYM_ADD_TIMESTAMP) {
-      time_t time = Time.now();
-      _timeStamp = Time.format(time, TIME_FORMAT_ISO8601_FULL);
-      json[FATHYM_TIMESTAMP_PROPERTY] = _timeStamp.c_str();
-    }
+  // If using schema ids and the backend hasn't been sent the current schema, announce it first. The ids
+  // mean nothing without it, so keep the values for the next cycle when the announcement fails.
+  if (_error == ERROR_NONE && FATHYM_USE_SCHEMA && !schemaAnnounced() && !publishSchema(topic) && _error == ERROR_NONE) {
+    _stats.publishFailures++;
+    if (requested) retryRequest();
+    return false;
+  }
 
+  if (_error == ERROR_NONE) {
     // Serialize current message values
-    size_t maxDataSize = MQTT_MAX_PACKET_SIZE - MQTT_MAX_HEADER_SIZE; // leave some size for the MQTT header
-    char buffer[maxDataSize]; // create a buffer of the max payload size
+    unsigned long start = micros();
     payload = buffer;
-    size_t written = json.printTo(buffer, maxDataSize);
+    size_t written = serialize(buffer, maxDataSize, 0);
+
+    _stats.serializeMicros = micros() - start;
+    if (_stats.serializeMicros > _stats.maxSerializeMicros) {
+      _stats.maxSerializeMicros = _stats.serializeMicros;
+    }
 
-    // Check to see that the JSON object is properly terminated
-    if (buffer[written - 1] != '}') {
+    // Check to see that the whole message fit the buffer
+    if (written == 0) {
       _error = ERROR_JSON_BUFFER_MAX;
     }
   }
 
   // If there is an error, send an error message payload instead with the error code
   if (_error != ERROR_NONE) {
-    _errorJson = String("{\"" + _idProp + "\":\"" + _id + "\",\"error\":");
-    _errorJson.concat(_error);
-    _errorJson.concat("}");
-    payload = _errorJson.c_str();
+    FathymWriter writer(buffer, maxDataSize);
+    writer.write(_prefix, _prefixLength);
+    if (FATHYM_ADD_SEQUENCE) {
+      writeSequence(writer);
+    }
+    writer.write(",\"error\":");
+    writer.writeUnsigned(_error);
+    writer.write('}');
+    writer.finish();
+    payload = buffer;
   }
 
+  // The payload took the next sequence number
+  _sequence++;
+
   // Publish to the given topic on the connected message broker/server
-  bool success = _mqtt->publish(topic, payload);
+  unsigned long start = micros();
+  bool success = send(topic, payload);
+
+  _stats.publishMicros = micros() - start;
+  if (_stats.publishMicros > _stats.maxPublishMicros) {
+    _stats.maxPublishMicros = _stats.publishMicros;
+  }
+
+  if (success) {
+    _stats.publishes++;
+    _lastPublish = millis();
+    if (_stats.firstPublishMillis == 0) _stats.firstPublishMillis = _lastPublish;
+    if (requested) _stats.triggered++;
+
+    // Start a new aggregation window and series once the current ones have been delivered, or once
+    // the error for values too large to send has been (keeping them would overflow every publish)
+    if (_error == ERROR_NONE || _error == ERROR_JSON_BUFFER_MAX) {
+      _message.resetGroup(0);
+    }
+  }
+  else {
+    _stats.publishFailures++;
+
+    // Try again next cycle
+    if (requested) retryRequest();
+  }
 
   // If we're using LED pin debugging and the publish was successful flash the LED to indicate a publish
   if (FATHYM_DEBUG_SHOW_PUBLISH && success) {
@@ -386,6 +883,399 @@ bool Fathym::publish(const char * topic) {
   return success;
 }
 
+// Sets the system field values (uptime, free memory, battery and time stamp) as configured
+void Fathym::setSystemValues(void) {
+  // If set to include the device uptime, include it
+  if (_systemFields & FATHYM_SYSTEM_UPTIME) {
+    set(FATHYM_UPTIME_PROPERTY, (long)millis());
+  }
+
+  // If set to include device free memory, include it
+  if (_systemFields & FATHYM_SYSTEM_FREE_MEMORY) {
+    set(FATHYM_FREE_MEMORY_PROPERTY, (long)_system.freeMemory);
+  }
+
+  // Include battery information as configured (sampled at the sample rate by sampleSystem)
+  #ifdef FATHYM_USE_BATTERY_POWER
+
+  if (FATHYM_USE_BATTERY_POWER && FATHYM_MONITOR_BATTERY) {
+      // If set to include battery voltage, include it
+      if (FATHYM_ADD_BATTERY_VOLTAGE) {
+        set(FATHYM_BATTERY_VOLTAGE_PROPERTY, _system.batteryVoltage, (uint8_t)2);
+      }
+
+      // If set to include battery charge level, include it
+      if (FATHYM_ADD_BATTERY_CHARGE) {
+        set(FATHYM_BATTERY_CHARGE_PROPERTY, _system.batteryCharge, (uint8_t)2);
+      }
+  }
+
+  #endif // FATHYM_USE_BATTERY_POWER
+
+  // If set to use time stamp, add the current time stamp
+  if (_systemFields & FATHYM_SYSTEM_TIMESTAMP) {
+    formatTime(Time.now(), _timeStamp);
+    set(FATHYM_TIMESTAMP_PROPERTY, _timeStamp);
+  }
+}
+
+// Adds a publish group sending to the send topic followed by "." and the suffix every given number of
+// seconds; returns the group's number for group(), or 0 if there is no room for it
+uint8_t Fathym::addGroup(const char * suffix, uint16_t seconds) {
+  return addGroup(suffix, seconds, FATHYM_TELEMETRY_QOS);
+}
+
+// Adds a publish group with its own MQTT QoS level (0 or 1)
+uint8_t Fathym::addGroup(const char * suffix, uint16_t seconds, uint8_t qos) {
+  if (_groupCount >= FATHYM_MAX_GROUPS) {
+    _error = ERROR_MESSAGE_FULL;
+    return 0;
+  }
+
+  FathymGroup & group = _groups[_groupCount];
+  FathymWriter writer(group.topic, sizeof(group.topic));
+  writer.write(_sendTopic);
+  writer.write('.');
+  writer.write(suffix);
+  if (writer.finish() == 0) {
+    _error = ERROR_MESSAGE_FULL;
+    return 0;
+  }
+
+  group.rate = seconds > 0 ? seconds : 1;
+  group.effectiveRate = group.rate;
+  group.qos = qos;
+  group.lastAttempt = 0;
+  group.sequence = 0;
+  return ++_groupCount;
+}
+
+// Moves the named value (set now or later) into a publish group, or back into the main message with 0.
+// System fields can be moved too, except the time stamp which every message carries.
+bool Fathym::group(const char * name, uint8_t group) {
+  if (group > _groupCount || !_message.setGroup(name, group)) {
+    _error = ERROR_MESSAGE_FULL;
+    return false;
+  }
+  return true;
+}
+
+// Publishes the values of a group to its topic now, starting its next aggregation window and series
+bool Fathym::publishGroup(uint8_t group) {
+  if (group == 0 || group > _groupCount || !isConnected()) {
+    return false;
+  }
+
+  // Whatever comes of it, the next attempt waits for the group's rate
+  FathymGroup & g = _groups[group - 1];
+  g.lastAttempt = millis();
+
+  // The main message reports errors
+  if (_error != ERROR_NONE) {
+    return false;
+  }
+
+  setSystemValues();
+  drainChannels();
+
+  // Nothing has been set in the group yet
+  if (_message.count(group) == 0) {
+    return false;
+  }
+
+  // Hold the group's values until the schema their ids belong to has been announced
+  if (FATHYM_USE_SCHEMA && !schemaAnnounced() && !publishSchema(NULL)) {
+    _stats.publishFailures++;
+    if (FATHYM_ADAPTIVE_RATE) adaptGroupRate(g, false);
+    return false;
+  }
+
+  char buffer[FATHYM_MAX_MESSAGE_SIZE];
+  if (serialize(buffer, sizeof(buffer), group) == 0) {
+    // Drop what can't be sent rather than overflowing every publish of the group
+    _error = ERROR_JSON_BUFFER_MAX;
+    _message.resetGroup(group);
+    return false;
+  }
+
+  g.sequence++;
+  bool success = send(g.topic, buffer, FATHYM_TELEMETRY_RETAIN, g.qos);
+  if (success) {
+    _stats.publishes++;
+    _message.resetGroup(group);
+  }
+  else {
+    _stats.publishFailures++;
+  }
+
+  if (FATHYM_ADAPTIVE_RATE) adaptGroupRate(g, success);
+  return success;
+}
+
+// Backs a group's rate off after a failed publish, otherwise steps it back towards its configured rate
+void Fathym::adaptGroupRate(FathymGroup & group, bool published) {
+  if (!published) {
+    // Back off quickly: double the time between publishes
+    if (group.effectiveRate < FATHYM_ADAPTIVE_MAX_RATE) {
+      uint32_t rate = (uint32_t)group.effectiveRate * 2;
+      group.effectiveRate = rate > FATHYM_ADAPTIVE_MAX_RATE ? FATHYM_ADAPTIVE_MAX_RATE : rate;
+      _stats.backoffs++;
+    }
+  }
+  else if (group.effectiveRate > group.rate) {
+    // Recover gradually: close a quarter of the gap back to the configured rate
+    uint16_t step = (group.effectiveRate - group.rate) / 4 + 1;
+    group.effectiveRate -= step;
+  }
+}
+
+// Publishes each group whose rate is due
+void Fathym::publishGroups(void) {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < _groupCount; i++) {
+    if (_groups[i].lastAttempt == 0 || now - _groups[i].lastAttempt >= _groups[i].effectiveRate * 1000UL) {
+      publishGroup(i + 1);
+    }
+  }
+}
+
+// Caches the invariant start of every message (device ID and name) as pre-serialized JSON
+void Fathym::buildPrefix(void) {
+  FathymWriter writer(_prefix, sizeof(_prefix));
+  writer.write('{');
+  writer.writeKey(FATHYM_ID_PROPERTY);
+  writer.writeString(_id);
+
+  // If configured to add the device's cloud name, include it once it is known
+  if (FATHYM_ADD_DEVICE_NAME && _name[0] != 0) {
+    writer.write(',');
+    writer.writeKey(FATHYM_DEVICE_NAME_PROPERTY);
+    writer.writeString(_name);
+  }
+
+  _prefixLength = writer.finish();
+
+  // If the name didn't fit, fall back to the device ID only
+  if (_prefixLength == 0) {
+    FathymWriter idWriter(_prefix, sizeof(_prefix));
+    idWriter.write('{');
+    idWriter.writeKey(FATHYM_ID_PROPERTY);
+    idWriter.writeString(_id);
+    _prefixLength = idWriter.finish();
+  }
+}
+
+// Serializes the current message into the given buffer starting from the cached prefix (0 if it does not fit)
+size_t Fathym::serialize(char * buffer, size_t size, uint8_t group) {
+  FathymWriter writer(buffer, size);
+  writer.write(_prefix, _prefixLength);
+
+  // Each topic is numbered separately, so the receiver can follow it on its own
+  if (FATHYM_ADD_SEQUENCE) {
+    writeSequence(writer, group == 0 ? _sequence : _groups[group - 1].sequence);
+  }
+
+  // When using schema ids, identify the schema the ids belong to
+  if (FATHYM_USE_SCHEMA) {
+    writer.write(',');
+    writer.writeKey(FATHYM_SCHEMA_VERSION_PROPERTY);
+    writer.writeUnsigned(_message.schemaVersion());
+  }
+
+  // Group messages carry the time stamp of the main message
+  if (group != 0 && (_systemFields & FATHYM_SYSTEM_TIMESTAMP)) {
+    writer.write(',');
+    writer.writeKey(FATHYM_TIMESTAMP_PROPERTY);
+    writer.writeString(_timeStamp);
+  }
+
+  _message.writeTo(writer, FATHYM_USE_SCHEMA, group);
+
+  // If set to include the timing and traffic counters, include them
+  if (FATHYM_ADD_STATS && group == 0) {
+    writeStats(writer);
+  }
+
+  writer.write('}');
+  return writer.finish();
+}
+
+// Checks whether the backend has been sent the current schema on this connection
+bool Fathym::schemaAnnounced(void) {
+  return _schemaAnnounced && _announcedSchema == _message.schemaVersion();
+}
+
+// Publishes the mapping of schema ids to value names and units used by messages when FATHYM_USE_SCHEMA is set
+bool Fathym::publishSchema(void) {
+  return publishSchema(NULL);
+}
+
+// Publishes the schema to the given topic, or the pre-encoded default send topic if NULL
+bool Fathym::publishSchema(const char * topic) {
+  if (!isConnected()) {
+    return false;
+  }
+
+  char buffer[FATHYM_MAX_MESSAGE_SIZE];
+  FathymWriter writer(buffer, sizeof(buffer));
+  writer.write(_prefix, _prefixLength);
+
+  // Numbered with the routine messages on the same topic, so the backend can tell it lost the schema
+  if (FATHYM_ADD_SEQUENCE) {
+    writeSequence(writer);
+  }
+
+  writer.write(',');
+  writer.writeKey(FATHYM_SCHEMA_VERSION_PROPERTY);
+  writer.writeUnsigned(_message.schemaVersion());
+  writer.write(',');
+  writer.writeKey(FATHYM_SCHEMA_PROPERTY);
+  writer.write('{');
+  _message.writeSchemaTo(writer);
+  writer.write("}}");
+
+  if (writer.finish() == 0) {
+    _error = ERROR_JSON_BUFFER_MAX;
+    return false;
+  }
+
+  _sequence++;
+  bool success = send(topic, buffer);
+  if (success) {
+    _announcedSchema = _message.schemaVersion();
+    _schemaAnnounced = true;
+  }
+
+  return success;
+}
+
+// Writes a routine payload to the given topic, or the pre-encoded default send topic if NULL
+bool Fathym::send(const char * topic, const char * payload) {
+  return send(topic, payload, FATHYM_TELEMETRY_RETAIN, FATHYM_TELEMETRY_QOS);
+}
+
+// Writes a payload with the given retain flag and QoS to the given topic, or the pre-encoded default send topic if NULL
+bool Fathym::send(const char * topic, const char * payload, bool retain, uint8_t qos) {
+  uint16_t messageId;
+  MQTT::EMQTT_QOS level = qos > 0 ? MQTT::QOS1 : MQTT::QOS0;
+  if (topic == NULL) {
+    return _mqtt->publishPrepared((const uint8_t *)payload, strlen(payload), retain, level, &messageId);
+  }
+  return _mqtt->publish(topic, (const uint8_t *)payload, strlen(payload), retain, level, &messageId);
+}
+
+// Sets a boolean alert value and sends it right away
+bool Fathym::alert(const char * name, bool value) {
+  if (!_alerts.setBool(name, value)) _error = ERROR_MESSAGE_FULL;
+  return publishAlerts();
+}
+
+// Sets a string alert value and sends it right away
+bool Fathym::alert(const char * name, const char * value) {
+  if (!_alerts.setString(name, value)) _error = ERROR_MESSAGE_FULL;
+  return publishAlerts();
+}
+
+// Sets a decimal alert value and sends it right away
+bool Fathym::alert(const char * name, double value) {
+  if (!_alerts.setDouble(name, value, _decimals)) _error = ERROR_MESSAGE_FULL;
+  return publishAlerts();
+}
+
+// Sets a number alert value and sends it right away
+bool Fathym::alert(const char * name, int value) {
+  return alert(name, (long)value);
+}
+
+// Sets a number alert value and sends it right away
+bool Fathym::alert(const char * name, long value) {
+  if (!_alerts.setLong(name, value)) _error = ERROR_MESSAGE_FULL;
+  return publishAlerts();
+}
+
+// Raises a true alert value from an interrupt handler (name must be a string literal); sent by the update loop
+// within FATHYM_ALERT_POLL_RATE milliseconds, cutting short the wait for the next publish. Up to
+// FATHYM_MAX_ISR_ALERTS alerts can be raised between checks.
+void Fathym::alertFromISR(const char * name) {
+  _alerts.raise(name);
+}
+
+// Sends any alert values not sent yet, ahead of routine data
+bool Fathym::publishAlerts(void) {
+  // Pick up the alerts raised from interrupts
+  _alerts.collect();
+
+  if (_alerts.count() == 0) {
+    return true;
+  }
+
+  // Alerts stay waiting until they can be delivered
+  if (!isConnected()) {
+    return false;
+  }
+
+  char buffer[FATHYM_MAX_MESSAGE_SIZE];
+  FathymWriter writer(buffer, sizeof(buffer));
+  writer.write(_prefix, _prefixLength);
+
+  // Alerts share the sequence of the routine messages on the same topic
+  if (FATHYM_ADD_SEQUENCE) {
+    writeSequence(writer);
+  }
+
+  writer.write(',');
+  writer.writeKey(FATHYM_ALERT_PROPERTY);
+  writer.writeBool(true);
+
+  if (_systemFields & FATHYM_SYSTEM_TIMESTAMP) {
+    writer.write(',');
+    writer.writeKey(FATHYM_TIMESTAMP_PROPERTY);
+    char timeStamp[FATHYM_TIMESTAMP_SIZE];
+    formatTime(Time.now(), timeStamp);
+    writer.writeString(timeStamp);
+  }
+
+  // Alerts are rare and small, so they always use names rather than schema ids
+  _alerts.writeTo(writer);
+  writer.write('}');
+
+  if (writer.finish() == 0) {
+    _error = ERROR_JSON_BUFFER_MAX;
+    _alerts.clear();
+    return false;
+  }
+
+  _sequence++;
+  bool success = send(NULL, buffer, FATHYM_ALERT_RETAIN, FATHYM_ALERT_QOS);
+  if (success) {
+    // Don't let the alert sit behind coalesced output
+    _mqtt->flush();
+    _alerts.clear();
+    _stats.alerts++;
+  }
+
+  return success;
+}
+
+// Whether or not there are alerts waiting to be sent
+bool Fathym::alertPending(void) {
+  return _alerts.raised() || _alerts.count() > 0;
+}
+
+// Waits for the given number of milliseconds, returning early if an alert is raised or a publish requested
+void Fathym::waitForAlert(unsigned long duration) {
+  unsigned long start = millis();
+  unsigned long elapsed = 0;
+  while (elapsed < duration && !_alerts.raised() && !requestWaiting()) {
+    // Keep the sample channels from overrunning while waiting
+    drainChannels();
+
+    unsigned long remaining = duration - elapsed;
+    delay(remaining < FATHYM_ALERT_POLL_RATE ? remaining : FATHYM_ALERT_POLL_RATE);
+    elapsed = millis() - start;
+  }
+}
+
 // Receives an MQTT message
 void Fathym::receive(char * topic, byte * payload, unsigned int length) {
   char p[length + 1];
@@ -395,8 +1285,324 @@ void Fathym::receive(char * topic, byte * payload, unsigned int length) {
   JsonObject & msg = rxBuffer.parseObject(p);
 
   if (msg.success()) {
-    // TODO Process commands from server
+    // Ignore commands delivered more than once (sequenced ones only)
+    if (msg.containsKey(FATHYM_SEQUENCE_PROPERTY)) {
+      uint8_t order = _commandSequence.check(msg[FATHYM_BOOT_PROPERTY].as<long>(), msg[FATHYM_SEQUENCE_PROPERTY].as<long>());
+      if (order == FATHYM_SEQUENCE_DUPLICATE || order == FATHYM_SEQUENCE_STALE) {
+        return;
+      }
+    }
+
+    const char * command = msg[FATHYM_COMMAND_PROPERTY];
+
+    // Change settings at runtime
+    if (FATHYM_REMOTE_CONFIG && command != NULL && strcmp(command, FATHYM_CONFIG_PROPERTY) == 0) {
+      configure(msg);
+    }
+  }
+}
+
+// Applies a config command received from the server and replies with the resulting settings.
+// Settings not in the command are left as they are; if any given setting is invalid, nothing changes.
+void Fathym::configure(JsonObject & command) {
+  long publishRate = _publishRate;
+  long keepAlive = _keepAlive;
+  long decimals = _decimals;
+  uint8_t fields = _systemFields;
+  bool keepAliveGiven = command.containsKey("ka");
+
+  if (command.containsKey("rate")) publishRate = command["rate"].as<long>();
+  if (keepAliveGiven) keepAlive = command["ka"].as<long>();
+  if (command.containsKey("dec")) decimals = command["dec"].as<long>();
+
+  // Keep alive follows the publish rate unless given, the same way setPublishRate adjusts it
+  if (!keepAliveGiven && keepAlive <= publishRate) {
+    keepAlive = publishRate + (publishRate / 2);
+  }
+
+  if (!validConfig(publishRate, keepAlive, decimals)) {
+    publishConfig(false);
+    return;
+  }
+
+  if (command.containsKey("uptime")) {
+    fields = command["uptime"].as<bool>() ? fields | FATHYM_SYSTEM_UPTIME : fields & ~FATHYM_SYSTEM_UPTIME;
+  }
+  if (command.containsKey("mem")) {
+    fields = command["mem"].as<bool>() ? fields | FATHYM_SYSTEM_FREE_MEMORY : fields & ~FATHYM_SYSTEM_FREE_MEMORY;
+  }
+  if (command.containsKey("ts")) {
+    fields = command["ts"].as<bool>() ? fields | FATHYM_SYSTEM_TIMESTAMP : fields & ~FATHYM_SYSTEM_TIMESTAMP;
+  }
+
+  setPublishRate(publishRate);
+  setKeepAlive(keepAlive);
+  setDecimalPlaces(decimals);
+  setSystemFields(fields);
+
+  // Save unless told not to (e.g. a temporary change during an incident). The settings apply either
+  // way, but the reply reports a failed save so the backend knows they won't survive a reset.
+  bool saved = true;
+  if (FATHYM_PERSIST_CONFIG && (!command.containsKey("save") || command["save"].as<bool>())) {
+    saved = saveConfig();
+  }
+
+  publishConfig(saved);
+}
+
+// Whether or not the given settings can be used
+bool Fathym::validConfig(long publishRate, long keepAlive, long decimals) {
+  return publishRate >= FATHYM_MIN_PUBLISH_RATE && publishRate <= FATHYM_MAX_PUBLISH_RATE &&
+    keepAlive > publishRate && keepAlive <= 0xFFFF &&
+    decimals >= 0 && decimals <= FATHYM_WRITER_MAX_DECIMALS;
+}
+
+// Publishes the current runtime settings in reply to a config command
+bool Fathym::publishConfig(bool ok) {
+  if (!isConnected()) {
+    return false;
+  }
+
+  char buffer[FATHYM_MAX_PREFIX_SIZE + 96];
+  FathymWriter writer(buffer, sizeof(buffer));
+  writer.write(_prefix, _prefixLength);
+  writer.write(',');
+  writer.writeKey(FATHYM_CONFIG_PROPERTY);
+  writer.write("{\"rate\":");
+  writer.writeUnsigned(_publishRate);
+  writer.write(",\"ka\":");
+  writer.writeUnsigned(_keepAlive);
+  writer.write(",\"dec\":");
+  writer.writeUnsigned(_decimals);
+  writer.write(",\"uptime\":");
+  writer.writeBool(_systemFields & FATHYM_SYSTEM_UPTIME);
+  writer.write(",\"mem\":");
+  writer.writeBool(_systemFields & FATHYM_SYSTEM_FREE_MEMORY);
+  writer.write(",\"ts\":");
+  writer.writeBool(_systemFields & FATHYM_SYSTEM_TIMESTAMP);
+  writer.write("},\"ok\":");
+  writer.writeBool(ok);
+  writer.write('}');
+
+  if (writer.finish() == 0) {
+    return false;
+  }
+
+  return send(NULL, buffer);
+}
+
+// Receives a chunk of an MQTT message too large for the packet buffer
+void Fathym::receiveChunk(char * topic, uint32_t offset, uint8_t * chunk, uint16_t length, uint32_t total) {
+  if (_chunkHandler != NULL) {
+    _chunkHandler(topic, offset, chunk, length, total);
+  }
+}
+
+// Sets the handler that streams in messages too large for the MQTT packet buffer (config blobs, lookup tables)
+void Fathym::onChunk(FathymChunkHandler handler) {
+  _chunkHandler = handler;
+}
+
+// Gets the timing and traffic counters for the Fathym update/publish cycle
+const FathymStats & Fathym::getStats(void) {
+  return _stats;
+}
+
+// Gets the traffic counters of the underlying MQTT client (NULL if not yet connected)
+const MQTT::MQTT_STATS * Fathym::getMqttStats(void) {
+  if (_mqtt == NULL) return NULL;
+  return &_mqtt->getStats();
+}
+
+// Resets the timing and traffic counters
+void Fathym::resetStats(void) {
+  // The time to the first publish only happens once per boot
+  uint32_t firstPublishMillis = _stats.firstPublishMillis;
+  memset(&_stats, 0, sizeof(_stats));
+  _stats.firstPublishMillis = firstPublishMillis;
+  if (_mqtt != NULL) _mqtt->resetStats();
+}
+
+// Writes the timing and traffic counters as a nested object property
+void Fathym::writeStats(FathymWriter & writer) {
+  writer.write(',');
+  writer.writeKey(FATHYM_STATS_PROPERTY);
+  writer.write("{\"cyc\":");
+  writer.writeUnsigned(_stats.cycles);
+  writer.write(",\"pub\":");
+  writer.writeUnsigned(_stats.publishes);
+  writer.write(",\"pubErr\":");
+  writer.writeUnsigned(_stats.publishFailures);
+  writer.write(",\"rc\":");
+  writer.writeUnsigned(_stats.reconnects);
+  writer.write(",\"upd\":");
+  writer.writeUnsigned(_stats.updateMicros);
+  writer.write(",\"ser\":");
+  writer.writeUnsigned(_stats.serializeMicros);
+  writer.write(",\"wr\":");
+  writer.writeUnsigned(_stats.publishMicros);
+  writer.write(",\"con\":");
+  writer.writeUnsigned(_stats.connectMillis);
+  writer.write(",\"smp\":");
+  writer.writeUnsigned(_stats.sampleMicros);
+  writer.write(",\"alr\":");
+  writer.writeUnsigned(_stats.alerts);
+  writer.write(",\"first\":");
+  writer.writeUnsigned(_stats.firstPublishMillis);
+  writer.write(",\"heap\":");
+  writer.writeLong(_stats.heapDelta);
+
+  if (_rules.count() > 0) {
+    writer.write(",\"trig\":");
+    writer.writeUnsigned(_stats.triggered);
+  }
+
+#if FATHYM_CONCURRENT_VALUES
+  writer.write(",\"valDrop\":");
+  writer.writeUnsigned(_pending.dropped());
+#endif
+
+  if (_channelCount > 0) {
+    uint32_t overruns = 0;
+    for (uint8_t i = 0; i < _channelCount; i++) {
+      overruns += _channels[i]->overruns();
+    }
+    writer.write(",\"ovr\":");
+    writer.writeUnsigned(overruns);
+  }
+
+  if (_commandSequence.received() > 0) {
+    writer.write(",\"cmdLost\":");
+    writer.writeUnsigned(_commandSequence.lost());
+    writer.write(",\"cmdDup\":");
+    writer.writeUnsigned(_commandSequence.duplicates());
+  }
+
+  if (FATHYM_ADAPTIVE_RATE) {
+    writer.write(",\"rate\":");
+    writer.writeUnsigned(_effectiveRate);
+  }
+
+  if (FATHYM_SLEEP_MODE != FATHYM_SLEEP_NONE) {
+    writer.write(",\"awake\":");
+    writer.writeUnsigned(_stats.awakeMillis);
+  }
+
+  if (_mqtt != NULL) {
+    const MQTT::MQTT_STATS & mqtt = _mqtt->getStats();
+    writer.write(",\"in\":");
+    writer.writeUnsigned(mqtt.bytesIn);
+    writer.write(",\"out\":");
+    writer.writeUnsigned(mqtt.bytesOut);
+    writer.write(",\"drop\":");
+    writer.writeUnsigned(mqtt.packetsDropped);
+    writer.write(",\"wrErr\":");
+    writer.writeUnsigned(mqtt.writeErrors);
+    writer.write(",\"parse\":");
+    writer.writeUnsigned(mqtt.maxParseMicros);
+  }
+
+#if MQTT_USE_TLS
+  if (_tls != NULL) {
+    const MQTT_TLS_STATS & tls = _tls->getStats();
+    writer.write(",\"tls\":{\"hs\":");
+    writer.writeUnsigned(tls.handshakes);
+    writer.write(",\"res\":");
+    writer.writeUnsigned(tls.resumptions);
+    writer.write(",\"err\":");
+    writer.writeUnsigned(tls.failures);
+    writer.write(",\"full\":");
+    writer.writeUnsigned(tls.fullHandshakeMicros);
+    writer.write(",\"resume\":");
+    writer.writeUnsigned(tls.resumeMicros);
+    writer.write('}');
   }
+#endif
+
+  writer.write('}');
+}
+
+// Gets the id of this boot that published messages are tagged with
+uint32_t Fathym::getBootId(void) {
+  return _bootId;
+}
+
+// Gets the sequence number of the last message published this boot
+uint32_t Fathym::getSequence(void) {
+  return _sequence;
+}
+
+// Gets the gap and duplicate counts of sequenced commands received from the server
+const FathymSequence & Fathym::getCommandSequence(void) {
+  return _commandSequence;
+}
+
+// Gets the network round trip (PINGREQ/PINGRESP) latency histogram (NULL if not yet connected)
+const LatencyHistogram * Fathym::getRttHistogram(void) {
+  if (_mqtt == NULL) return NULL;
+  return &_mqtt->getRttHistogram();
+}
+
+// Gets the QoS publish acknowledgement latency histogram (NULL if not yet connected)
+const LatencyHistogram * Fathym::getAckHistogram(void) {
+  if (_mqtt == NULL) return NULL;
+  return &_mqtt->getAckHistogram();
+}
+
+// Publishes the network latency percentiles collected since the last report and starts a new report period
+bool Fathym::publishLatency(void) {
+  if (!isConnected()) {
+    return false;
+  }
+
+  _lastLatencyReport = millis();
+
+  const LatencyHistogram & rtt = _mqtt->getRttHistogram();
+  const LatencyHistogram & ack = _mqtt->getAckHistogram();
+
+  char payload[FATHYM_MAX_MESSAGE_SIZE];
+  FathymWriter writer(payload, sizeof(payload));
+  writer.write(_prefix, _prefixLength);
+
+  // Shares the sequence of the routine messages on the same topic
+  if (FATHYM_ADD_SEQUENCE) {
+    writeSequence(writer);
+  }
+
+  writer.write(',');
+  writer.writeKey(FATHYM_LATENCY_PROPERTY);
+  writer.write("{\"rttN\":");
+  writer.writeUnsigned(rtt.count());
+  writer.write(",\"rtt50\":");
+  writer.writeUnsigned(rtt.percentile(50));
+  writer.write(",\"rtt95\":");
+  writer.writeUnsigned(rtt.percentile(95));
+  writer.write(",\"rtt99\":");
+  writer.writeUnsigned(rtt.percentile(99));
+  writer.write(",\"ackN\":");
+  writer.writeUnsigned(ack.count());
+  writer.write(",\"ack50\":");
+  writer.writeUnsigned(ack.percentile(50));
+  writer.write(",\"ack95\":");
+  writer.writeUnsigned(ack.percentile(95));
+  writer.write(",\"ack99\":");
+  writer.writeUnsigned(ack.percentile(99));
+  writer.write("}}");
+
+  if (writer.finish() == 0) {
+    _error = ERROR_JSON_BUFFER_MAX;
+    return false;
+  }
+
+  _sequence++;
+  bool success = publishRaw(_sendTopic, payload);
+
+  // Start a new report period once the current one has been delivered
+  if (success) {
+    _mqtt->resetLatency();
+  }
+
+  return success;
 }
 
 // Flashes the debug LED pin a given number of flashes with a given millisecond delay between high/low
@@ -411,151 +1617,257 @@ void Fathym::flash(uint8_t numFlashes, uint8_t delayMs) {
   }
 }
 
+// Writes a number zero-padded to the given number of digits
+static char * writeDigits(char * p, unsigned long value, uint8_t digits) {
+  for (uint8_t i = digits; i > 0; i--) {
+    p[i - 1] = '0' + value % 10;
+    value /= 10;
+  }
+  return p + digits;
+}
+
+// Formats a time in the configured time zone like TIME_FORMAT_ISO8601_FULL (e.g. 2016-05-04T21:30:00-07:00)
+// into a FATHYM_TIMESTAMP_SIZE buffer, without the String that Time.format() allocates
+void Fathym::formatTime(time_t time, char * buffer) {
+  long offset = (long)(FATHYM_TIMEZONE_OFFSET * 3600L);
+  time_t local = time + offset;
+  struct tm parts;
+  gmtime_r(&local, &parts);
+
+  char * p = buffer;
+  p = writeDigits(p, parts.tm_year + 1900, 4);
+  *p++ = '-';
+  p = writeDigits(p, parts.tm_mon + 1, 2);
+  *p++ = '-';
+  p = writeDigits(p, parts.tm_mday, 2);
+  *p++ = 'T';
+  p = writeDigits(p, parts.tm_hour, 2);
+  *p++ = ':';
+  p = writeDigits(p, parts.tm_min, 2);
+  *p++ = ':';
+  p = writeDigits(p, parts.tm_sec, 2);
+
+  if (offset == 0) {
+    *p++ = 'Z';
+  }
+  else {
+    *p++ = offset < 0 ? '-' : '+';
+    if (offset < 0) offset = -offset;
+    p = writeDigits(p, offset / 3600, 2);
+    *p++ = ':';
+    p = writeDigits(p, offset / 60 % 60, 2);
+  }
+  *p = 0;
+}
+
 // Remove a value entry from the message
 void Fathym::remove(const char * name) {
-  JsonObject & json = *_json;
-  json.remove(name);
+  _message.remove(name);
 }
 
 // Sets a boolean message value
 void Fathym::set(const char * name, bool value) {
-  JsonObject & json = *_json;
-  json[name] = value;
+  stored(values().setBool(name, value));
 }
 
 // Sets a string message value
 void Fathym::set(const char * name, const char * value) {
-  JsonObject & json = *_json;
-  json[name] = value;
+  stored(values().setString(name, value));
 }
 
 // Sets a float message value
 void Fathym::set(const char * name, float value) {
-  set(name, value, FATHYM_DEFAULT_DECIMAL_PLACES);
+  set(name, value, _decimals);
 }
 
 // Sets a float message value and determines the number of decimal places to include
 void Fathym::set(const char * name, float value, uint8_t decimals) {
-  JsonObject & json = *_json;
-  json[name].set(value, decimals);
+  stored(values().setDouble(name, value, decimals, NULL));
+  check(name, value);
 }
 
 // Sets a double message value
 void Fathym::set(const char * name, double value) {
-  set(name, value, FATHYM_DEFAULT_DECIMAL_PLACES);
+  set(name, value, _decimals);
 }
 
 // Sets a double message value and determines the number of decimal places to include
 void Fathym::set(const char * name, double value, uint8_t decimals) {
-  JsonObject & json = *_json;
-  json[name].set(value, decimals);
+  stored(values().setDouble(name, value, decimals, NULL));
+  check(name, value);
 }
 
 // Sets an int message value
 void Fathym::set(const char * name, int value) {
-  JsonObject & json = *_json;
-  json[name] = value;
+  set(name, (long)value);
 }
 
 // Sets a long message value
 void Fathym::set(const char * name, long value) {
-  JsonObject & json = *_json;
-  json[name] = value;
+  stored(values().setLong(name, value, NULL));
+  check(name, value);
 }
 
 // Sets a float message value with the associated units
 void Fathym::set(const char * name, float value, const char * units) {
-  set(name, value, units, FATHYM_DEFAULT_DECIMAL_PLACES);
+  set(name, value, units, _decimals);
 }
 
 // Sets a float message value with the associated units and determines the number of decimal places to include
 void Fathym::set(const char * name, float value, const char * units, uint8_t decimals) {
-  JsonObject & json = *_json;
-
-  // Get the nested object for the value/units
-  JsonObject & nestedObj =  json[name];
-
-  // Create it if it doesn't exist
-  if (nestedObj == JsonObject::invalid()) {
-    JsonObject & newNested = json.createNestedObject(name);
-    newNested["value"].set(value, decimals);
-    newNested["units"] = units;
-  }
-  // Otherwise update the current object
-  else {
-    nestedObj["value"].set(value, decimals);
-    nestedObj["units"] = units;
-  }
+  stored(values().setDouble(name, value, decimals, units));
+  check(name, value);
 }
 
 // Sets a double message value with the associated units
 void Fathym::set(const char * name, double value, const char * units) {
-  set(name, value, units, FATHYM_DEFAULT_DECIMAL_PLACES);
+  set(name, value, units, _decimals);
 }
 
 // Sets a double message value with the associated unit sand determines the number of decimal places to include
 void Fathym::set(const char * name, double value, const char * units, uint8_t decimals) {
-  JsonObject & json = *_json;
-
-  // Get the nested object for the value/units
-  JsonObject & nestedObj =  json[name];
-
-  // Create it if it doesn't exist
-  if (nestedObj == JsonObject::invalid()) {
-    JsonObject & newNested = json.createNestedObject(name);
-    newNested["value"].set(value, decimals);
-    newNested["units"] = units;
-  }
-  // Otherwise update the current object
-  else {
-    nestedObj["value"].set(value, decimals);
-    nestedObj["units"] = units;
-  }
+  stored(values().setDouble(name, value, decimals, units));
+  check(name, value);
 }
 
 // Sets a int message value with the associated units
 void Fathym::set(const char * name, int value, const char * units) {
-  JsonObject & json = *_json;
+  set(name, (long)value, units);
+}
+
+// Sets a long message value with the associated units
+void Fathym::set(const char * name, long value, const char * units) {
+  stored(values().setLong(name, value, units));
+  check(name, value);
+}
+
+// Sets a fixed point message value that is already scaled by 10^decimals (e.g. 2153 with 2 decimals is 21.53)
+void Fathym::setFixed(const char * name, long value, uint8_t decimals) {
+  setFixed(name, value, decimals, NULL);
+}
 
-  // Get the nested object for the value/units
-  JsonObject & nestedObj =  json[name];
+// Sets a fixed point message value that is already scaled by 10^decimals with the associated units
+void Fathym::setFixed(const char * name, long value, uint8_t decimals, const char * units) {
+  stored(values().setFixed(name, value, decimals, units));
 
-  // Create it if it doesn't exist
-  if (nestedObj == JsonObject::invalid()) {
-    JsonObject & newNested = json.createNestedObject(name);
-    newNested["value"] = value;
-    newNested["units"] = units;
+  if (_rules.count() > 0) {
+    double scaled = value;
+    for (uint8_t i = 0; i < decimals; i++) scaled /= 10;
+    check(name, scaled);
   }
-  // Otherwise update the current object
-  else {
-    nestedObj["value"] = value;
-    nestedObj["units"] = units;
+}
+
+// Aggregates the values set between publishes into min/max/mean/standard deviation/count
+void Fathym::aggregate(const char * name) {
+  aggregate(name, NULL, _decimals);
+}
+
+// Aggregates the values set between publishes and determines the number of decimal places to include
+void Fathym::aggregate(const char * name, uint8_t decimals) {
+  aggregate(name, NULL, decimals);
+}
+
+// Aggregates the values set between publishes with the associated units
+void Fathym::aggregate(const char * name, const char * units) {
+  aggregate(name, units, _decimals);
+}
+
+// Aggregates the values set between publishes with the associated units and determines the number of decimal places to include
+void Fathym::aggregate(const char * name, const char * units, uint8_t decimals) {
+  if (!_message.aggregate(name, decimals, units)) _error = ERROR_MESSAGE_FULL;
+}
+
+// Buffers the values set between publishes as a compressed series of timestamped samples
+void Fathym::series(const char * name) {
+  series(name, NULL);
+}
+
+// Buffers the values set between publishes as a compressed series with the associated units
+void Fathym::series(const char * name, const char * units) {
+  if (!_message.series(name, units)) _error = ERROR_MESSAGE_FULL;
+
+#if FATHYM_CONCURRENT_VALUES
+  // Each value set is a sample to keep
+  _pending.keepEach(name);
+#endif
+}
+
+// Feeds the samples captured by a channel (e.g. from a timer interrupt) into the message value of the
+// given name: make it an aggregate or series first to keep every sample, otherwise it shows the latest
+bool Fathym::capture(const char * name, FathymChannel & channel) {
+  if (_channelCount >= FATHYM_MAX_CHANNELS) {
+    _error = ERROR_MESSAGE_FULL;
+    return false;
   }
+
+  channel.setClock(millis);
+  _channelNames[_channelCount] = name;
+  _channels[_channelCount] = &channel;
+  _channelCount++;
+  return true;
 }
 
-// Sets a long message value with the associated units
-void Fathym::set(const char * name, long value, const char * units) {
-  JsonObject & json = *_json;
+// Moves the samples captured since the last drain (and with concurrent values, the values set) into
+// the message (done while waiting between publishes and before each publish; call it often when
+// publishing manually)
+void Fathym::drainChannels(void) {
+  uint32_t fired = _rules.fired();
 
-  // Get the nested object for the value/units
-  JsonObject & nestedObj =  json[name];
+#if FATHYM_CONCURRENT_VALUES
+  // The rules are checked here as the values are merged, not as they are set from other contexts
+  if (!_pending.commit(_message, &_rules)) {
+    _error = ERROR_MESSAGE_FULL;
+  }
+#endif
 
-  // Create it if it doesn't exist
-  if (nestedObj == JsonObject::invalid()) {
-    JsonObject & newNested = json.createNestedObject(name);
-    newNested["value"] = value;
-    newNested["units"] = units;
+  for (uint8_t i = 0; i < _channelCount; i++) {
+    if (!_channels[i]->drainTo(_message, _channelNames[i], _decimals, &_rules)) {
+      _error = ERROR_MESSAGE_FULL;
+    }
   }
-  // Otherwise update the current object
-  else {
-    nestedObj["value"] = value;
-    nestedObj["units"] = units;
+
+  // A rule fired on one of the samples
+  if (_rules.fired() != fired) {
+    _publishRequested = true;
   }
 }
 
+// Checks a number being set against the publish rules, requesting a publish if one of them fires.
+// Concurrent values are checked by the publisher as they are merged (drainChannels()) instead.
+void Fathym::check(const char * name, double value) {
+#if FATHYM_CONCURRENT_VALUES
+  (void)name;
+  (void)value;
+#else
+  if (_rules.count() > 0 && _rules.check(name, (float)value, millis())) {
+    _publishRequested = true;
+  }
+#endif
+}
+
+// Notes whether a value set fit. A full message is an error, but a full double buffer only counts the
+// drop (valDrop): values are then set from interrupts and other threads, which mustn't race the publisher
+// on the error state.
+void Fathym::stored(bool success) {
+#if FATHYM_CONCURRENT_VALUES
+  (void)success;
+#else
+  if (!success) _error = ERROR_MESSAGE_FULL;
+#endif
+}
+
+// Gets where set() values go: the message itself, or the double buffer merged into it when publishing
+FathymValueStore & Fathym::values(void) {
+#if FATHYM_CONCURRENT_VALUES
+  return _pending;
+#else
+  return _message;
+#endif
+}
+
 // Prints the current fathym JSON data to the serial port for debugging
 void Fathym::printJson(void) {
-  JsonObject & json = *_json;
-  json.printTo(Serial);
-  Serial.println();
+  char buffer[FATHYM_MAX_MESSAGE_SIZE];
+  serialize(buffer, sizeof(buffer), 0);
+  Serial.println(buffer);
 }
@@ -35,6 +35,24 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 // MQTT library used for underlying message broker communication
 #include "MQTT.h"
+#include "MQTTTlsTransport.h"
+#include "MQTTSnTransport.h"
+
+// Fixed-capacity message values and the JSON writer used to publish them
+#include "FathymMessage.h"
+
+// Double-buffered values that can be set from interrupts and other threads
+#include "FathymSnapshot.h"
+
+// Interrupt-safe sample rings for capturing sensors faster than the loop runs
+#include "FathymChannel.h"
+#include "FathymAlerts.h"
+
+// Threshold and rate of change rules that publish as soon as a value crosses them
+#include "FathymRules.h"
+
+// Receive-side gap and duplicate detection of message sequence numbers
+#include "FathymSequence.h"
 
 // If this is a local Particle Dev build, reference dependencies/libraries differently
 #ifdef LOCAL_BUILD
@@ -67,6 +85,31 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define FATHYM_DEVICE_NAME_PROPERTY "name"
 #endif
 
+// The maximum size in bytes of the device name kept in EEPROM (including the terminator)
+#ifndef FATHYM_MAX_NAME_SIZE
+#define FATHYM_MAX_NAME_SIZE 32
+#endif
+
+// The EEPROM address the device name is kept at (after the boot id), so it is known from startup
+#ifndef FATHYM_NAME_ADDRESS
+#define FATHYM_NAME_ADDRESS 24
+#endif
+
+// How often (in seconds) to ask the cloud for the device name again until it arrives. Messages are
+// published without the name (or with the one kept in EEPROM) in the meantime.
+#ifndef FATHYM_NAME_RETRY_RATE
+#define FATHYM_NAME_RETRY_RATE 30
+#endif
+
+// The size in bytes of the device ID (24 hex digits) and of an ISO 8601 time stamp with its time zone
+#define FATHYM_DEVICE_ID_SIZE 25
+#define FATHYM_TIMESTAMP_SIZE 26
+
+// The maximum size in bytes of the cached message prefix holding the device ID and name
+#ifndef FATHYM_MAX_PREFIX_SIZE
+#define FATHYM_MAX_PREFIX_SIZE 96
+#endif
+
 // The default number of decimal places to include from numbers with decimal values
 #ifndef FATHYM_DEFAULT_DECIMAL_PLACES
 #define FATHYM_DEFAULT_DECIMAL_PLACES 3
@@ -112,6 +155,123 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define FATHYM_FREE_MEMORY_PROPERTY "mem"
 #endif
 
+// The rate (in seconds) at which system fields (free memory, battery) are sampled between publishes,
+// independent of the publish rate; publishing reads the last sampled values
+#ifndef FATHYM_SYSTEM_SAMPLE_RATE
+#define FATHYM_SYSTEM_SAMPLE_RATE 60
+#endif
+
+// Whether or not values may be set from interrupts or another thread while publishing. Values
+// set are then double buffered (see FathymSnapshot) and merged into the message while waiting and
+// when it is published, so it is serialized as a consistent snapshot; publish rules are checked by
+// the publisher as the values are merged. Up to FATHYM_MAX_PENDING values and
+// FATHYM_MAX_PENDING_SAMPLES series samples can be set between publishes; more are dropped and
+// counted (valDrop) rather than raising an error. aggregate() and series() must still be called
+// from the main loop.
+#ifndef FATHYM_CONCURRENT_VALUES
+#define FATHYM_CONCURRENT_VALUES false
+#endif
+
+// The maximum number of sample channels that can be captured into the message
+#ifndef FATHYM_MAX_CHANNELS
+#define FATHYM_MAX_CHANNELS 4
+#endif
+
+// Whether or not to number each published message, so the receiver can count lost and duplicate
+// messages (see FathymSequence) without QoS 1. The number restarts from 1 with every boot, which
+// is identified by a boot id kept in EEPROM (each wake from deep sleep is a new boot). Routine
+// messages, alerts, schema announcements and latency reports share the send topic's sequence; each
+// group topic has its own.
+#ifndef FATHYM_ADD_SEQUENCE
+#define FATHYM_ADD_SEQUENCE true
+#endif
+
+// The name of the message sequence number property to use
+#ifndef FATHYM_SEQUENCE_PROPERTY
+#define FATHYM_SEQUENCE_PROPERTY "seq"
+#endif
+
+// The name of the boot id property to use
+#ifndef FATHYM_BOOT_PROPERTY
+#define FATHYM_BOOT_PROPERTY "boot"
+#endif
+
+// The EEPROM address the boot id is kept at (after the runtime settings)
+#ifndef FATHYM_BOOT_ADDRESS
+#define FATHYM_BOOT_ADDRESS 16
+#endif
+
+// Whether or not to include the library's timing and traffic counters in the message
+#ifndef FATHYM_ADD_STATS
+#define FATHYM_ADD_STATS false
+#endif
+
+// The name of the timing and traffic counters property to use
+#ifndef FATHYM_STATS_PROPERTY
+#define FATHYM_STATS_PROPERTY "perf"
+#endif
+
+// Whether or not to periodically publish network round trip and acknowledgement latency percentiles
+#ifndef FATHYM_ADD_LATENCY
+#define FATHYM_ADD_LATENCY false
+#endif
+
+// The name of the network latency property to use
+#ifndef FATHYM_LATENCY_PROPERTY
+#define FATHYM_LATENCY_PROPERTY "net"
+#endif
+
+// The rate (in seconds) at which network latency percentiles are published
+#ifndef FATHYM_LATENCY_REPORT_RATE
+#define FATHYM_LATENCY_REPORT_RATE 300
+#endif
+
+// Whether or not to publish values keyed by small schema ids instead of their names and units.
+// The mapping of ids to names and units is published once after connecting and whenever it changes,
+// and values are only published by id once it has been. A value keeps its id until it is removed.
+#ifndef FATHYM_USE_SCHEMA
+#define FATHYM_USE_SCHEMA false
+#endif
+
+// The name of the schema property to use
+#ifndef FATHYM_SCHEMA_PROPERTY
+#define FATHYM_SCHEMA_PROPERTY "schema"
+#endif
+
+// The name of the schema version property to use
+#ifndef FATHYM_SCHEMA_VERSION_PROPERTY
+#define FATHYM_SCHEMA_VERSION_PROPERTY "sv"
+#endif
+
+// The MQTT QoS level (0 or 1) and retain flag for routine message data
+#ifndef FATHYM_TELEMETRY_QOS
+#define FATHYM_TELEMETRY_QOS 0
+#endif
+
+#ifndef FATHYM_TELEMETRY_RETAIN
+#define FATHYM_TELEMETRY_RETAIN false
+#endif
+
+// The MQTT QoS level (0 or 1) and retain flag for alerts, which are sent as soon as they are raised
+// instead of waiting for the next publish
+#ifndef FATHYM_ALERT_QOS
+#define FATHYM_ALERT_QOS 1
+#endif
+
+#ifndef FATHYM_ALERT_RETAIN
+#define FATHYM_ALERT_RETAIN false
+#endif
+
+// The name of the property that marks a message as an alert
+#ifndef FATHYM_ALERT_PROPERTY
+#define FATHYM_ALERT_PROPERTY "alert"
+#endif
+
+// How often (in milliseconds) the wait between publishes checks for alerts raised from interrupts
+#ifndef FATHYM_ALERT_POLL_RATE
+#define FATHYM_ALERT_POLL_RATE 10
+#endif
+
 // Whether or not the Fathym library will automatically handle publishing data or not
 #ifndef FATHYM_AUTO_PUBLISH
 #define FATHYM_AUTO_PUBLISH true
@@ -122,10 +282,142 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define FATHYM_PUBLISH_RATE 10
 #endif
 
-// Default to standard MQTT port
+// The publish rate (in seconds) used once publish rules are added: values are still set every
+// FATHYM_PUBLISH_RATE seconds, but only published when a rule fires or this long after the last publish
+#ifndef FATHYM_BASELINE_RATE
+#define FATHYM_BASELINE_RATE 300
+#endif
+
+// The maximum number of publish groups, each sending its values to its own topic at its own rate
+#ifndef FATHYM_MAX_GROUPS
+#define FATHYM_MAX_GROUPS 4
+#endif
+
+// The maximum length of a publish group's topic (the send topic, a dot and the group's suffix)
+#ifndef FATHYM_MAX_TOPIC_SIZE
+#define FATHYM_MAX_TOPIC_SIZE 64
+#endif
+
+// Whether or not to slow the publish rate down when the network shows congestion (failed or slow writes,
+// reconnects, slow acknowledgements or pings) and speed it back up gradually once the link recovers.
+// Aggregated and series values keep collecting everything set in between, so a slower rate batches them.
+// Publish groups back off their own rates the same way when their publishes fail.
+#ifndef FATHYM_ADAPTIVE_RATE
+#define FATHYM_ADAPTIVE_RATE false
+#endif
+
+// The slowest publish rate (in seconds) the adaptive rate will back off to
+#ifndef FATHYM_ADAPTIVE_MAX_RATE
+#define FATHYM_ADAPTIVE_MAX_RATE 600
+#endif
+
+// A publish write, acknowledgement or ping taking longer than this (in milliseconds) counts as congestion
+#ifndef FATHYM_ADAPTIVE_SLOW_MILLIS
+#define FATHYM_ADAPTIVE_SLOW_MILLIS 2000
+#endif
+
+// The number of uncongested publishes between each step back towards the configured publish rate
+#ifndef FATHYM_ADAPTIVE_RECOVERY_CYCLES
+#define FATHYM_ADAPTIVE_RECOVERY_CYCLES 3
+#endif
+
+// Whether or not the publish rate, keep alive, decimal places and system fields can be changed at runtime
+// with a config command sent to the device's receive topic, e.g.
+// {"cmd":"config","rate":30,"ka":60,"dec":2,"uptime":true,"mem":false,"ts":true,"save":true}
+#ifndef FATHYM_REMOTE_CONFIG
+#define FATHYM_REMOTE_CONFIG true
+#endif
+
+// The allowed range (in seconds) for a publish rate set by a config command
+#ifndef FATHYM_MIN_PUBLISH_RATE
+#define FATHYM_MIN_PUBLISH_RATE 1
+#endif
+
+#ifndef FATHYM_MAX_PUBLISH_RATE
+#define FATHYM_MAX_PUBLISH_RATE 3600
+#endif
+
+// Whether or not settings changed at runtime are saved to EEPROM and restored on startup
+#ifndef FATHYM_PERSIST_CONFIG
+#define FATHYM_PERSIST_CONFIG true
+#endif
+
+// The EEPROM address the runtime settings are saved at
+#ifndef FATHYM_CONFIG_ADDRESS
+#define FATHYM_CONFIG_ADDRESS 0
+#endif
+
+// The name of the command property of messages received by the device
+#ifndef FATHYM_COMMAND_PROPERTY
+#define FATHYM_COMMAND_PROPERTY "cmd"
+#endif
+
+// The name of the config property used for config commands and their replies
+#ifndef FATHYM_CONFIG_PROPERTY
+#define FATHYM_CONFIG_PROPERTY "config"
+#endif
+
+// Low-power modes to use between publishes (applies when FATHYM_AUTO_PUBLISH is set to true)
+#define FATHYM_SLEEP_NONE  0 // stay awake, servicing MQTT communications while waiting
+#define FATHYM_SLEEP_RADIO 1 // turn the Wi-Fi radio off while waiting
+#define FATHYM_SLEEP_STOP  2 // stop the MCU and radio until the next publish (or the wake pin)
+
+// The low-power mode to use between publishes
+#ifndef FATHYM_SLEEP_MODE
+#define FATHYM_SLEEP_MODE FATHYM_SLEEP_NONE
+#endif
+
+// The shortest wait (in seconds) worth sleeping through, shorter waits stay awake
+#ifndef FATHYM_MIN_SLEEP
+#define FATHYM_MIN_SLEEP 5
+#endif
+
+// The pin and edge that can wake the device early from FATHYM_SLEEP_STOP
+#ifndef FATHYM_WAKE_PIN
+#define FATHYM_WAKE_PIN D1
+#endif
+
+#ifndef FATHYM_WAKE_EDGE
+#define FATHYM_WAKE_EDGE RISING
+#endif
+
+// The maximum time (in milliseconds) to wait for the network after waking
+#ifndef FATHYM_WAKE_TIMEOUT
+#define FATHYM_WAKE_TIMEOUT 10000
+#endif
+
+// Whether or not the broker keeps the MQTT session (and its subscription) between connections,
+// so QoS 1 messages sent while asleep are queued for the device (it still resubscribes on every connect)
+#ifndef FATHYM_PERSISTENT_SESSION
+#define FATHYM_PERSISTENT_SESSION (FATHYM_SLEEP_MODE != FATHYM_SLEEP_NONE)
+#endif
+
+// Default to standard MQTT port (or the standard MQTT over TLS / MQTT-SN gateway port)
 #ifndef FATHYM_DEFAULT_PORT
+#if MQTT_USE_TLS
+#define FATHYM_DEFAULT_PORT 8883
+#elif MQTT_USE_SN
+#define FATHYM_DEFAULT_PORT 1884
+#else
 #define FATHYM_DEFAULT_PORT 1883
 #endif
+#endif
+
+#if MQTT_USE_TLS && MQTT_USE_SN
+#error "MQTT_USE_TLS and MQTT_USE_SN can't be used together"
+#endif
+
+// When using MQTT-SN, the topic ID predefined on the gateway for the send topic
+// (0 registers the topic with the gateway on the first publish)
+#ifndef FATHYM_SN_TOPIC_ID
+#define FATHYM_SN_TOPIC_ID 0
+#endif
+
+// When using MQTT-SN, whether to publish without connecting to the gateway (QoS -1).
+// Needs FATHYM_SN_TOPIC_ID; nothing can be received (no remote commands or config).
+#ifndef FATHYM_SN_CONNECTIONLESS
+#define FATHYM_SN_CONNECTIONLESS false
+#endif
 
 // The rate at which the MQTT communication loop updates in milliseconds.
 // This includes ping/keep alive/QoS/receiving messages. It runs on a
@@ -153,13 +445,37 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define MQTT_MAX_HEADER_SIZE 160
 #endif
 
-// The reserved buffer size in bytes for MQTT data packet buffer.
+// The reserved buffer size in bytes for the outbound MQTT packet buffer.
 // The maximum buffer size available to serialize JSON messages to string
-// is determined by the MQTT_MAX_PACKET_SIZE - MQTT_MAX_HEADER_SIZE.
-#ifndef MQTT_MAX_PACKET_SIZE
-#define MQTT_MAX_PACKET_SIZE 640
+// is determined by the FATHYM_MQTT_TX_SIZE - MQTT_MAX_HEADER_SIZE (see FATHYM_MAX_MESSAGE_SIZE).
+#ifndef FATHYM_MQTT_TX_SIZE
+#define FATHYM_MQTT_TX_SIZE 640
+#endif
+
+// The reserved buffer size in bytes for the inbound MQTT packet buffer.
+// Larger inbound messages are only delivered through onChunk().
+#ifndef FATHYM_MQTT_RX_SIZE
+#define FATHYM_MQTT_RX_SIZE 640
 #endif
 
+static_assert(FATHYM_MQTT_TX_SIZE > MQTT_MAX_HEADER_SIZE, "FATHYM_MQTT_TX_SIZE must leave room for messages after MQTT_MAX_HEADER_SIZE");
+
+// The buffer size in bytes messages are serialized to. Over MQTT-SN a message also has to fit one
+// publish datagram, after its long form header (4 bytes) and the flags, topic ID and message ID (5 bytes).
+#if MQTT_USE_SN && MQTT_SN_MAX_PACKET_SIZE - 8 < FATHYM_MQTT_TX_SIZE - MQTT_MAX_HEADER_SIZE
+#define FATHYM_MAX_MESSAGE_SIZE (MQTT_SN_MAX_PACKET_SIZE - 8)
+#else
+#define FATHYM_MAX_MESSAGE_SIZE (FATHYM_MQTT_TX_SIZE - MQTT_MAX_HEADER_SIZE)
+#endif
+
+// Message room taken by a full series: its base64 data and the JSON around it with a name of up to 16
+// characters (units not included), and by the message prefix with the boot id and sequence number
+#define FATHYM_SERIES_JSON_SIZE (((FATHYM_SERIES_BUFFER_SIZE) + 2) / 3 * 4 + 80)
+#define FATHYM_PREFIX_JSON_SIZE (FATHYM_MAX_PREFIX_SIZE + 40)
+
+static_assert(FATHYM_MAX_SERIES * FATHYM_SERIES_JSON_SIZE + FATHYM_PREFIX_JSON_SIZE <= FATHYM_MAX_MESSAGE_SIZE,
+  "FATHYM_MAX_SERIES full series of FATHYM_SERIES_BUFFER_SIZE bytes must fit a message (raise FATHYM_MQTT_TX_SIZE, or MQTT_SN_MAX_PACKET_SIZE over MQTT-SN, or lower them)");
+
 // Whether or not to use the defined debug pin for Fathym visual status debugging
 #ifndef FATHYM_USE_DEBUG_LED
 #define FATHYM_USE_DEBUG_LED true
@@ -183,6 +499,7 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 // Device error states
 #define ERROR_NONE            0
 #define ERROR_JSON_BUFFER_MAX 1
+#define ERROR_MESSAGE_FULL    2
 #define ERROR_CRITICAL        128
 
 //==== Battery Shield ===========================================================================
@@ -228,10 +545,95 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #endif // end FATHYM_USE_BATTERY_POWER
 
+// Timing and traffic counters for the Fathym update/publish cycle
+typedef struct {
+  uint32_t cycles; // number of update cycles started
+  uint32_t publishes; // successful publishes
+  uint32_t publishFailures; // failed publishes
+  uint32_t reconnects; // reconnect attempts
+  uint32_t updateMicros; // duration of the last beginUpdate
+  uint32_t serializeMicros; // duration of the last message serialization
+  uint32_t maxSerializeMicros; // longest message serialization
+  uint32_t publishMicros; // duration of the last MQTT publish write
+  uint32_t maxPublishMicros; // longest MQTT publish write
+  uint32_t connectMillis; // duration of the last connect/reconnect
+  uint32_t awakeMillis; // time awake in the last cycle before sleeping
+  uint32_t sleeps; // number of times slept between publishes
+  uint32_t sampleMicros; // duration of the last system field sample
+  uint32_t alerts; // alert messages sent
+  uint32_t backoffs; // times the adaptive rate slowed publishing down
+  uint32_t triggered; // publishes made early because a rule fired or one was requested
+  uint32_t firstPublishMillis; // uptime when the first message was published (0 until then)
+  int32_t heapDelta; // bytes of heap taken over the last update cycle (0 once running, when stats are added)
+} FathymStats;
+
+// System field values sampled in the background and read when publishing
+typedef struct {
+  volatile uint32_t freeMemory; // free memory in bytes
+  volatile float batteryVoltage; // battery voltage
+  volatile float batteryCharge; // battery state of charge (percent)
+  volatile unsigned long sampledAt; // uptime of the last sample
+} FathymSystemSample;
+
+// System fields that can be switched on and off at runtime
+#define FATHYM_SYSTEM_UPTIME      0x01
+#define FATHYM_SYSTEM_FREE_MEMORY 0x02
+#define FATHYM_SYSTEM_TIMESTAMP   0x04
+
+// Identifies runtime settings saved to EEPROM (change when the layout of FathymConfig changes)
+#define FATHYM_CONFIG_MAGIC 0xFA01
+
+// Runtime settings as saved to EEPROM
+typedef struct {
+  uint16_t magic; // FATHYM_CONFIG_MAGIC when the settings have been saved
+  uint16_t publishRate; // publish rate in seconds
+  uint16_t keepAlive; // MQTT keep alive in seconds
+  uint8_t decimals; // default decimal places
+  uint8_t systemFields; // FATHYM_SYSTEM_* fields to include
+} FathymConfig;
+
+// Identifies the boot id saved to EEPROM
+#define FATHYM_BOOT_MAGIC 0xFB01
+
+// Boot id as saved to EEPROM, counted up on every startup
+typedef struct {
+  uint16_t magic; // FATHYM_BOOT_MAGIC once a boot id has been saved
+  uint32_t id; // id of the current boot
+} FathymBoot;
+
+// Values published to their own topic at their own rate
+typedef struct {
+  char topic[FATHYM_MAX_TOPIC_SIZE]; // the send topic followed by the group's suffix
+  uint16_t rate; // publish rate in seconds
+  uint16_t effectiveRate; // publish rate in use, slower than rate while backing off from failed publishes
+  uint8_t qos; // MQTT QoS level (0 or 1)
+  unsigned long lastAttempt; // uptime of the last publish attempt, successful or not (0 before the first)
+  uint32_t sequence; // number of the last message published to the topic this boot
+} FathymGroup;
+
+// Identifies the device name saved to EEPROM
+#define FATHYM_NAME_MAGIC 0xFC01
+
+// Device name as saved to EEPROM, updated whenever the cloud reports a different one
+typedef struct {
+  uint16_t magic; // FATHYM_NAME_MAGIC once a name has been saved
+  char name[FATHYM_MAX_NAME_SIZE];
+} FathymName;
+
+// Where values set through Fathym::set() go: straight into the message, or through the double buffer
+#if FATHYM_CONCURRENT_VALUES
+typedef FathymSnapshot FathymValueStore;
+#else
+typedef FathymMessage FathymValueStore;
+#endif
+
 // Fathym API class
 class Fathym;
 typedef void (Fathym::*MQTT_HANDLER)(const char * payload);
 
+// Handler for inbound messages too large for the MQTT packet buffer, called once per chunk as it arrives
+typedef void (*FathymChunkHandler)(const char * topic, uint32_t offset, const uint8_t * chunk, uint16_t length, uint32_t total);
+
 // Main Fathym class that provides singleton-like access to the API
 class Fathym {
 public:
@@ -251,12 +653,30 @@ public:
   bool connect(char * server, uint16_t port, char * username, char * password);
   bool isConnected(void);
   void setKeepAlive(uint16_t seconds);
+  void setCertificate(const char * caPem);
+
+  // Runtime settings
+  void setDecimalPlaces(uint8_t decimals);
+  void setSystemFields(uint8_t fields);
+  bool saveConfig(void);
+  bool loadConfig(void);
 
   // Message
   void setPublishRate(uint16_t seconds);
+  uint16_t getPublishRate(void);
+  void setBaselineRate(uint16_t seconds);
+  bool publishWhen(const char * name, uint8_t condition, float threshold);
+  bool publishWhen(const char * name, uint8_t condition, float threshold, float hysteresis);
+  void removeRules(const char * name);
+  void requestPublish(void);
+  uint8_t addGroup(const char * suffix, uint16_t seconds);
+  uint8_t addGroup(const char * suffix, uint16_t seconds, uint8_t qos);
+  bool group(const char * name, uint8_t group);
+  bool publishGroup(uint8_t group);
   bool publishRaw(const char * topic, const char * payload);
   bool publish(void);
   bool publish(const char * topic);
+  bool publishSchema(void);
   void remove(const char * name);
   void set(const char * name, bool value);
   void set(const char * name, const char * value);
@@ -272,25 +692,74 @@ public:
   void set(const char * name, double value, const char * units, uint8_t decimals);
   void set(const char * name, int value, const char * units);
   void set(const char * name, long value, const char * units);
+  void setFixed(const char * name, long value, uint8_t decimals);
+  void setFixed(const char * name, long value, uint8_t decimals, const char * units);
+  void aggregate(const char * name);
+  void aggregate(const char * name, uint8_t decimals);
+  void aggregate(const char * name, const char * units);
+  void aggregate(const char * name, const char * units, uint8_t decimals);
+  void series(const char * name);
+  void series(const char * name, const char * units);
+  bool capture(const char * name, FathymChannel & channel);
+  void drainChannels(void);
   void printJson(void);
+
+  // Alerts
+  bool alert(const char * name, bool value);
+  bool alert(const char * name, const char * value);
+  bool alert(const char * name, double value);
+  bool alert(const char * name, int value);
+  bool alert(const char * name, long value);
+  void alertFromISR(const char * name);
+  bool publishAlerts(void);
   void receive(char * topic, byte * payload, unsigned int length);
+  void receiveChunk(char * topic, uint32_t offset, uint8_t * chunk, uint16_t length, uint32_t total);
+  void onChunk(FathymChunkHandler handler);
+
+  // Instrumentation
+  const FathymStats & getStats(void);
+  const MQTT::MQTT_STATS * getMqttStats(void);
+  void resetStats(void);
+  const LatencyHistogram * getRttHistogram(void);
+  const LatencyHistogram * getAckHistogram(void);
+  bool publishLatency(void);
+  uint32_t getBootId(void);
+  uint32_t getSequence(void);
+  const FathymSequence & getCommandSequence(void);
 
 private:
   // Initialize
   void init(char * server, uint16_t port, char * username, char * password);
 
   // Device
-  String _id; // stores the device's ID
-  String _idProp = FATHYM_ID_PROPERTY; // the property name to use for the device ID
-  String _name; // stores the device's name
-  String _timeStamp; // stores the current timestamp string for the last publish
+  char _id[FATHYM_DEVICE_ID_SIZE]; // stores the device's ID
+  char _name[FATHYM_MAX_NAME_SIZE]; // stores the device's name
+  bool _nameReceived; // whether the cloud has reported the name this boot
+  bool _nameSubscribed; // whether the cloud name event has been subscribed to
+  unsigned long _lastNameRequest; // uptime of the last request for the name (0 before the first)
+  void requestName(void);
+  void loadName(void);
+  void saveName(void);
+  char _timeStamp[FATHYM_TIMESTAMP_SIZE]; // stores the current timestamp string for the last publish
   uint16_t _publishRate; // rate (in seconds) at which auto-publishing occurs if it is enabled
+  uint16_t _effectiveRate; // publish rate (in seconds) in use, slower than _publishRate while backing off
+  uint8_t _cleanCycles; // uncongested publishes since the last adaptive rate change
+  uint32_t _lastReconnects; // counters at the last adaptive rate check, to see what changed since
+  uint32_t _lastWriteErrors;
+  uint32_t _lastAcks;
+  uint32_t _lastPings;
+  void adaptRate(bool published);
+  uint16_t _baselineRate; // rate (in seconds) at which auto-publishing occurs while rules are set and none fire
+  unsigned long _lastPublish; // uptime of the last successful publish
+  uint8_t _decimals; // default number of decimal places
+  uint8_t _systemFields; // FATHYM_SYSTEM_* fields included in each message
   unsigned long _lastTimeSync; // used to resync to cloud network time to avoid local time drift
   unsigned long _lastBeginUpdate; // used to adjust delay compensation to attempt to regulate a more stable update/publish rate
-  String _sendTopic; // the device-specific send topic
-  String _receiveTopic; // the device-specific receive topic
+  char _sendTopic[FATHYM_MAX_TOPIC_SIZE]; // the device-specific send topic
+  char _receiveTopic[FATHYM_MAX_TOPIC_SIZE]; // the device-specific receive topic
   uint8_t _error; // used to indicate the error state of the device (if any)
-  String _errorJson; // string used to send a device error message
+  char _prefix[FATHYM_MAX_PREFIX_SIZE]; // pre-serialized start of every message (device ID and name)
+  size_t _prefixLength; // length of the pre-serialized message prefix
 
   // Connection
   char * _server;
@@ -300,17 +769,82 @@ private:
   MQTT * _mqtt;
   uint16_t _keepAlive;
   bool _subscribed;
+  const char * _caPem; // CA certificate (PEM) the broker is verified against when using TLS
+#if MQTT_USE_TLS
+  MQTTTlsTransport * _tls; // owned by _mqtt
+#endif
+  FathymChunkHandler _chunkHandler; // receives large inbound messages in chunks (NULL drops them)
   bool reconnect(void);
+  void sleep(unsigned long duration);
+  unsigned long _lastWake; // used to measure the time awake each cycle when sleeping between publishes
+
+  // System sampling
+  Timer _sampleTimer; // asks for system field samples at their own rate, off the publish path
+  volatile bool _sampleDue; // set by the sample timer, sampled on the application thread
+  FathymSystemSample _system; // last sampled system field values
+  void sampleDue(void);
+  void sampleIfDue(void);
+  void sampleSystem(void);
+
+  // Instrumentation
+  FathymStats _stats;
+  unsigned long _lastLatencyReport; // used to publish network latency percentiles at their own rate
+  void writeStats(FathymWriter & writer);
+  uint32_t _lastFreeMemory; // free memory at the start of the last update cycle (0 before the first)
+
+  // Sequencing
+  uint32_t _bootId; // id of this boot, restored from EEPROM and counted up in setup
+  uint32_t _sequence; // number of the last message published this boot
+  FathymSequence _commandSequence; // gaps and duplicates in sequenced commands from the server
+  void nextBoot(void);
+  void writeSequence(FathymWriter & writer);
+  void writeSequence(FathymWriter & writer, uint32_t sequence);
 
   // Storage
   //FlashDevice * _flash;
 
-  // JSON
-  DynamicJsonBuffer _jsonBuffer;
-  JsonObject * _json;
+  // Message
+  FathymMessage _message;
+#if FATHYM_CONCURRENT_VALUES
+  FathymSnapshot _pending; // values set since the last publish
+#endif
+  FathymValueStore & values(void);
+  void stored(bool success);
+  const char * _channelNames[FATHYM_MAX_CHANNELS]; // message values fed by the sample channels
+  FathymChannel * _channels[FATHYM_MAX_CHANNELS];
+  uint8_t _channelCount;
+  FathymRules _rules; // conditions on values that publish them right away
+  std::atomic<bool> _publishRequested; // set when a rule fires (or from requestPublish), taken by the next publish
+  bool _requestFailed; // the requested publish failed, so it waits for the next cycle
+  void retryRequest(void);
+  bool requestWaiting(void);
+  void check(const char * name, double value);
+  FathymGroup _groups[FATHYM_MAX_GROUPS];
+  uint8_t _groupCount;
+  void publishGroups(void);
+  void adaptGroupRate(FathymGroup & group, bool published);
+  void buildPrefix(void);
+  void setSystemValues(void);
+  size_t serialize(char * buffer, size_t size, uint8_t group);
+  bool publishMessage(const char * topic);
+  bool publishSchema(const char * topic);
+  bool schemaAnnounced(void);
+  bool send(const char * topic, const char * payload);
+  bool send(const char * topic, const char * payload, bool retain, uint8_t qos);
+  void configure(JsonObject & command);
+  bool publishConfig(bool ok);
+  bool validConfig(long publishRate, long keepAlive, long decimals);
+
+  // Alerts
+  FathymAlerts _alerts; // alert values waiting to be sent, including those raised from interrupts
+  bool alertPending(void);
+  void waitForAlert(unsigned long duration);
+  uint16_t _announcedSchema; // the schema version last published
+  bool _schemaAnnounced; // whether the schema has been published since connecting
 
   // Utility
   void flash(uint8_t numFlashes, uint8_t delayMs);
+  void formatTime(time_t time, char * buffer);
 };
 
 // Singleton instance to use
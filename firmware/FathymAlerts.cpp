@@ -0,0 +1,141 @@
+#include "FathymAlerts.h"
+
+#include <string.h>
+
+// Constructor
+FathymAlerts::FathymAlerts() {
+  _count = 0;
+  for (uint8_t i = 0; i < FATHYM_MAX_ISR_ALERTS; i++) {
+    _raised[i].store(NULL);
+  }
+  _head.store(0);
+  _tail.store(0);
+  _dropped.store(0);
+}
+
+// Sets a boolean alert value (false if the table is full)
+bool FathymAlerts::setBool(const char * name, bool value) {
+  FathymField * alert = add(name);
+  if (alert == NULL) return false;
+
+  alert->type = FATHYM_FIELD_BOOL;
+  alert->value.b = value;
+  return true;
+}
+
+// Sets a string alert value (false if the table is full)
+bool FathymAlerts::setString(const char * name, const char * value) {
+  FathymField * alert = add(name);
+  if (alert == NULL) return false;
+
+  alert->type = FATHYM_FIELD_STRING;
+  alert->value.s = value;
+  return true;
+}
+
+// Sets an integer alert value (false if the table is full)
+bool FathymAlerts::setLong(const char * name, long value) {
+  FathymField * alert = add(name);
+  if (alert == NULL) return false;
+
+  alert->type = FATHYM_FIELD_LONG;
+  alert->value.l = value;
+  return true;
+}
+
+// Sets a floating point alert value, rounded to the given decimal places when written (false if the table is full)
+bool FathymAlerts::setDouble(const char * name, double value, uint8_t decimals) {
+  FathymField * alert = add(name);
+  if (alert == NULL) return false;
+
+  alert->type = FATHYM_FIELD_DOUBLE;
+  alert->decimals = decimals;
+  alert->value.d = value;
+  return true;
+}
+
+// Raises a true alert value (safe from any interrupt; the name must stay valid, e.g. a string literal)
+bool FathymAlerts::raise(const char * name) {
+  // Claim a slot, so interrupts preempting each other never share one
+  uint16_t head = _head.load(std::memory_order_relaxed);
+  do {
+    if ((uint16_t)(head - _tail.load(std::memory_order_acquire)) >= FATHYM_MAX_ISR_ALERTS) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } while (!_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel));
+
+  _raised[head & (FATHYM_MAX_ISR_ALERTS - 1)].store(name, std::memory_order_release);
+  return true;
+}
+
+// Whether or not alerts have been raised from interrupts since the last collect
+bool FathymAlerts::raised(void) const {
+  return _head.load(std::memory_order_acquire) != _tail.load(std::memory_order_relaxed);
+}
+
+// Moves the alerts raised from interrupts into the table, leaving any that don't fit for later
+void FathymAlerts::collect(void) {
+  uint16_t tail = _tail.load(std::memory_order_relaxed);
+  while (tail != _head.load(std::memory_order_acquire)) {
+    // A slot is claimed before its name is written; stop at one still being written
+    std::atomic<const char *> & slot = _raised[tail & (FATHYM_MAX_ISR_ALERTS - 1)];
+    const char * name = slot.load(std::memory_order_acquire);
+    if (name == NULL || !setBool(name, true)) {
+      break;
+    }
+
+    slot.store(NULL, std::memory_order_relaxed);
+    _tail.store(++tail, std::memory_order_release);
+  }
+}
+
+// Gets the number of alert values waiting to be sent
+uint8_t FathymAlerts::count(void) const {
+  return _count;
+}
+
+// Gets the number of alerts raised from interrupts that were dropped because the ring was full
+uint32_t FathymAlerts::dropped(void) const {
+  return _dropped.load(std::memory_order_relaxed);
+}
+
+// Writes each alert value as ,"name":value so they can be appended to an open JSON object
+void FathymAlerts::writeTo(FathymWriter & writer) {
+  for (uint8_t i = 0; i < _count; i++) {
+    FathymField & alert = _alerts[i];
+
+    writer.write(',');
+    writer.writeKey(alert.name);
+    switch (alert.type) {
+      case FATHYM_FIELD_BOOL: writer.writeBool(alert.value.b); break;
+      case FATHYM_FIELD_STRING: writer.writeString(alert.value.s); break;
+      case FATHYM_FIELD_LONG: writer.writeLong(alert.value.l); break;
+      case FATHYM_FIELD_DOUBLE: writer.writeDouble(alert.value.d, alert.decimals); break;
+    }
+  }
+}
+
+// Removes the alert values once sent (alerts raised from interrupts and not collected yet stay)
+void FathymAlerts::clear(void) {
+  _count = 0;
+}
+
+// Finds the alert with the given name or adds it if there is room (NULL if the table is full)
+FathymField * FathymAlerts::add(const char * name) {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_alerts[i].name == name || strcmp(_alerts[i].name, name) == 0) {
+      return &_alerts[i];
+    }
+  }
+
+  if (_count >= FATHYM_MAX_ALERTS) return NULL;
+
+  FathymField * alert = &_alerts[_count++];
+  alert->name = name;
+  alert->units = NULL;
+  alert->decimals = 0;
+  alert->group = 0;
+  alert->id = 0;
+  return alert;
+}
@@ -0,0 +1,76 @@
+/*
+Alert table for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_ALERTS
+#define _FATHYM_ALERTS
+
+#include <atomic>
+
+#include "FathymMessage.h"
+
+// The maximum number of alert values waiting to be sent together
+#ifndef FATHYM_MAX_ALERTS
+#define FATHYM_MAX_ALERTS 4
+#endif
+
+// The number of alerts that can be raised from interrupts between update loop checks (a power of two)
+#ifndef FATHYM_MAX_ISR_ALERTS
+#define FATHYM_MAX_ISR_ALERTS 8
+#endif
+
+// Small table of alert values waiting to be sent, plus a ring of alerts raised from interrupts.
+// Interrupt handlers (any number, at any priority) raise alerts by name without locks or
+// allocation; the update loop moves them into the table as true values before sending.
+// Alerts raised while the ring is full are dropped and counted.
+class FathymAlerts {
+public:
+  FathymAlerts();
+
+  bool setBool(const char * name, bool value);
+  bool setString(const char * name, const char * value);
+  bool setLong(const char * name, long value);
+  bool setDouble(const char * name, double value, uint8_t decimals);
+  bool raise(const char * name);
+  bool raised(void) const;
+  void collect(void);
+  uint8_t count(void) const;
+  uint32_t dropped(void) const;
+  void writeTo(FathymWriter & writer);
+  void clear(void);
+
+private:
+  static_assert((FATHYM_MAX_ISR_ALERTS & (FATHYM_MAX_ISR_ALERTS - 1)) == 0, "FATHYM_MAX_ISR_ALERTS must be a power of two");
+
+  FathymField _alerts[FATHYM_MAX_ALERTS];
+  uint8_t _count;
+  std::atomic<const char *> _raised[FATHYM_MAX_ISR_ALERTS]; // names raised from interrupts (NULL until written)
+  std::atomic<uint16_t> _head; // next slot to raise into (claimed by the raising interrupt)
+  std::atomic<uint16_t> _tail; // next slot to collect (only written by the update loop)
+  std::atomic<uint32_t> _dropped; // alerts raised while the ring was full
+
+  FathymField * add(const char * name);
+};
+
+#endif
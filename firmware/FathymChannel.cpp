@@ -0,0 +1,98 @@
+#include "FathymChannel.h"
+
+#include <string.h>
+
+// Constructor
+FathymChannel::FathymChannel() {
+  _head.store(0);
+  _tail.store(0);
+  _overruns.store(0);
+  _clock = NULL;
+}
+
+// Captures a sample timestamped with the channel's clock (safe from an interrupt)
+bool FathymChannel::push(float value) {
+  return push(value, _clock != NULL ? _clock() : 0);
+}
+
+// Captures a sample taken at the given time (safe from an interrupt)
+bool FathymChannel::push(float value, uint32_t time) {
+  uint16_t head = _head.load(std::memory_order_relaxed);
+  uint16_t tail = _tail.load(std::memory_order_acquire);
+  if ((uint16_t)(head - tail) >= FATHYM_CHANNEL_SIZE) {
+    _overruns.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  _values[head & (FATHYM_CHANNEL_SIZE - 1)] = value;
+  _times[head & (FATHYM_CHANNEL_SIZE - 1)] = time;
+  _head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+// Takes the oldest sample (false if there is none)
+bool FathymChannel::pop(float & value, uint32_t & time) {
+  uint16_t tail = _tail.load(std::memory_order_relaxed);
+  if (tail == _head.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  value = _values[tail & (FATHYM_CHANNEL_SIZE - 1)];
+  time = _times[tail & (FATHYM_CHANNEL_SIZE - 1)];
+  _tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+// Gets the number of samples waiting to be drained
+uint16_t FathymChannel::available(void) const {
+  return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed);
+}
+
+// Gets the number of samples dropped because the ring was full
+uint32_t FathymChannel::overruns(void) const {
+  return _overruns.load(std::memory_order_relaxed);
+}
+
+// Sets the clock used to timestamp samples pushed without a time
+void FathymChannel::setClock(FathymClock clock) {
+  _clock = clock;
+}
+
+// Moves the captured samples into the message value of the given name, checking each against the
+// given rules (if any) on the way (false if a plain value didn't fit)
+bool FathymChannel::drainTo(FathymMessage & message, const char * name, uint8_t decimals, FathymRules * rules) {
+  FathymField * field = message.find(name);
+  uint8_t type = field != NULL ? field->type : FATHYM_FIELD_DOUBLE;
+  FathymAggregate samples;
+  memset(&samples, 0, sizeof(samples));
+
+  float value;
+  uint32_t time;
+  bool any = false;
+  while (pop(value, time)) {
+    any = true;
+
+    if (rules != NULL && rules->count() > 0) {
+      rules->check(name, value, time);
+    }
+
+    if (type == FATHYM_FIELD_SERIES) {
+      message.sampleAt(name, value, time);
+      continue;
+    }
+
+    // Running statistics, merged into the aggregated value once drained
+    fathymAddSample(samples, value);
+  }
+
+  if (!any || type == FATHYM_FIELD_SERIES) {
+    return true;
+  }
+
+  if (type == FATHYM_FIELD_AGGREGATE) {
+    return message.addSamples(name, samples);
+  }
+
+  // A plain value shows the latest sample
+  return message.setDouble(name, value, field != NULL ? field->decimals : decimals, field != NULL ? field->units : NULL);
+}
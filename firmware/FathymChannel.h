@@ -0,0 +1,70 @@
+/*
+Interrupt-safe sample capture for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_CHANNEL
+#define _FATHYM_CHANNEL
+
+#include <atomic>
+
+#include "FathymMessage.h"
+#include "FathymRules.h"
+
+// The number of samples each channel can hold between drains (a power of two)
+#ifndef FATHYM_CHANNEL_SIZE
+#define FATHYM_CHANNEL_SIZE 64
+#endif
+
+// Fixed-capacity ring of samples for capturing a sensor faster than the loop runs, e.g. from a
+// timer interrupt at kHz rates. One producer (the interrupt) pushes and one consumer (the main
+// loop) drains, without locks or allocation. Samples pushed while the ring is full are dropped
+// and counted as overruns.
+//
+// Draining feeds the message value of the same name: an aggregated value takes the statistics
+// of every sample, a series takes each timestamped sample, and a plain value the latest sample.
+// Each sample is also checked against the rules for the value, at the time it was taken.
+class FathymChannel {
+public:
+  FathymChannel();
+
+  bool push(float value);
+  bool push(float value, uint32_t time);
+  bool pop(float & value, uint32_t & time);
+  uint16_t available(void) const;
+  uint32_t overruns(void) const;
+  void setClock(FathymClock clock);
+  bool drainTo(FathymMessage & message, const char * name, uint8_t decimals, FathymRules * rules);
+
+private:
+  static_assert((FATHYM_CHANNEL_SIZE & (FATHYM_CHANNEL_SIZE - 1)) == 0, "FATHYM_CHANNEL_SIZE must be a power of two");
+
+  float _values[FATHYM_CHANNEL_SIZE];
+  uint32_t _times[FATHYM_CHANNEL_SIZE];
+  std::atomic<uint16_t> _head; // next slot to push to (only written by the producer)
+  std::atomic<uint16_t> _tail; // next slot to pop from (only written by the consumer)
+  std::atomic<uint32_t> _overruns; // samples dropped because the ring was full
+  FathymClock _clock;
+};
+
+#endif
@@ -0,0 +1,538 @@
+#include "FathymMessage.h"
+
+#include <math.h>
+#include <string.h>
+
+// Constructor
+FathymMessage::FathymMessage() {
+  _clock = NULL;
+  _schemaVersion = 0;
+  _groupedCount = 0;
+  clear();
+}
+
+// Sets a boolean value
+bool FathymMessage::setBool(const char * name, bool value) {
+  FathymField * field = add(name);
+  if (field == NULL) return false;
+
+  // Aggregated values take the value as a 0/1 sample instead
+  if (field->type == FATHYM_FIELD_AGGREGATE || field->type == FATHYM_FIELD_SERIES) {
+    addSample(*field, value ? 1 : 0);
+    return true;
+  }
+
+  field->type = FATHYM_FIELD_BOOL;
+  setUnits(*field, NULL);
+  field->value.b = value;
+  return true;
+}
+
+// Sets a string value
+bool FathymMessage::setString(const char * name, const char * value) {
+  FathymField * field = find(name);
+
+  // Strings can't be sampled, so they replace the aggregated value or series
+  if (field != NULL && (field->type == FATHYM_FIELD_AGGREGATE || field->type == FATHYM_FIELD_SERIES)) {
+    remove(name);
+  }
+
+  field = add(name);
+  if (field == NULL) return false;
+
+  field->type = FATHYM_FIELD_STRING;
+  setUnits(*field, NULL);
+  field->value.s = value;
+  return true;
+}
+
+// Sets an integer value with optional units
+bool FathymMessage::setLong(const char * name, long value, const char * units) {
+  FathymField * field = add(name);
+  if (field == NULL) return false;
+
+  // Aggregated values take the value as a sample instead
+  if (field->type == FATHYM_FIELD_AGGREGATE || field->type == FATHYM_FIELD_SERIES) {
+    addSample(*field, value);
+    return true;
+  }
+
+  field->type = FATHYM_FIELD_LONG;
+  setUnits(*field, units);
+  field->value.l = value;
+  return true;
+}
+
+// Sets a floating point value with optional units, rounded to the given decimal places when written
+bool FathymMessage::setDouble(const char * name, double value, uint8_t decimals, const char * units) {
+  FathymField * field = add(name);
+  if (field == NULL) return false;
+
+  // Aggregated values take the value as a sample instead
+  if (field->type == FATHYM_FIELD_AGGREGATE || field->type == FATHYM_FIELD_SERIES) {
+    addSample(*field, value);
+    return true;
+  }
+
+  field->type = FATHYM_FIELD_DOUBLE;
+  setUnits(*field, units);
+  field->decimals = decimals;
+  field->value.d = value;
+  return true;
+}
+
+// Sets a fixed point value with optional units; the value is scaled by 10^decimals (e.g. 2153 with 2 decimals is 21.53)
+bool FathymMessage::setFixed(const char * name, long value, uint8_t decimals, const char * units) {
+  FathymField * field = add(name);
+  if (field == NULL) return false;
+
+  // Aggregated values take the value as a sample instead
+  if (field->type == FATHYM_FIELD_AGGREGATE || field->type == FATHYM_FIELD_SERIES) {
+    addSample(*field, (double)value / pow(10, decimals));
+    return true;
+  }
+
+  field->type = FATHYM_FIELD_FIXED;
+  setUnits(*field, units);
+  field->decimals = decimals;
+  field->value.l = value;
+  return true;
+}
+
+// Sets the value described by a field (as queued by FathymSnapshot)
+bool FathymMessage::set(const FathymField & value) {
+  switch (value.type) {
+    case FATHYM_FIELD_BOOL: return setBool(value.name, value.value.b);
+    case FATHYM_FIELD_STRING: return setString(value.name, value.value.s);
+    case FATHYM_FIELD_LONG: return setLong(value.name, value.value.l, value.units);
+    case FATHYM_FIELD_DOUBLE: return setDouble(value.name, value.value.d, value.decimals, value.units);
+    case FATHYM_FIELD_FIXED: return setFixed(value.name, value.value.l, value.decimals, value.units);
+  }
+  return false;
+}
+
+// Adds the statistics of several samples at once to an aggregated value (false if it isn't one)
+bool FathymMessage::addSamples(const char * name, const FathymAggregate & samples) {
+  FathymField * field = find(name);
+  if (field == NULL || field->type != FATHYM_FIELD_AGGREGATE || samples.count == 0) return false;
+
+  FathymAggregate & aggregate = _aggregates[field->value.aggregate];
+  if (aggregate.count == 0) {
+    aggregate = samples;
+    return true;
+  }
+
+  // Combine the two sets of running statistics (Chan et al.)
+  uint32_t count = aggregate.count + samples.count;
+  double delta = samples.mean - aggregate.mean;
+  aggregate.m2 += samples.m2 + delta * delta * aggregate.count * samples.count / count;
+  aggregate.mean += delta * samples.count / count;
+  aggregate.count = count;
+  if (samples.min < aggregate.min) aggregate.min = samples.min;
+  if (samples.max > aggregate.max) aggregate.max = samples.max;
+  return true;
+}
+
+// Adds a sample taken at the given time to a series (false if the value isn't one)
+bool FathymMessage::sampleAt(const char * name, double value, uint32_t time) {
+  FathymField * field = find(name);
+  if (field == NULL || field->type != FATHYM_FIELD_SERIES) return false;
+
+  return _series[field->value.series].append(time, (float)value);
+}
+
+// Makes a value aggregate the samples set between publishes into min/max/mean/standard deviation/count
+bool FathymMessage::aggregate(const char * name, uint8_t decimals, const char * units) {
+  FathymField * field = find(name);
+
+  // Already aggregating, just update how it is written
+  if (field != NULL && field->type == FATHYM_FIELD_AGGREGATE) {
+    field->decimals = decimals;
+    setUnits(*field, units);
+    return true;
+  }
+
+  // A series is replaced by the aggregated value
+  if (field != NULL && field->type == FATHYM_FIELD_SERIES) {
+    remove(name);
+  }
+
+  if (_aggregateCount >= FATHYM_MAX_AGGREGATES) return false;
+
+  field = add(name);
+  if (field == NULL) return false;
+
+  field->type = FATHYM_FIELD_AGGREGATE;
+  setUnits(*field, units);
+  field->decimals = decimals;
+  field->value.aggregate = _aggregateCount++;
+  memset(&_aggregates[field->value.aggregate], 0, sizeof(FathymAggregate));
+  return true;
+}
+
+// Starts a new aggregation window for every aggregated value
+void FathymMessage::resetAggregates(void) {
+  memset(_aggregates, 0, sizeof(_aggregates));
+}
+
+// Makes a value buffer the samples set between publishes as a compressed series
+bool FathymMessage::series(const char * name, const char * units) {
+  FathymField * field = find(name);
+
+  // Already a series, just update how it is written
+  if (field != NULL && field->type == FATHYM_FIELD_SERIES) {
+    setUnits(*field, units);
+    return true;
+  }
+
+  // An aggregated value is replaced by the series
+  if (field != NULL && field->type == FATHYM_FIELD_AGGREGATE) {
+    remove(name);
+  }
+
+  if (_seriesCount >= FATHYM_MAX_SERIES) return false;
+
+  field = add(name);
+  if (field == NULL) return false;
+
+  field->type = FATHYM_FIELD_SERIES;
+  setUnits(*field, units);
+  field->value.series = _seriesCount++;
+  _series[field->value.series].clear();
+  return true;
+}
+
+// Removes the buffered samples of every series
+void FathymMessage::resetSeries(void) {
+  for (uint8_t i = 0; i < _seriesCount; i++) {
+    _series[i].clear();
+  }
+}
+
+// Starts a new aggregation window and series for the values of the given group
+void FathymMessage::resetGroup(uint8_t group) {
+  for (uint8_t i = 0; i < _count; i++) {
+    FathymField & field = _fields[i];
+    if (field.group != group) continue;
+
+    if (field.type == FATHYM_FIELD_AGGREGATE) {
+      memset(&_aggregates[field.value.aggregate], 0, sizeof(FathymAggregate));
+    }
+    else if (field.type == FATHYM_FIELD_SERIES) {
+      _series[field.value.series].clear();
+    }
+  }
+}
+
+// Assigns the named value (set now or later) to a publish group, 0 puts it back in the main message
+bool FathymMessage::setGroup(const char * name, uint8_t group) {
+  uint8_t i = 0;
+  while (i < _groupedCount && _groupedNames[i] != name && strcmp(_groupedNames[i], name) != 0) {
+    i++;
+  }
+
+  if (i == _groupedCount) {
+    if (_groupedCount >= FATHYM_MAX_GROUPED) return false;
+    _groupedNames[_groupedCount++] = name;
+  }
+  _groupedGroups[i] = group;
+
+  FathymField * field = find(name);
+  if (field != NULL) {
+    field->group = group;
+  }
+  return true;
+}
+
+// Sets the clock used to timestamp series samples
+void FathymMessage::setClock(FathymClock clock) {
+  _clock = clock;
+}
+
+// Removes a value, keeping the remaining values in order
+void FathymMessage::remove(const char * name) {
+  FathymField * field = find(name);
+  if (field == NULL) return;
+
+  // Release the running statistics, keeping the remaining ones packed
+  if (field->type == FATHYM_FIELD_AGGREGATE) {
+    uint8_t aggregate = field->value.aggregate;
+    memmove(&_aggregates[aggregate], &_aggregates[aggregate + 1], (_aggregateCount - aggregate - 1) * sizeof(FathymAggregate));
+    _aggregateCount--;
+
+    for (uint8_t i = 0; i < _count; i++) {
+      if (_fields[i].type == FATHYM_FIELD_AGGREGATE && _fields[i].value.aggregate > aggregate) {
+        _fields[i].value.aggregate--;
+      }
+    }
+  }
+
+  // Release the compressed samples, keeping the remaining ones packed
+  if (field->type == FATHYM_FIELD_SERIES) {
+    uint8_t series = field->value.series;
+    for (uint8_t i = series; i + 1 < _seriesCount; i++) {
+      _series[i] = _series[i + 1];
+    }
+    _seriesCount--;
+
+    for (uint8_t i = 0; i < _count; i++) {
+      if (_fields[i].type == FATHYM_FIELD_SERIES && _fields[i].value.series > series) {
+        _fields[i].value.series--;
+      }
+    }
+  }
+
+  uint8_t index = field - _fields;
+  memmove(&_fields[index], &_fields[index + 1], (_count - index - 1) * sizeof(FathymField));
+  _count--;
+  _schemaVersion++;
+}
+
+// Removes all values
+void FathymMessage::clear(void) {
+  if (_count > 0) _schemaVersion++;
+  _count = 0;
+  _aggregateCount = 0;
+  _seriesCount = 0;
+}
+
+// Finds the field with the given name (NULL if there is none)
+FathymField * FathymMessage::find(const char * name) {
+  for (uint8_t i = 0; i < _count; i++) {
+    // Names are usually the same literal each time, so try the pointer first
+    if (_fields[i].name == name || strcmp(_fields[i].name, name) == 0) {
+      return &_fields[i];
+    }
+  }
+  return NULL;
+}
+
+// Gets the number of values in the message
+uint8_t FathymMessage::count(void) {
+  return _count;
+}
+
+// Gets the number of values in the given group
+uint8_t FathymMessage::count(uint8_t group) {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_fields[i].group == group) count++;
+  }
+  return count;
+}
+
+// Gets the version of the current names and units; it changes whenever they do
+uint16_t FathymMessage::schemaVersion(void) {
+  return _schemaVersion;
+}
+
+// Writes each value as ,"name":value so the fields can be appended to an open JSON object.
+// With useIds, each name is replaced by its schema id and units are left to the schema.
+void FathymMessage::writeTo(FathymWriter & writer, bool useIds) {
+  for (uint8_t i = 0; i < _count; i++) {
+    writeField(writer, i, useIds);
+  }
+}
+
+// Writes the values of the given publish group only, as writeTo does
+void FathymMessage::writeTo(FathymWriter & writer, bool useIds, uint8_t group) {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_fields[i].group == group) {
+      writeField(writer, i, useIds);
+    }
+  }
+}
+
+// Writes a value as ,"name":value (or ,"id":value)
+void FathymMessage::writeField(FathymWriter & writer, uint8_t index, bool useIds) {
+  FathymField & field = _fields[index];
+
+  writer.write(',');
+  if (useIds) {
+    writer.write('"');
+    writer.writeUnsigned(field.id);
+    writer.write("\":");
+  }
+  else {
+    writer.writeKey(field.name);
+  }
+
+  if (field.type == FATHYM_FIELD_AGGREGATE) {
+    writeAggregate(writer, field, useIds);
+  }
+  else if (field.type == FATHYM_FIELD_SERIES) {
+    writeSeries(writer, field, useIds);
+  }
+  else if (field.units == NULL || useIds) {
+    writeValue(writer, field);
+  }
+  else {
+    writer.write("{\"value\":");
+    writeValue(writer, field);
+    writer.write(",\"units\":");
+    writer.writeString(field.units);
+    writer.write('}');
+  }
+}
+
+// Writes the schema as comma separated "id":["name"] or "id":["name","units"] entries, in the order of writeTo.
+// Ids stay with their names until removed, so removing one value doesn't renumber the others.
+void FathymMessage::writeSchemaTo(FathymWriter & writer) {
+  for (uint8_t i = 0; i < _count; i++) {
+    FathymField & field = _fields[i];
+
+    if (i > 0) writer.write(',');
+    writer.write('"');
+    writer.writeUnsigned(field.id);
+    writer.write("\":[");
+    writer.writeString(field.name);
+
+    if (field.units != NULL) {
+      writer.write(',');
+      writer.writeString(field.units);
+    }
+
+    writer.write(']');
+  }
+}
+
+// Sets a field's units, tracking whether the schema changed
+void FathymMessage::setUnits(FathymField & field, const char * units) {
+  if (field.units == units) return;
+
+  if (field.units == NULL || units == NULL || strcmp(field.units, units) != 0) {
+    _schemaVersion++;
+  }
+  field.units = units;
+}
+
+// Finds the field with the given name or adds it if there is room (NULL if the message is full)
+FathymField * FathymMessage::add(const char * name) {
+  FathymField * field = find(name);
+  if (field != NULL) return field;
+
+  if (_count >= FATHYM_MAX_FIELDS) return NULL;
+
+  uint8_t id = unusedId();
+  field = &_fields[_count++];
+  _schemaVersion++;
+  field->name = name;
+  field->type = FATHYM_FIELD_LONG;
+  field->units = NULL;
+  field->decimals = 0;
+  field->value.l = 0;
+  field->id = id;
+
+  // Values assigned to a group before they were first set join it now
+  field->group = 0;
+  for (uint8_t i = 0; i < _groupedCount; i++) {
+    if (_groupedNames[i] == name || strcmp(_groupedNames[i], name) == 0) {
+      field->group = _groupedGroups[i];
+      break;
+    }
+  }
+  return field;
+}
+
+// Gets the lowest schema id not taken by another value (ids start at 1)
+uint8_t FathymMessage::unusedId(void) {
+  for (uint8_t id = 1; ; id++) {
+    bool taken = false;
+    for (uint8_t i = 0; i < _count && !taken; i++) {
+      taken = _fields[i].id == id;
+    }
+    if (!taken) return id;
+  }
+}
+
+// Writes a field's value
+void FathymMessage::writeValue(FathymWriter & writer, FathymField & field) {
+  switch (field.type) {
+    case FATHYM_FIELD_BOOL: writer.writeBool(field.value.b); break;
+    case FATHYM_FIELD_STRING: writer.writeString(field.value.s); break;
+    case FATHYM_FIELD_LONG: writer.writeLong(field.value.l); break;
+    case FATHYM_FIELD_DOUBLE: writer.writeDouble(field.value.d, field.decimals); break;
+    case FATHYM_FIELD_FIXED: writer.writeFixed(field.value.l, field.decimals); break;
+  }
+}
+
+// Writes an aggregated value's statistics for the current window
+void FathymMessage::writeAggregate(FathymWriter & writer, FathymField & field, bool useIds) {
+  FathymAggregate & aggregate = _aggregates[field.value.aggregate];
+
+  writer.write("{\"n\":");
+  writer.writeUnsigned(aggregate.count);
+
+  if (aggregate.count > 0) {
+    // Sample standard deviation
+    double variance = aggregate.count > 1 ? aggregate.m2 / (aggregate.count - 1) : 0;
+
+    writer.write(",\"min\":");
+    writer.writeDouble(aggregate.min, field.decimals);
+    writer.write(",\"max\":");
+    writer.writeDouble(aggregate.max, field.decimals);
+    writer.write(",\"mean\":");
+    writer.writeDouble(aggregate.mean, field.decimals);
+    writer.write(",\"sd\":");
+    writer.writeDouble(sqrt(variance), field.decimals);
+  }
+
+  if (field.units != NULL && !useIds) {
+    writer.write(",\"units\":");
+    writer.writeString(field.units);
+  }
+
+  writer.write('}');
+}
+
+// Writes a series' compressed samples (see FathymSeries for the encoding)
+void FathymMessage::writeSeries(FathymWriter & writer, FathymField & field, bool useIds) {
+  FathymSeries & series = _series[field.value.series];
+
+  writer.write("{\"enc\":\"g32\",\"t0\":");
+  writer.writeUnsigned(series.start());
+  writer.write(",\"n\":");
+  writer.writeUnsigned(series.count());
+
+  if (series.dropped() > 0) {
+    writer.write(",\"drop\":");
+    writer.writeUnsigned(series.dropped());
+  }
+
+  writer.write(",\"data\":");
+  writer.writeBase64(series.data(), series.size());
+
+  if (field.units != NULL && !useIds) {
+    writer.write(",\"units\":");
+    writer.writeString(field.units);
+  }
+
+  writer.write('}');
+}
+
+// Adds a sample to an aggregated value's running statistics or a series' buffer in constant time
+void FathymMessage::addSample(FathymField & field, double value) {
+  if (field.type == FATHYM_FIELD_SERIES) {
+    _series[field.value.series].append(_clock != NULL ? _clock() : 0, (float)value);
+    return;
+  }
+
+  fathymAddSample(_aggregates[field.value.aggregate], value);
+}
+
+// Adds a sample to running statistics (Welford's online mean/variance)
+void fathymAddSample(FathymAggregate & aggregate, double value) {
+  aggregate.count++;
+  if (aggregate.count == 1) {
+    aggregate.min = value;
+    aggregate.max = value;
+  }
+  else {
+    if (value < aggregate.min) aggregate.min = value;
+    if (value > aggregate.max) aggregate.max = value;
+  }
+
+  double delta = value - aggregate.mean;
+  aggregate.mean += delta / aggregate.count;
+  aggregate.m2 += delta * (value - aggregate.mean);
+}
@@ -0,0 +1,149 @@
+/*
+Message field store for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_MESSAGE
+#define _FATHYM_MESSAGE
+
+#include "FathymWriter.h"
+#include "FathymSeries.h"
+
+// The maximum number of values a message can hold
+#ifndef FATHYM_MAX_FIELDS
+#define FATHYM_MAX_FIELDS 32
+#endif
+
+// The maximum number of values that can be aggregated between publishes
+#ifndef FATHYM_MAX_AGGREGATES
+#define FATHYM_MAX_AGGREGATES 8
+#endif
+
+// The maximum number of compressed sample series a message can hold
+#ifndef FATHYM_MAX_SERIES
+#define FATHYM_MAX_SERIES 2
+#endif
+
+// The maximum number of values that can be assigned to publish groups
+#ifndef FATHYM_MAX_GROUPED
+#define FATHYM_MAX_GROUPED 16
+#endif
+
+// Clock used to timestamp series samples (milliseconds)
+typedef uint32_t (*FathymClock)(void);
+
+// Message field value types
+#define FATHYM_FIELD_BOOL   0
+#define FATHYM_FIELD_STRING 1
+#define FATHYM_FIELD_LONG   2
+#define FATHYM_FIELD_DOUBLE 3
+#define FATHYM_FIELD_FIXED  4
+#define FATHYM_FIELD_AGGREGATE 5
+#define FATHYM_FIELD_SERIES 6
+
+// Running statistics for an aggregated value (Welford's online mean/variance)
+typedef struct {
+  uint32_t count;
+  double mean;
+  double m2; // sum of squared differences from the mean
+  double min;
+  double max;
+} FathymAggregate;
+
+// Adds a sample to running statistics in constant time
+void fathymAddSample(FathymAggregate & aggregate, double value);
+
+// A single message value. Names, units and string values are stored by
+// pointer, so they must stay valid for as long as the field exists.
+typedef struct {
+  const char * name;
+  const char * units; // NULL for a plain value, otherwise written as {"value":...,"units":...}
+  uint8_t type;
+  uint8_t decimals; // decimal places for double values, scale for fixed values
+  union {
+    bool b;
+    const char * s;
+    long l;
+    double d;
+    uint8_t aggregate; // index of the running statistics for aggregated values
+    uint8_t series; // index of the compressed samples for series values
+  } value;
+  uint8_t group; // publish group the value is sent with (0 for the main message)
+  uint8_t id; // schema id, kept for as long as the value exists (0 until added to a message)
+} FathymField;
+
+// Fixed-capacity store of the values to publish, kept in insertion order
+class FathymMessage {
+public:
+  FathymMessage();
+
+  bool setBool(const char * name, bool value);
+  bool setString(const char * name, const char * value);
+  bool setLong(const char * name, long value, const char * units);
+  bool setDouble(const char * name, double value, uint8_t decimals, const char * units);
+  bool setFixed(const char * name, long value, uint8_t decimals, const char * units);
+  bool set(const FathymField & value);
+  bool addSamples(const char * name, const FathymAggregate & samples);
+  bool sampleAt(const char * name, double value, uint32_t time);
+  bool aggregate(const char * name, uint8_t decimals, const char * units);
+  void resetAggregates(void);
+  bool series(const char * name, const char * units);
+  void resetSeries(void);
+  void resetGroup(uint8_t group);
+  bool setGroup(const char * name, uint8_t group);
+  void setClock(FathymClock clock);
+  void remove(const char * name);
+  void clear(void);
+
+  FathymField * find(const char * name);
+  uint8_t count(void);
+  uint8_t count(uint8_t group);
+  uint16_t schemaVersion(void);
+  void writeTo(FathymWriter & writer, bool useIds);
+  void writeTo(FathymWriter & writer, bool useIds, uint8_t group);
+  void writeSchemaTo(FathymWriter & writer);
+
+private:
+  FathymField _fields[FATHYM_MAX_FIELDS];
+  uint8_t _count;
+  FathymAggregate _aggregates[FATHYM_MAX_AGGREGATES];
+  uint8_t _aggregateCount;
+  FathymSeries _series[FATHYM_MAX_SERIES];
+  uint8_t _seriesCount;
+  FathymClock _clock;
+  uint16_t _schemaVersion; // changes whenever the set of names or units changes
+  const char * _groupedNames[FATHYM_MAX_GROUPED]; // values assigned to a publish group, set or not
+  uint8_t _groupedGroups[FATHYM_MAX_GROUPED];
+  uint8_t _groupedCount;
+
+  FathymField * add(const char * name);
+  uint8_t unusedId(void);
+  void setUnits(FathymField & field, const char * units);
+  void writeField(FathymWriter & writer, uint8_t index, bool useIds);
+  void writeValue(FathymWriter & writer, FathymField & field);
+  void writeAggregate(FathymWriter & writer, FathymField & field, bool useIds);
+  void writeSeries(FathymWriter & writer, FathymField & field, bool useIds);
+  void addSample(FathymField & field, double value);
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "FathymRules.h"
+
+#include <string.h>
+#include <math.h>
+
+// Constructor
+FathymRules::FathymRules() {
+  _count = 0;
+  _fired = 0;
+}
+
+// Adds a rule for the named value (the name must stay valid, e.g. a string literal)
+bool FathymRules::add(const char * name, uint8_t condition, float threshold, float hysteresis) {
+  if (_count >= FATHYM_MAX_RULES || condition > FATHYM_RULE_CHANGE) {
+    return false;
+  }
+
+  FathymRule & rule = _rules[_count++];
+  rule.name = name;
+  rule.condition = condition;
+  rule.active = false;
+  rule.primed = false;
+  rule.threshold = threshold;
+  rule.hysteresis = hysteresis < 0 ? -hysteresis : hysteresis;
+  rule.last = 0;
+  rule.lastTime = 0;
+  return true;
+}
+
+// Removes every rule for the named value
+void FathymRules::remove(const char * name) {
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_rules[i].name != name && strcmp(_rules[i].name, name) != 0) {
+      _rules[kept++] = _rules[i];
+    }
+  }
+  _count = kept;
+}
+
+// Removes all rules
+void FathymRules::clear(void) {
+  _count = 0;
+}
+
+// Gets the number of rules
+uint8_t FathymRules::count(void) const {
+  return _count;
+}
+
+// Gets the number of times a rule has fired
+uint32_t FathymRules::fired(void) const {
+  return _fired;
+}
+
+// Checks a value being set against its rules, true if any of them fired
+bool FathymRules::check(const char * name, float value, uint32_t now) {
+  bool fired = false;
+  for (uint8_t i = 0; i < _count; i++) {
+    FathymRule & rule = _rules[i];
+    if ((rule.name == name || strcmp(rule.name, name) == 0) && update(rule, value, now)) {
+      fired = true;
+    }
+  }
+
+  if (fired) {
+    _fired++;
+  }
+  return fired;
+}
+
+// Moves a rule on to the given value, true if its condition started or cleared
+bool FathymRules::update(FathymRule & rule, float value, uint32_t now) {
+  float measure = value;
+  if (rule.condition == FATHYM_RULE_CHANGE) {
+    // Needs two samples apart in time for a rate
+    if (rule.primed && now == rule.lastTime) {
+      return false;
+    }
+
+    bool primed = rule.primed;
+    float last = rule.last;
+    uint32_t elapsed = now - rule.lastTime;
+    rule.primed = true;
+    rule.last = value;
+    rule.lastTime = now;
+    if (!primed) {
+      return false;
+    }
+
+    measure = fabsf(value - last) * 1000.0f / elapsed;
+  }
+
+  bool active;
+  if (rule.condition == FATHYM_RULE_BELOW) {
+    active = rule.active ? measure <= rule.threshold + rule.hysteresis : measure < rule.threshold;
+  }
+  else {
+    active = rule.active ? measure >= rule.threshold - rule.hysteresis : measure > rule.threshold;
+  }
+
+  if (active == rule.active) {
+    return false;
+  }
+  rule.active = active;
+  return true;
+}
@@ -0,0 +1,75 @@
+/*
+Publish rules for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_RULES
+#define _FATHYM_RULES
+
+#include <stdint.h>
+
+// The maximum number of publish rules
+#ifndef FATHYM_MAX_RULES
+#define FATHYM_MAX_RULES 4
+#endif
+
+// Conditions a rule watches a value for
+#define FATHYM_RULE_ABOVE  0 // the value rises above the threshold
+#define FATHYM_RULE_BELOW  1 // the value falls below the threshold
+#define FATHYM_RULE_CHANGE 2 // the value changes faster than the threshold per second (either way)
+
+// A condition on one message value
+typedef struct {
+  const char * name; // name of the value watched
+  uint8_t condition; // FATHYM_RULE_*
+  bool active; // whether the condition holds (until it clears by more than the hysteresis)
+  bool primed; // whether a previous value is known (for rate of change)
+  float threshold;
+  float hysteresis; // how far back past the threshold the value has to go for the condition to clear
+  float last; // previous value and when it was checked (for rate of change)
+  uint32_t lastTime;
+} FathymRule;
+
+// Fixed table of threshold and rate of change rules checked as values are set. A rule fires when
+// its condition starts to hold and again when it clears; it can't fire again until it has cleared,
+// so a value hovering around a threshold doesn't fire on every sample. Checking a value looks at
+// no more than FATHYM_MAX_RULES rules.
+class FathymRules {
+public:
+  FathymRules();
+
+  bool add(const char * name, uint8_t condition, float threshold, float hysteresis);
+  void remove(const char * name);
+  void clear(void);
+  uint8_t count(void) const;
+  uint32_t fired(void) const;
+  bool check(const char * name, float value, uint32_t now);
+
+private:
+  FathymRule _rules[FATHYM_MAX_RULES];
+  uint8_t _count;
+  uint32_t _fired; // times a rule has fired
+  bool update(FathymRule & rule, float value, uint32_t now);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "FathymSequence.h"
+
+// Constructor
+FathymSequence::FathymSequence() {
+  reset();
+}
+
+// Checks a received message's boot id and sequence number, returning one of FATHYM_SEQUENCE_*
+uint8_t FathymSequence::check(uint32_t boot, uint32_t sequence) {
+  // First message, or the sender restarted and began a new sequence
+  if (!_started || boot > _boot) {
+    // Messages sent before this one since the restart never arrived
+    if (_started && sequence > 1) {
+      _lost += sequence - 1;
+    }
+
+    _started = true;
+    _boot = boot;
+    _last = sequence;
+    _window = 1;
+    _received++;
+    return FATHYM_SEQUENCE_RESTART;
+  }
+
+  // Left over from a boot that has already been replaced
+  if (boot < _boot) {
+    return FATHYM_SEQUENCE_STALE;
+  }
+
+  if (sequence > _last) {
+    uint32_t skipped = sequence - _last - 1;
+    uint32_t shift = sequence - _last;
+    _window = shift < 32 ? (_window << shift) | 1 : 1;
+    _last = sequence;
+    _lost += skipped;
+    _received++;
+    return skipped > 0 ? FATHYM_SEQUENCE_GAP : FATHYM_SEQUENCE_NEW;
+  }
+
+  uint32_t age = _last - sequence;
+  if (age >= 32) {
+    return FATHYM_SEQUENCE_STALE;
+  }
+
+  if (_window & (1UL << age)) {
+    _duplicates++;
+    return FATHYM_SEQUENCE_DUPLICATE;
+  }
+
+  // A message counted as lost turned up after all
+  _window |= 1UL << age;
+  if (_lost > 0) {
+    _lost--;
+  }
+  _received++;
+  return FATHYM_SEQUENCE_LATE;
+}
+
+// Forgets the sender's sequence and clears the counters
+void FathymSequence::reset(void) {
+  _started = false;
+  _boot = 0;
+  _last = 0;
+  _window = 0;
+  _received = 0;
+  _lost = 0;
+  _duplicates = 0;
+}
+
+// Gets the number of messages accepted
+uint32_t FathymSequence::received(void) const {
+  return _received;
+}
+
+// Gets the number of messages skipped that haven't arrived (yet)
+uint32_t FathymSequence::lost(void) const {
+  return _lost;
+}
+
+// Gets the number of messages received more than once
+uint32_t FathymSequence::duplicates(void) const {
+  return _duplicates;
+}
+
+// Gets the boot id of the sender's current sequence
+uint32_t FathymSequence::boot(void) const {
+  return _boot;
+}
+
+// Gets the highest sequence number received
+uint32_t FathymSequence::last(void) const {
+  return _last;
+}
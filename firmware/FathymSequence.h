@@ -0,0 +1,65 @@
+/*
+Message sequence tracking for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_SEQUENCE
+#define _FATHYM_SEQUENCE
+
+#include <stdint.h>
+
+// Results of checking the sequence number of a received message
+#define FATHYM_SEQUENCE_NEW       0 // the next message in order
+#define FATHYM_SEQUENCE_GAP       1 // a later message, the ones skipped are counted as lost
+#define FATHYM_SEQUENCE_LATE      2 // a skipped message arriving out of order (no longer counted as lost)
+#define FATHYM_SEQUENCE_DUPLICATE 3 // already received, should be ignored
+#define FATHYM_SEQUENCE_STALE     4 // too old to tell (or from an earlier boot), should be ignored
+#define FATHYM_SEQUENCE_RESTART   5 // the first message since the sender (re)started
+
+// Receive-side tracking of a sender's (boot id, sequence number) pairs for cheap loss accounting
+// without QoS 1. Sequence numbers restart with every boot of the sender, so a new boot id starts
+// a new sequence. The last 32 sequence numbers are remembered, so reordered messages within that
+// window are told apart from duplicates.
+class FathymSequence {
+public:
+  FathymSequence();
+
+  uint8_t check(uint32_t boot, uint32_t sequence);
+  void reset(void);
+  uint32_t received(void) const;
+  uint32_t lost(void) const;
+  uint32_t duplicates(void) const;
+  uint32_t boot(void) const;
+  uint32_t last(void) const;
+
+private:
+  bool _started; // whether any message has been checked
+  uint32_t _boot; // boot id of the sender's current sequence
+  uint32_t _last; // highest sequence number received
+  uint32_t _window; // bit n set when _last - n has been received
+  uint32_t _received; // messages accepted
+  uint32_t _lost; // messages skipped and not (yet) received
+  uint32_t _duplicates; // messages received more than once
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "FathymSeries.h"
+
+#include <string.h>
+
+// Counts the leading zero bits of a non-zero value
+static uint8_t leadingZeros(uint32_t value) {
+  return __builtin_clz(value);
+}
+
+// Counts the trailing zero bits of a non-zero value
+static uint8_t trailingZeros(uint32_t value) {
+  return __builtin_ctz(value);
+}
+
+// Constructor
+FathymSeries::FathymSeries() {
+  clear();
+}
+
+// Appends a sample if it fits the buffer, otherwise counts it as dropped
+bool FathymSeries::append(uint32_t time, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  // The first sample anchors the series
+  if (_count == 0) {
+    if (_bits + 32 > FATHYM_SERIES_BUFFER_SIZE * 8) {
+      _dropped++;
+      return false;
+    }
+    _start = time;
+    _lastTime = time;
+    _lastDelta = 0;
+    writeBits(bits, 32);
+    _lastValue = bits;
+    _count++;
+    return true;
+  }
+
+  int32_t delta = time - _lastTime;
+  int32_t deltaOfDelta = delta - _lastDelta;
+
+  // Only write whole samples
+  if (_bits + timeBits(deltaOfDelta) + valueBits(bits) > FATHYM_SERIES_BUFFER_SIZE * 8) {
+    _dropped++;
+    return false;
+  }
+
+  writeTime(deltaOfDelta);
+  writeValue(bits);
+
+  _lastTime = time;
+  _lastDelta = delta;
+  _count++;
+  return true;
+}
+
+// Removes all samples
+void FathymSeries::clear(void) {
+  memset(_data, 0, sizeof(_data));
+  _bits = 0;
+  _count = 0;
+  _dropped = 0;
+  _start = 0;
+  _lastTime = 0;
+  _lastDelta = 0;
+  _lastValue = 0;
+  _lastLeading = 0xFF; // no window until the first non-zero XOR
+  _lastTrailing = 0;
+}
+
+// Gets the number of samples
+uint16_t FathymSeries::count(void) const {
+  return _count;
+}
+
+// Gets the number of samples dropped because the buffer was full
+uint16_t FathymSeries::dropped(void) const {
+  return _dropped;
+}
+
+// Gets the time of the first sample
+uint32_t FathymSeries::start(void) const {
+  return _start;
+}
+
+// Gets the compressed samples
+const uint8_t * FathymSeries::data(void) const {
+  return _data;
+}
+
+// Gets the size of the compressed samples in bytes
+size_t FathymSeries::size(void) const {
+  return (_bits + 7) / 8;
+}
+
+// Gets the number of bits needed to encode a timestamp delta-of-delta
+uint16_t FathymSeries::timeBits(int32_t deltaOfDelta) const {
+  if (deltaOfDelta == 0) return 1;
+  if (deltaOfDelta >= -63 && deltaOfDelta <= 64) return 2 + 7;
+  if (deltaOfDelta >= -255 && deltaOfDelta <= 256) return 3 + 9;
+  if (deltaOfDelta >= -2047 && deltaOfDelta <= 2048) return 4 + 12;
+  return 4 + 32;
+}
+
+// Gets the number of bits needed to encode a value
+uint16_t FathymSeries::valueBits(uint32_t value) const {
+  uint32_t xored = value ^ _lastValue;
+  if (xored == 0) return 1;
+
+  uint8_t leading = leadingZeros(xored);
+  uint8_t trailing = trailingZeros(xored);
+  if (leading > 31) leading = 31;
+
+  if (_lastLeading != 0xFF && leading >= _lastLeading && trailing >= _lastTrailing) {
+    return 2 + (32 - _lastLeading - _lastTrailing);
+  }
+  return 2 + 5 + 5 + (32 - leading - trailing);
+}
+
+// Writes a timestamp delta-of-delta
+void FathymSeries::writeTime(int32_t deltaOfDelta) {
+  // Values are written biased so the ranges above fit their unsigned widths
+  if (deltaOfDelta == 0) {
+    writeBits(0, 1);
+  }
+  else if (deltaOfDelta >= -63 && deltaOfDelta <= 64) {
+    writeBits(2, 2);
+    writeBits(deltaOfDelta + 63, 7);
+  }
+  else if (deltaOfDelta >= -255 && deltaOfDelta <= 256) {
+    writeBits(6, 3);
+    writeBits(deltaOfDelta + 255, 9);
+  }
+  else if (deltaOfDelta >= -2047 && deltaOfDelta <= 2048) {
+    writeBits(14, 4);
+    writeBits(deltaOfDelta + 2047, 12);
+  }
+  else {
+    writeBits(15, 4);
+    writeBits((uint32_t)deltaOfDelta, 32);
+  }
+}
+
+// Writes a value XORed with the previous one
+void FathymSeries::writeValue(uint32_t value) {
+  uint32_t xored = value ^ _lastValue;
+  _lastValue = value;
+
+  if (xored == 0) {
+    writeBits(0, 1);
+    return;
+  }
+
+  uint8_t leading = leadingZeros(xored);
+  uint8_t trailing = trailingZeros(xored);
+  if (leading > 31) leading = 31;
+
+  // Reuse the previous window when the meaningful bits fit inside it
+  if (_lastLeading != 0xFF && leading >= _lastLeading && trailing >= _lastTrailing) {
+    writeBits(2, 2);
+    writeBits(xored >> _lastTrailing, 32 - _lastLeading - _lastTrailing);
+    return;
+  }
+
+  uint8_t length = 32 - leading - trailing;
+  writeBits(3, 2);
+  writeBits(leading, 5);
+  writeBits(length - 1, 5);
+  writeBits(xored >> trailing, length);
+
+  _lastLeading = leading;
+  _lastTrailing = trailing;
+}
+
+// Writes the lowest bits of a value, most significant first
+void FathymSeries::writeBits(uint32_t value, uint8_t count) {
+  while (count > 0) {
+    count--;
+    if ((value >> count) & 1) {
+      _data[_bits / 8] |= 0x80 >> (_bits % 8);
+    }
+    _bits++;
+  }
+}
@@ -0,0 +1,85 @@
+/*
+Compressed time series for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_SERIES
+#define _FATHYM_SERIES
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The number of bytes of compressed samples each series can buffer. Every series has to fit a
+// message when full, so this is bounded by the MQTT TX buffer (checked in Fathym.h).
+#ifndef FATHYM_SERIES_BUFFER_SIZE
+#define FATHYM_SERIES_BUFFER_SIZE 64
+#endif
+
+// Compact in-memory series of timestamped samples, compressed as they are
+// appended (Gorilla style):
+//
+// Timestamps (milliseconds since the first sample) are delta-of-delta encoded:
+//   '0'                          same interval as before
+//   '10'   + 7 bit signed        interval changed by -63..64
+//   '110'  + 9 bit signed        interval changed by -255..256
+//   '1110' + 12 bit signed       interval changed by -2047..2048
+//   '1111' + 32 bit signed       anything else
+//
+// Values are 32 bit floats XORed with the previous value:
+//   '0'                          same value as before
+//   '10' + meaningful bits       fits within the previous leading/trailing zero window
+//   '11' + 5 bit leading zeros + 5 bit (length - 1) + meaningful bits
+//
+// The first sample stores its value as 32 raw bits. Bits are packed MSB first.
+class FathymSeries {
+public:
+  FathymSeries();
+
+  bool append(uint32_t time, float value);
+  void clear(void);
+  uint16_t count(void) const;
+  uint16_t dropped(void) const;
+  uint32_t start(void) const;
+  const uint8_t * data(void) const;
+  size_t size(void) const;
+
+private:
+  uint8_t _data[FATHYM_SERIES_BUFFER_SIZE];
+  uint16_t _bits; // number of bits written
+  uint16_t _count; // number of samples
+  uint16_t _dropped; // samples that did not fit
+  uint32_t _start; // time of the first sample
+  uint32_t _lastTime;
+  int32_t _lastDelta;
+  uint32_t _lastValue;
+  uint8_t _lastLeading;
+  uint8_t _lastTrailing;
+
+  uint16_t timeBits(int32_t deltaOfDelta) const;
+  uint16_t valueBits(uint32_t value) const;
+  void writeTime(int32_t deltaOfDelta);
+  void writeValue(uint32_t value);
+  void writeBits(uint32_t value, uint8_t count);
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "FathymSnapshot.h"
+
+#include <math.h>
+#include <string.h>
+
+// Entry states
+#define FATHYM_PENDING_EMPTY 0
+#define FATHYM_PENDING_READY 1
+#define FATHYM_PENDING_BUSY  2
+
+// Gets the numeric value of a field as a sample (strings have none)
+static double sampleOf(const FathymField & field) {
+  switch (field.type) {
+    case FATHYM_FIELD_BOOL: return field.value.b ? 1 : 0;
+    case FATHYM_FIELD_LONG: return field.value.l;
+    case FATHYM_FIELD_FIXED: return (double)field.value.l / pow(10, field.decimals);
+    default: return field.value.d;
+  }
+}
+
+// Constructor
+FathymSnapshot::FathymSnapshot() {
+  for (uint8_t b = 0; b < 2; b++) {
+    _counts[b].store(0);
+    _sampleCounts[b].store(0);
+    _writers[b].store(0);
+    for (uint8_t i = 0; i < FATHYM_MAX_PENDING; i++) {
+      _pending[b][i].state.store(FATHYM_PENDING_EMPTY);
+    }
+    for (uint8_t i = 0; i < FATHYM_MAX_PENDING_SAMPLES; i++) {
+      _samples[b][i].state.store(FATHYM_PENDING_EMPTY);
+    }
+  }
+  _back.store(0);
+  _dropped.store(0);
+  _eachCount.store(0);
+  _clock = NULL;
+}
+
+// Sets a boolean value
+bool FathymSnapshot::setBool(const char * name, bool value) {
+  FathymField field = { name, NULL, FATHYM_FIELD_BOOL, 0, {}, 0, 0 };
+  field.value.b = value;
+  return set(field);
+}
+
+// Sets a string value (stored by pointer, so it must stay valid until published)
+bool FathymSnapshot::setString(const char * name, const char * value) {
+  FathymField field = { name, NULL, FATHYM_FIELD_STRING, 0, {}, 0, 0 };
+  field.value.s = value;
+  return set(field);
+}
+
+// Sets an integer value with optional units
+bool FathymSnapshot::setLong(const char * name, long value, const char * units) {
+  FathymField field = { name, units, FATHYM_FIELD_LONG, 0, {}, 0, 0 };
+  field.value.l = value;
+  return set(field);
+}
+
+// Sets a floating point value with optional units, rounded to the given decimal places when written
+bool FathymSnapshot::setDouble(const char * name, double value, uint8_t decimals, const char * units) {
+  FathymField field = { name, units, FATHYM_FIELD_DOUBLE, decimals, {}, 0, 0 };
+  field.value.d = value;
+  return set(field);
+}
+
+// Sets a fixed point value with optional units; the value is scaled by 10^decimals
+bool FathymSnapshot::setFixed(const char * name, long value, uint8_t decimals, const char * units) {
+  FathymField field = { name, units, FATHYM_FIELD_FIXED, decimals, {}, 0, 0 };
+  field.value.l = value;
+  return set(field);
+}
+
+// Makes every value set for the name take its own entry (for series, which keep each sample).
+// Call from the publishing context before the value is set concurrently.
+void FathymSnapshot::keepEach(const char * name) {
+  if (keepsEach(name)) return;
+
+  uint8_t count = _eachCount.load();
+  if (count >= FATHYM_MAX_SERIES) return;
+
+  _each[count] = name;
+  _eachCount.store(count + 1);
+}
+
+// Sets the clock used to timestamp series samples
+void FathymSnapshot::setClock(FathymClock clock) {
+  _clock = clock;
+}
+
+// Adds a value to the back buffer (safe from interrupts and other threads)
+bool FathymSnapshot::set(const FathymField & value) {
+  // Join the writers of the back buffer, checking it wasn't swapped out while joining
+  uint8_t back = _back.load();
+  for (;;) {
+    _writers[back]++;
+    uint8_t current = _back.load();
+    if (current == back) break;
+    _writers[back]--;
+    back = current;
+  }
+
+  bool stored = value.type != FATHYM_FIELD_STRING && keepsEach(value.name) ?
+    storeSample(_samples[back], _sampleCounts[back], value) : store(_pending[back], _counts[back], value);
+  _writers[back]--;
+
+  if (!stored) _dropped++;
+  return stored;
+}
+
+// Updates the value's entry in the buffer, or takes a new one
+bool FathymSnapshot::store(FathymPending * buffer, std::atomic<uint8_t> & count, const FathymField & value) {
+  uint32_t time = _clock != NULL ? _clock() : 0;
+
+  uint8_t taken = count.load();
+  if (taken > FATHYM_MAX_PENDING) taken = FATHYM_MAX_PENDING;
+
+  for (uint8_t i = 0; i < taken; i++) {
+    FathymPending & entry = buffer[i];
+    uint8_t ready = FATHYM_PENDING_READY;
+    if (entry.state.load() == FATHYM_PENDING_READY &&
+        (entry.field.name == value.name || strcmp(entry.field.name, value.name) == 0) &&
+        entry.state.compare_exchange_strong(ready, FATHYM_PENDING_BUSY)) {
+      update(entry, value, time);
+      entry.state.store(FATHYM_PENDING_READY);
+      return true;
+    }
+  }
+
+  // Take the next free entry
+  uint8_t slot = count.load();
+  do {
+    if (slot >= FATHYM_MAX_PENDING) return false;
+  } while (!count.compare_exchange_weak(slot, slot + 1));
+
+  FathymPending & entry = buffer[slot];
+  memset(&entry.samples, 0, sizeof(entry.samples));
+  update(entry, value, time);
+  entry.state.store(FATHYM_PENDING_READY);
+  return true;
+}
+
+// Takes a new sample entry for a series value
+bool FathymSnapshot::storeSample(FathymPendingSample * buffer, std::atomic<uint8_t> & count, const FathymField & value) {
+  uint8_t slot = count.load();
+  do {
+    if (slot >= FATHYM_MAX_PENDING_SAMPLES) return false;
+  } while (!count.compare_exchange_weak(slot, slot + 1));
+
+  FathymPendingSample & entry = buffer[slot];
+  entry.field = value;
+  entry.time = _clock != NULL ? _clock() : 0;
+  entry.state.store(FATHYM_PENDING_READY);
+  return true;
+}
+
+// Replaces the entry's value, adding it to the entry's statistics
+void FathymSnapshot::update(FathymPending & entry, const FathymField & value, uint32_t time) {
+  entry.field = value;
+  entry.time = time;
+  if (value.type == FATHYM_FIELD_STRING) return;
+
+  fathymAddSample(entry.samples, sampleOf(value));
+}
+
+// Swaps the buffers and merges the values set since the last commit into the message, in the order
+// they were first set, checking the numbers against the given rules (if any) on the way (false if any
+// didn't fit the message). Call from the publishing context only.
+bool FathymSnapshot::commit(FathymMessage & message, FathymRules * rules) {
+  bool checking = rules != NULL && rules->count() > 0;
+  uint8_t old = _back.load();
+  _back.store(old ^ 1);
+
+  // Writers that joined the old buffer before the swap finish quickly (interrupts always do)
+  while (_writers[old].load() > 0) {}
+
+  bool success = true;
+  uint8_t taken = _counts[old].load();
+  if (taken > FATHYM_MAX_PENDING) taken = FATHYM_MAX_PENDING;
+
+  for (uint8_t i = 0; i < taken; i++) {
+    FathymPending & entry = _pending[old][i];
+    if (entry.state.load() != FATHYM_PENDING_READY) continue;
+
+    if (checking && entry.field.type != FATHYM_FIELD_STRING) {
+      rules->check(entry.field.name, sampleOf(entry.field), entry.time);
+    }
+
+    // Aggregated values take the statistics of every sample, series the timestamped sample
+    FathymField * field = message.find(entry.field.name);
+    if (field != NULL && field->type == FATHYM_FIELD_AGGREGATE && entry.samples.count > 0) {
+      message.addSamples(entry.field.name, entry.samples);
+    }
+    else if (field != NULL && field->type == FATHYM_FIELD_SERIES && entry.field.type != FATHYM_FIELD_STRING) {
+      message.sampleAt(entry.field.name, sampleOf(entry.field), entry.time);
+    }
+    else if (!message.set(entry.field)) {
+      success = false;
+    }
+
+    entry.state.store(FATHYM_PENDING_EMPTY);
+  }
+
+  _counts[old].store(0);
+
+  taken = _sampleCounts[old].load();
+  if (taken > FATHYM_MAX_PENDING_SAMPLES) taken = FATHYM_MAX_PENDING_SAMPLES;
+
+  for (uint8_t i = 0; i < taken; i++) {
+    FathymPendingSample & entry = _samples[old][i];
+    if (entry.state.load() != FATHYM_PENDING_READY) continue;
+
+    if (checking) {
+      rules->check(entry.field.name, sampleOf(entry.field), entry.time);
+    }
+
+    FathymField * field = message.find(entry.field.name);
+    if (field != NULL && field->type == FATHYM_FIELD_SERIES) {
+      message.sampleAt(entry.field.name, sampleOf(entry.field), entry.time);
+    }
+    else if (!message.set(entry.field)) {
+      success = false;
+    }
+
+    entry.state.store(FATHYM_PENDING_EMPTY);
+  }
+
+  _sampleCounts[old].store(0);
+  return success;
+}
+
+// Gets the number of values dropped because too many were set between publishes
+uint32_t FathymSnapshot::dropped(void) const {
+  return _dropped.load();
+}
+
+// Whether every value set for the name takes its own entry
+bool FathymSnapshot::keepsEach(const char * name) {
+  uint8_t count = _eachCount.load();
+  for (uint8_t i = 0; i < count; i++) {
+    if (_each[i] == name || strcmp(_each[i], name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
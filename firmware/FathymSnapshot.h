@@ -0,0 +1,109 @@
+/*
+Double-buffered message values for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_SNAPSHOT
+#define _FATHYM_SNAPSHOT
+
+#include <atomic>
+
+#include "FathymMessage.h"
+#include "FathymRules.h"
+
+// The maximum number of values that can be set between publishes when values are double buffered
+// (each value set takes one entry; repeated sets of a value update its entry, except for series)
+#ifndef FATHYM_MAX_PENDING
+#define FATHYM_MAX_PENDING 8
+#endif
+
+// The maximum number of series samples that can be set between publishes when values are double
+// buffered (kept apart from other values, as each sample takes an entry)
+#ifndef FATHYM_MAX_PENDING_SAMPLES
+#define FATHYM_MAX_PENDING_SAMPLES 16
+#endif
+
+// A value set since the last commit
+typedef struct {
+  FathymField field; // the last value set
+  FathymAggregate samples; // statistics of every numeric value set, for aggregated values
+  uint32_t time; // when the last value was set, for series
+  std::atomic<uint8_t> state; // FATHYM_PENDING_*
+} FathymPending;
+
+// A series sample set since the last commit
+typedef struct {
+  FathymField field; // the value set
+  uint32_t time; // when it was set
+  std::atomic<uint8_t> state; // FATHYM_PENDING_*
+} FathymPendingSample;
+
+// Double-buffered store of the values set between publishes, so values can be set from interrupts
+// or another thread while a message is being published. Writers add to the back buffer without
+// locking; commit() swaps the buffers, waits for writers still finishing on the old back buffer
+// and merges it into the message, so the message is only ever changed by the publisher and is
+// serialized as a consistent snapshot.
+//
+// Setting a value again before the next commit updates its pending entry in place, keeping the
+// statistics of every value set so aggregated values still see each sample. Values made series
+// with keepEach() instead take an entry (and timestamp) per sample from a buffer of their own, so
+// a fast series can't crowd out the other values. If the entry being updated is busy (an interrupt
+// preempted its writer), a new entry is taken and both are merged in order.
+//
+// Writers only record values: publish rules are checked by commit() as the values are merged, with
+// the latest value of each entry and every series sample, so rule state is only ever touched by the
+// publisher.
+class FathymSnapshot {
+public:
+  FathymSnapshot();
+
+  bool setBool(const char * name, bool value);
+  bool setString(const char * name, const char * value);
+  bool setLong(const char * name, long value, const char * units);
+  bool setDouble(const char * name, double value, uint8_t decimals, const char * units);
+  bool setFixed(const char * name, long value, uint8_t decimals, const char * units);
+  void keepEach(const char * name);
+  void setClock(FathymClock clock);
+  bool commit(FathymMessage & message, FathymRules * rules);
+  uint32_t dropped(void) const;
+
+private:
+  FathymPending _pending[2][FATHYM_MAX_PENDING];
+  std::atomic<uint8_t> _counts[2]; // entries taken in each buffer
+  FathymPendingSample _samples[2][FATHYM_MAX_PENDING_SAMPLES];
+  std::atomic<uint8_t> _sampleCounts[2]; // sample entries taken in each buffer
+  std::atomic<uint8_t> _writers[2]; // writers in progress on each buffer
+  std::atomic<uint8_t> _back; // the buffer writers add to
+  std::atomic<uint32_t> _dropped; // values and samples that found the back buffer full
+  const char * _each[FATHYM_MAX_SERIES]; // names that take an entry per sample
+  std::atomic<uint8_t> _eachCount;
+  FathymClock _clock;
+
+  bool set(const FathymField & value);
+  bool store(FathymPending * buffer, std::atomic<uint8_t> & count, const FathymField & value);
+  bool storeSample(FathymPendingSample * buffer, std::atomic<uint8_t> & count, const FathymField & value);
+  void update(FathymPending & entry, const FathymField & value, uint32_t time);
+  bool keepsEach(const char * name);
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include "FathymWriter.h"
+
+#include <math.h>
+#include <string.h>
+
+// Powers of ten used to scale and split fixed decimal values
+static const uint32_t POW10[FATHYM_WRITER_MAX_DECIMALS + 1] = {
+  1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL
+};
+
+static const double POW10_DOUBLE[FATHYM_WRITER_MAX_DECIMALS + 1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+// Two-digit lookup so each division by 100 produces two characters
+static const char DIGIT_PAIRS[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static const char BASE64_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Constructor (the last byte of the buffer is reserved for the terminator)
+FathymWriter::FathymWriter(char * buffer, size_t size) {
+  _buffer = buffer;
+  _size = size;
+  _length = 0;
+  _overflow = size == 0;
+}
+
+// Writes a single raw character
+void FathymWriter::write(char c) {
+  if (_length + 1 >= _size) {
+    _overflow = true;
+    return;
+  }
+  _buffer[_length++] = c;
+}
+
+// Writes a raw (unescaped) string
+void FathymWriter::write(const char * raw) {
+  write(raw, strlen(raw));
+}
+
+// Writes the given number of raw (unescaped) characters
+void FathymWriter::write(const char * raw, size_t length) {
+  if (_length + length >= _size) {
+    _overflow = true;
+    return;
+  }
+  memcpy(_buffer + _length, raw, length);
+  _length += length;
+}
+
+// Writes a property name and separator
+void FathymWriter::writeKey(const char * name) {
+  writeString(name);
+  write(':');
+}
+
+// Writes a quoted, escaped string value (NULL is written as null)
+void FathymWriter::writeString(const char * value) {
+  if (value == NULL) {
+    write("null", 4);
+    return;
+  }
+
+  write('"');
+  for (const char * c = value; *c; c++) {
+    switch (*c) {
+      case '"': write("\\\"", 2); break;
+      case '\\': write("\\\\", 2); break;
+      case '\n': write("\\n", 2); break;
+      case '\r': write("\\r", 2); break;
+      case '\t': write("\\t", 2); break;
+      default:
+        if ((uint8_t)*c < 0x20) {
+          write("\\u00", 4);
+          write(HEX_DIGITS[(*c >> 4) & 0x0F]);
+          write(HEX_DIGITS[*c & 0x0F]);
+        }
+        else {
+          write(*c);
+        }
+    }
+  }
+  write('"');
+}
+
+// Writes a boolean value
+void FathymWriter::writeBool(bool value) {
+  if (value) write("true", 4);
+  else write("false", 5);
+}
+
+// Writes a signed integer value
+void FathymWriter::writeLong(long value) {
+  if (value < 0) {
+    write('-');
+    writeUnsigned((uint64_t)(-(int64_t)value));
+  }
+  else {
+    writeUnsigned((uint64_t)value);
+  }
+}
+
+// Writes an unsigned integer value
+void FathymWriter::writeUnsigned(uint64_t value) {
+  // Keep to 32 bit arithmetic whenever the value allows it
+  if (value <= 0xFFFFFFFFULL) {
+    writeDigits((uint32_t)value, 1);
+    return;
+  }
+
+  writeUnsigned(value / POW10[9]);
+  writeDigits((uint32_t)(value % POW10[9]), 9);
+}
+
+// Writes a scaled integer as a fixed decimal value (e.g. 12345 with 2 decimals is 123.45)
+void FathymWriter::writeFixed(int64_t value, uint8_t decimals) {
+  if (decimals > FATHYM_WRITER_MAX_DECIMALS) decimals = FATHYM_WRITER_MAX_DECIMALS;
+
+  uint64_t magnitude;
+  if (value < 0) {
+    write('-');
+    magnitude = (uint64_t)(-value);
+  }
+  else {
+    magnitude = (uint64_t)value;
+  }
+
+  // Split into whole and fractional parts
+  uint64_t whole;
+  uint32_t fraction;
+  if (magnitude <= 0xFFFFFFFFULL) {
+    whole = (uint32_t)magnitude / POW10[decimals];
+    fraction = (uint32_t)magnitude % POW10[decimals];
+  }
+  else {
+    whole = magnitude / POW10[decimals];
+    fraction = (uint32_t)(magnitude % POW10[decimals]);
+  }
+
+  writeUnsigned(whole);
+
+  // Drop trailing zeros from the fraction
+  while (decimals > 0 && fraction % 10 == 0) {
+    fraction /= 10;
+    decimals--;
+  }
+
+  if (decimals > 0) {
+    write('.');
+    writeDigits(fraction, decimals);
+  }
+}
+
+// Writes a floating point value rounded to the given number of decimal places
+void FathymWriter::writeDouble(double value, uint8_t decimals) {
+  // JSON has no representation for these
+  if (isnan(value) || isinf(value)) {
+    write("null", 4);
+    return;
+  }
+
+  if (decimals > FATHYM_WRITER_MAX_DECIMALS) decimals = FATHYM_WRITER_MAX_DECIMALS;
+
+  bool negative = value < 0;
+  if (negative) value = -value;
+
+  double scaled = value * POW10_DOUBLE[decimals] + 0.5;
+
+  // The common case: the scaled value fits 32 bits so the rest is integer math
+  if (scaled < 4294967296.0) {
+    uint32_t fixed = (uint32_t)scaled;
+    if (negative && fixed != 0) write('-');
+    writeFixed(fixed, decimals);
+    return;
+  }
+
+  // Large values: shed decimal places until the scaled value is a whole number the double holds exactly
+  // (2^53), so no digits are written past its precision
+  while (scaled >= 9007199254740992.0 && decimals > 0) {
+    decimals--;
+    scaled = value * POW10_DOUBLE[decimals] + 0.5;
+  }
+
+  if (negative) write('-');
+
+  if (scaled < 9.2e18) {
+    writeFixed((int64_t)scaled, decimals);
+    return;
+  }
+
+  // Very large values are written in exponent notation
+  int exponent = (int)floor(log10(value));
+  writeDouble(value / pow(10.0, exponent), FATHYM_WRITER_MAX_DECIMALS);
+  write('e');
+  writeLong(exponent);
+}
+
+// Writes binary data as a quoted base64 string
+void FathymWriter::writeBase64(const uint8_t * data, size_t length) {
+  write('"');
+
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t chunk = (uint32_t)data[i] << 16;
+    if (i + 1 < length) chunk |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < length) chunk |= data[i + 2];
+
+    write(BASE64_DIGITS[(chunk >> 18) & 0x3F]);
+    write(BASE64_DIGITS[(chunk >> 12) & 0x3F]);
+    write(i + 1 < length ? BASE64_DIGITS[(chunk >> 6) & 0x3F] : '=');
+    write(i + 2 < length ? BASE64_DIGITS[chunk & 0x3F] : '=');
+  }
+
+  write('"');
+}
+
+// Gets the number of characters written so far
+size_t FathymWriter::length(void) {
+  return _length;
+}
+
+// Determines whether or not anything was dropped for lack of space
+bool FathymWriter::overflowed(void) {
+  return _overflow;
+}
+
+// Terminates the output and returns its length (0 if it did not fit the buffer)
+size_t FathymWriter::finish(void) {
+  if (_size > 0) {
+    _buffer[_length < _size ? _length : _size - 1] = '\0';
+  }
+  return _overflow ? 0 : _length;
+}
+
+// Writes the decimal digits of a value, zero padded to at least the given number of digits
+void FathymWriter::writeDigits(uint32_t value, uint8_t minDigits) {
+  char digits[10];
+  uint8_t pos = sizeof(digits);
+
+  while (value >= 100) {
+    uint32_t pair = (value % 100) * 2;
+    value /= 100;
+    digits[--pos] = DIGIT_PAIRS[pair + 1];
+    digits[--pos] = DIGIT_PAIRS[pair];
+  }
+
+  if (value >= 10) {
+    uint32_t pair = value * 2;
+    digits[--pos] = DIGIT_PAIRS[pair + 1];
+    digits[--pos] = DIGIT_PAIRS[pair];
+  }
+  else {
+    digits[--pos] = '0' + value;
+  }
+
+  while (sizeof(digits) - pos < minDigits) {
+    digits[--pos] = '0';
+  }
+
+  write(digits + pos, sizeof(digits) - pos);
+}
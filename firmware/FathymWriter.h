@@ -0,0 +1,67 @@
+/*
+JSON writer for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _FATHYM_WRITER
+#define _FATHYM_WRITER
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The largest number of decimal places the writer will format
+#define FATHYM_WRITER_MAX_DECIMALS 9
+
+// Allocation-free JSON writer into a fixed caller-provided buffer. Numbers are
+// formatted with integer arithmetic and lookup tables rather than the generic
+// float printing, and fixed decimal values drop their trailing zeros.
+class FathymWriter {
+public:
+  FathymWriter(char * buffer, size_t size);
+
+  void write(char c);
+  void write(const char * raw);
+  void write(const char * raw, size_t length);
+  void writeKey(const char * name);
+  void writeString(const char * value);
+  void writeBool(bool value);
+  void writeLong(long value);
+  void writeUnsigned(uint64_t value);
+  void writeFixed(int64_t value, uint8_t decimals);
+  void writeDouble(double value, uint8_t decimals);
+  void writeBase64(const uint8_t * data, size_t length);
+
+  size_t length(void);
+  bool overflowed(void);
+  size_t finish(void);
+
+private:
+  char * _buffer;
+  size_t _size;
+  size_t _length;
+  bool _overflow;
+
+  void writeDigits(uint32_t value, uint8_t minDigits);
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "LatencyHistogram.h"
+
+#include <string.h>
+
+// Constructor
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+// Records a latency sample in milliseconds
+void LatencyHistogram::record(uint32_t millis) {
+  // Find the bucket from the position of the highest set bit
+  uint8_t index = 0;
+  uint32_t value = millis;
+  while (value > 0 && index < LATENCY_HISTOGRAM_BUCKETS - 1) {
+    value >>= 1;
+    index++;
+  }
+
+  _buckets[index]++;
+  _count++;
+  if (millis < _min) _min = millis;
+  if (millis > _max) _max = millis;
+}
+
+// Clears all recorded samples
+void LatencyHistogram::reset(void) {
+  memset(_buckets, 0, sizeof(_buckets));
+  _count = 0;
+  _min = 0xFFFFFFFF;
+  _max = 0;
+}
+
+// Gets the number of recorded samples
+uint32_t LatencyHistogram::count(void) const {
+  return _count;
+}
+
+// Gets the smallest recorded sample (0 if there are none)
+uint32_t LatencyHistogram::min(void) const {
+  return _count > 0 ? _min : 0;
+}
+
+// Gets the largest recorded sample
+uint32_t LatencyHistogram::max(void) const {
+  return _max;
+}
+
+// Gets the number of samples in the given bucket
+uint32_t LatencyHistogram::bucket(uint8_t index) const {
+  if (index >= LATENCY_HISTOGRAM_BUCKETS) return 0;
+  return _buckets[index];
+}
+
+// Estimates the given percentile (0-100) in milliseconds by interpolating within its bucket
+uint32_t LatencyHistogram::percentile(uint8_t percent) const {
+  if (_count == 0) return 0;
+  if (percent > 100) percent = 100;
+
+  // The rank of the sample we are looking for (1-based)
+  uint32_t rank = ((uint64_t)_count * percent + 99) / 100;
+  if (rank == 0) rank = 1;
+
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    if (_buckets[i] == 0) continue;
+
+    if (seen + _buckets[i] >= rank) {
+      // Bucket bounds, clamped to the observed range
+      uint32_t lower = i == 0 ? 0 : (1UL << (i - 1));
+      uint32_t upper = i == LATENCY_HISTOGRAM_BUCKETS - 1 ? _max : (1UL << i);
+      if (lower < _min) lower = _min;
+      if (upper > _max) upper = _max;
+      if (upper < lower) upper = lower;
+
+      return lower + (uint32_t)((uint64_t)(upper - lower) * (rank - seen) / _buckets[i]);
+    }
+
+    seen += _buckets[i];
+  }
+
+  return _max;
+}
@@ -0,0 +1,56 @@
+/*
+Latency histogram for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _LATENCY_HISTOGRAM
+#define _LATENCY_HISTOGRAM
+
+#include <stdint.h>
+
+// The number of log-scale buckets. Bucket 0 holds samples under 1ms and
+// bucket i holds samples from 2^(i-1) up to 2^i ms, the last bucket also
+// holds everything beyond it.
+#define LATENCY_HISTOGRAM_BUCKETS 17
+
+// Fixed-size log2 histogram of millisecond latencies
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void record(uint32_t millis);
+  void reset(void);
+  uint32_t count(void) const;
+  uint32_t min(void) const;
+  uint32_t max(void) const;
+  uint32_t percentile(uint8_t percent) const;
+  uint32_t bucket(uint8_t index) const;
+
+private:
+  uint32_t _buckets[LATENCY_HISTOGRAM_BUCKETS];
+  uint32_t _count;
+  uint32_t _min;
+  uint32_t _max;
+};
+
+#endif
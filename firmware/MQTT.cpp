@@ -13,7 +13,27 @@
 #define MQTTQOS2_HEADER_MASK        (2 << 1)
 
 MQTT::MQTT() {
+    this->domain[0] = 0;
     this->ip = NULL;
+    this->txBuffer = this->rxBuffer = NULL;
+    this->txSize = this->rxSize = 0;
+    this->ownsBuffers = false;
+#if defined(SPARK)
+    this->ownsTransport = false;
+#endif
+    this->chunkcallback = NULL;
+    resetStats();
+    memset(inflightIds, 0, sizeof(inflightIds));
+    preparedTopicLength = 0;
+    cleanSession = true;
+    cacheAddress = false;
+    addressCached = false;
+    readHead = readTail = 0;
+    readFailed = false;
+    sessionKeepAlive = MQTT_KEEPALIVE;
+#if MQTT_OUTPUT_BUFFER_SIZE > 0
+    outLength = 0;
+#endif
 }
 
 MQTT::MQTT(char* domain, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int)
@@ -23,14 +43,32 @@ MQTT::MQTT(char* domain, uint16_t port, void (*callback)(char*,uint8_t*,unsigned
     ) {
     this->callback = callback;
     this->qoscallback = NULL;
-    this->domain = domain;
+    this->chunkcallback = NULL;
+    strncpy(this->domain, domain, MQTT_MAX_DOMAIN_SIZE - 1);
+    this->domain[MQTT_MAX_DOMAIN_SIZE - 1] = 0;
     this->port = port;
     this->ip = NULL;
     this->keepAlive = MQTT_KEEPALIVE;
+    this->txBuffer = this->rxBuffer = NULL;
+    this->txSize = this->rxSize = 0;
+    this->ownsBuffers = false;
 #if defined(ARDUINO)
     this->_client = &client;
 #elif defined(SPARK)
-    this->_client = new TCPClient();
+    this->_client = new MQTTTcpTransport();
+    this->ownsTransport = true;
+#endif
+    resetStats();
+    memset(inflightIds, 0, sizeof(inflightIds));
+    preparedTopicLength = 0;
+    cleanSession = true;
+    cacheAddress = false;
+    addressCached = false;
+    readHead = readTail = 0;
+    readFailed = false;
+    sessionKeepAlive = MQTT_KEEPALIVE;
+#if MQTT_OUTPUT_BUFFER_SIZE > 0
+    outLength = 0;
 #endif
 }
 
@@ -41,20 +79,100 @@ MQTT::MQTT(uint8_t *ip, uint16_t port, void (*callback)(char*,uint8_t*,unsigned
     ) {
     this->callback = callback;
     this->qoscallback = NULL;
+    this->chunkcallback = NULL;
+    this->domain[0] = 0;
     this->ip = ip;
     this->port = port;
     this->keepAlive = MQTT_KEEPALIVE;
+    this->txBuffer = this->rxBuffer = NULL;
+    this->txSize = this->rxSize = 0;
+    this->ownsBuffers = false;
 #if defined(ARDUINO)
     this->_client = &client;
 #elif defined(SPARK)
-    this->_client = new TCPClient();
+    this->_client = new MQTTTcpTransport();
+    this->ownsTransport = true;
+#endif
+    resetStats();
+    memset(inflightIds, 0, sizeof(inflightIds));
+    preparedTopicLength = 0;
+    cleanSession = true;
+    cacheAddress = false;
+    addressCached = false;
+    readHead = readTail = 0;
+    readFailed = false;
+    sessionKeepAlive = MQTT_KEEPALIVE;
+#if MQTT_OUTPUT_BUFFER_SIZE > 0
+    outLength = 0;
+#endif
+}
+
+MQTT::MQTT(char* domain, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int),
+#if defined(ARDUINO)
+        Client& client,
+#endif
+        uint8_t *txBuffer, uint16_t txSize, uint8_t *rxBuffer, uint16_t rxSize)
+    : MQTT(domain, port, callback
+#if defined(ARDUINO)
+        , client
+#endif
+    ) {
+    this->txBuffer = txBuffer;
+    this->txSize = txSize;
+    this->rxBuffer = rxBuffer;
+    this->rxSize = rxSize;
+}
+
+MQTT::MQTT(uint8_t *ip, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int),
+#if defined(ARDUINO)
+        Client& client,
+#endif
+        uint8_t *txBuffer, uint16_t txSize, uint8_t *rxBuffer, uint16_t rxSize)
+    : MQTT(ip, port, callback
+#if defined(ARDUINO)
+        , client
 #endif
+    ) {
+    this->txBuffer = txBuffer;
+    this->txSize = txSize;
+    this->rxBuffer = rxBuffer;
+    this->rxSize = rxSize;
+}
+
+MQTT::~MQTT() {
+    if (ownsBuffers) {
+        delete[] txBuffer;
+    }
+#if defined(SPARK)
+    if (ownsTransport) {
+        delete _client;
+    }
+#endif
+}
+
+// The plain client allocates one MQTT_MAX_PACKET_SIZE buffer on first connect, shared for TX and RX
+bool MQTT::allocateBuffers() {
+    if (txBuffer == NULL) {
+        txBuffer = rxBuffer = new uint8_t[MQTT_MAX_PACKET_SIZE];
+        if (txBuffer == NULL) {
+            return false;
+        }
+        txSize = rxSize = MQTT_MAX_PACKET_SIZE;
+        ownsBuffers = true;
+    }
+    return true;
 }
 
 void MQTT::addQosCallback(void (*qoscallback)(unsigned int)) {
     this->qoscallback = qoscallback;
 }
 
+// Publishes too large for the packet buffer are streamed to this callback
+// as (topic, offset, chunk, chunk length, total payload length) instead of dropped
+void MQTT::addChunkCallback(void (*chunkcallback)(char*,uint32_t,uint8_t*,uint16_t,uint32_t)) {
+    this->chunkcallback = chunkcallback;
+}
+
 bool MQTT::connect(const char *id) {
     return connect(id,NULL,NULL,0,QOS0,0,0);
 }
@@ -68,28 +186,50 @@ bool MQTT::connect(const char *id, const char* willTopic, EMQTT_QOS willQos, uin
 }
 
 bool MQTT::connect(const char *id, const char *user, const char *pass, const char* willTopic, EMQTT_QOS willQos, uint8_t willRetain, const char* willMessage) {
-      if (!isConnected()) {
+      if (!isConnected() && allocateBuffers()) {
+        unsigned long start = micros();
         int result = 0;
-        if (ip == NULL)
-            result = _client->connect(this->domain.c_str(), this->port);
-        else
+        if (ip != NULL)
             result = _client->connect(this->ip, this->port);
+#if defined(SPARK)
+        else if (cacheAddress && resolveAddress())
+            result = _client->connect(this->cachedAddress, this->port);
+#endif
+        else
+            result = _client->connect(this->domain, this->port);
+
+        // The cached address may be stale, resolve it again next time
+        if (!result) {
+            addressCached = false;
+        }
 
         if (result) {
+#if MQTT_OUTPUT_BUFFER_SIZE > 0
+            // Anything still buffered belonged to the previous connection
+            outLength = 0;
+#endif
+            // Start the read buffer empty so no bytes left from the old stream are parsed as packets
+            readHead = readTail = 0;
+            readFailed = false;
             nextMsgId = 1;
+            memset(inflightIds, 0, sizeof(inflightIds));
             uint8_t d[9] = {0x00,0x06,'M','Q','I','s','d','p',MQTTPROTOCOLVERSION};
-            // Leave room in the buffer for header and variable length field
+            // Leave room in the txBuffer for header and variable length field
             uint16_t length = 5;
             unsigned int j;
             for (j = 0;j<9;j++) {
-                buffer[length++] = d[j];
+                txBuffer[length++] = d[j];
             }
 
             uint8_t v;
             if (willTopic) {
-                v = 0x06|(willQos<<3)|(willRetain<<5);
+                v = 0x04|(willQos<<3)|(willRetain<<5);
             } else {
-                v = 0x02;
+                v = 0x00;
+            }
+
+            if (cleanSession) {
+                v = v|0x02;
             }
 
             if(user != NULL) {
@@ -100,166 +240,326 @@ bool MQTT::connect(const char *id, const char *user, const char *pass, const cha
                 }
             }
 
-            buffer[length++] = v;
+            txBuffer[length++] = v;
 
-            buffer[length++] = ((this->keepAlive) >> 8);
-            buffer[length++] = ((this->keepAlive) & 0xFF);
-            length = writeString(id, buffer, length);
+            txBuffer[length++] = ((this->keepAlive) >> 8);
+            txBuffer[length++] = ((this->keepAlive) & 0xFF);
+            length = writeString(id, txBuffer, length);
             if (willTopic) {
-                length = writeString(willTopic, buffer, length);
-                length = writeString(willMessage, buffer, length);
+                length = writeString(willTopic, txBuffer, length);
+                length = writeString(willMessage, txBuffer, length);
             }
 
             if(user != NULL) {
-                length = writeString(user,buffer,length);
+                length = writeString(user,txBuffer,length);
                 if(pass != NULL) {
-                    length = writeString(pass,buffer,length);
+                    length = writeString(pass,txBuffer,length);
                 }
             }
 
-            write(MQTTCONNECT, buffer, length-5);
+            write(MQTTCONNECT, txBuffer, length-5);
+            flush();
             lastInActivity = lastOutActivity = millis();
 
-            while (!_client->available()) {
+            while (!dataAvailable()) {
                 unsigned long t = millis();
                 if (t-lastInActivity > this->keepAlive*1000UL) {
                     _client->stop();
+                    stats.connectFailures++;
+                    stats.connectMicros = micros() - start;
                     return false;
                 }
             }
             uint8_t llen;
             uint16_t len = readPacket(&llen);
 
-            if (len == 4 && buffer[3] == 0) {
+            if (len == 4 && rxBuffer[3] == 0) {
+                sessionKeepAlive = keepAlive;
                 lastInActivity = millis();
                 pingOutstanding = false;
+                stats.connects++;
+                stats.connectMicros = micros() - start;
                 return true;
             }
         }
         _client->stop();
+        stats.connectFailures++;
+        stats.connectMicros = micros() - start;
     }
     return false;
 }
 
 uint8_t MQTT::readByte() {
-    while(!_client->available()) {}
-    return _client->read();
+    if (readHead == readTail && !fillReadBuffer()) {
+        return 0;
+    }
+    return readBuffer[readHead++];
+}
+
+// Reads count bytes into buf, or skips over them if buf is NULL
+void MQTT::readBytes(uint8_t* buf, uint32_t count) {
+    while (count > 0) {
+        if (readHead == readTail && !fillReadBuffer()) {
+            return;
+        }
+        uint16_t n = readTail - readHead;
+        if (n > count) {
+            n = count;
+        }
+        if (buf) {
+            memcpy(buf, readBuffer+readHead, n);
+            buf += n;
+        }
+        readHead += n;
+        count -= n;
+    }
+}
+
+// Waits for data and reads as much of it as fits with a single socket read. If the connection closes
+// or nothing arrives within MQTT_READ_TIMEOUT, the client is stopped and the packet being read fails.
+bool MQTT::fillReadBuffer() {
+    if (readFailed) {
+        return false;
+    }
+
+    unsigned long start = millis();
+    int n = 0;
+    while (n <= 0) {
+        if (_client->available()) {
+            n = _client->read(readBuffer, MQTT_READ_BUFFER_SIZE);
+        } else if (!_client->connected() || millis() - start >= MQTT_READ_TIMEOUT) {
+            _client->stop();
+            readFailed = true;
+            readHead = readTail = 0;
+            return false;
+        }
+    }
+    readHead = 0;
+    readTail = n;
+    stats.bytesIn += n;
+    stats.reads++;
+    return true;
+}
+
+bool MQTT::dataAvailable() {
+    return readHead < readTail || _client->available();
 }
 
 uint16_t MQTT::readPacket(uint8_t* lengthLength) {
     uint16_t len = 0;
-    buffer[len++] = readByte();
-    bool isPublish = (buffer[0]&0xF0) == MQTTPUBLISH;
+    readFailed = false;
+    rxBuffer[len++] = readByte();
+    bool isPublish = (rxBuffer[0]&0xF0) == MQTTPUBLISH;
     uint32_t multiplier = 1;
-    uint16_t length = 0;
+    uint32_t length = 0;
     uint8_t digit = 0;
     uint16_t skip = 0;
-    uint8_t start = 0;
+    uint32_t start = 0;
 
     do {
         digit = readByte();
-        buffer[len++] = digit;
+        rxBuffer[len++] = digit;
         length += (digit & 127) * multiplier;
         multiplier *= 128;
-    } while ((digit & 128) != 0);
+    } while ((digit & 128) != 0 && len < 5);
     *lengthLength = len-1;
 
+    if (len + length > rxSize) {
+        if (isPublish && chunkcallback) {
+            readChunkedPublish(rxBuffer[0], length);
+        } else {
+            skipBytes(length);
+            stats.packetsDropped++;
+        }
+        return 0; // This will cause the packet to be ignored.
+    }
+
     if (isPublish) {
         // Read in topic length to calculate bytes to skip over for Stream writing
-        buffer[len++] = readByte();
-        buffer[len++] = readByte();
-        skip = (buffer[*lengthLength+1]<<8)+buffer[*lengthLength+2];
+        rxBuffer[len++] = readByte();
+        rxBuffer[len++] = readByte();
+        skip = (rxBuffer[*lengthLength+1]<<8)+rxBuffer[*lengthLength+2];
         start = 2;
-        if (buffer[0] & MQTTQOS1_HEADER_MASK) {
+        if ((rxBuffer[0]&0x06) != MQTTQOS0_HEADER_MASK) {
             // skip message id
             skip += 2;
         }
     }
 
-    for (uint16_t i = start;i<length;i++) {
-        digit = readByte();
-        if (len < MQTT_MAX_PACKET_SIZE) {
-            buffer[len] = digit;
+    readBytes(rxBuffer+len, length-start);
+    len += length-start;
+
+    // The connection went away part way through the packet
+    if (readFailed) {
+        return 0;
+    }
+    stats.packetsIn++;
+
+    return len;
+}
+
+void MQTT::readChunkedPublish(uint8_t header, uint32_t length) {
+    // The topic is kept null terminated at the start of the rxBuffer, the rest holds each chunk
+    if (length < 2) {
+        skipBytes(length);
+        stats.packetsDropped++;
+        return;
+    }
+    uint16_t tl = readByte()<<8;
+    tl += readByte();
+    length -= 2;
+
+    // msgId only present for QOS>0
+    uint16_t idLength = (header&0x06) != MQTTQOS0_HEADER_MASK ? 2 : 0;
+    if (tl+idLength > length || tl+1 >= rxSize) {
+        skipBytes(length);
+        stats.packetsDropped++;
+        return;
+    }
+
+    readBytes(rxBuffer, tl);
+    rxBuffer[tl] = 0;
+    length -= tl;
+
+    uint16_t msgId = 0;
+    if (idLength) {
+        msgId = readByte()<<8;
+        msgId += readByte();
+        length -= 2;
+    }
+
+    if (readFailed) {
+        return;
+    }
+
+    uint8_t *chunk = rxBuffer+tl+1;
+    uint16_t chunkSize = rxSize-tl-1;
+    uint32_t offset = 0;
+    while (offset < length) {
+        uint16_t n = (length-offset < chunkSize) ? length-offset : chunkSize;
+        readBytes(chunk, n);
+        if (readFailed) {
+            return;
         }
-        len++;
+        chunkcallback((char*)rxBuffer, offset, chunk, n, length);
+        offset += n;
     }
+    stats.packetsIn++;
+    stats.packetsChunked++;
 
-    if (len > MQTT_MAX_PACKET_SIZE) {
-        len = 0; // This will cause the packet to be ignored.
+    lastInActivity = millis();
+    if (idLength) {
+        sendPublishAck(header, msgId);
     }
+}
 
-    return len;
+// Acknowledges a received publish: PUBACK for QOS1, PUBREC for QOS2 (the broker then sends PUBREL)
+void MQTT::sendPublishAck(uint8_t header, uint16_t msgId) {
+    txBuffer[0] = (header&0x06) == MQTTQOS2_HEADER_MASK ? MQTTPUBREC : MQTTPUBACK;
+    txBuffer[1] = 2;
+    txBuffer[2] = (msgId >> 8);
+    txBuffer[3] = (msgId & 0xFF);
+    send(txBuffer,4);
+    lastOutActivity = millis();
+}
+
+void MQTT::skipBytes(uint32_t count) {
+    readBytes(NULL, count);
 }
 
 bool MQTT::loop() {
     if (isConnected()) {
+        stats.loops++;
         unsigned long t = millis();
-        if ((t - lastInActivity > this->keepAlive*1000UL) || (t - lastOutActivity > this->keepAlive*1000UL)) {
+        // A new keep alive is only agreed with the broker on the next connect, so until then ping at the shorter of the two
+        unsigned long interval = (keepAlive < sessionKeepAlive ? keepAlive : sessionKeepAlive)*1000UL;
+        if ((t - lastInActivity > interval) || (t - lastOutActivity > interval)) {
             if (pingOutstanding) {
                 _client->stop();
                 return false;
             } else {
-                buffer[0] = MQTTPINGREQ;
-                buffer[1] = 0;
-                _client->write(buffer,2);
+                txBuffer[0] = MQTTPINGREQ;
+                txBuffer[1] = 0;
+                send(txBuffer,2);
+                pingSentAt = t;
                 lastOutActivity = t;
                 lastInActivity = t;
                 pingOutstanding = true;
             }
         }
-        if (_client->available()) {
+        if (dataAvailable()) {
+            unsigned long start = micros();
             uint8_t llen;
             uint16_t len = readPacket(&llen);
             uint16_t msgId = 0;
             uint8_t *payload;
             if (len > 0) {
                 lastInActivity = t;
-                uint8_t type = buffer[0]&0xF0;
+                uint8_t type = rxBuffer[0]&0xF0;
                 if (type == MQTTPUBLISH) {
                     if (callback) {
-                        uint16_t tl = (buffer[llen+1]<<8)+buffer[llen+2];
+                        uint16_t tl = (rxBuffer[llen+1]<<8)+rxBuffer[llen+2];
                         char topic[tl+1];
                         for (uint16_t i=0;i<tl;i++) {
-                            topic[i] = buffer[llen+3+i];
+                            topic[i] = rxBuffer[llen+3+i];
                         }
                         topic[tl] = 0;
                         // msgId only present for QOS>0
-                        if ((buffer[0]&0x06) == MQTTQOS1_HEADER_MASK) {
-                            msgId = (buffer[llen+3+tl]<<8)+buffer[llen+3+tl+1];
-                            payload = buffer+llen+3+tl+2;
+                        if ((rxBuffer[0]&0x06) != MQTTQOS0_HEADER_MASK) {
+                            msgId = (rxBuffer[llen+3+tl]<<8)+rxBuffer[llen+3+tl+1];
+                            payload = rxBuffer+llen+3+tl+2;
                             callback(topic,payload,len-llen-3-tl-2);
-
-                            buffer[0] = MQTTPUBACK;
-                            buffer[1] = 2;
-                            buffer[2] = (msgId >> 8);
-                            buffer[3] = (msgId & 0xFF);
-                            _client->write(buffer,4);
-                            lastOutActivity = t;
+                            sendPublishAck(rxBuffer[0], msgId);
                         } else {
-                            payload = buffer+llen+3+tl;
+                            payload = rxBuffer+llen+3+tl;
                             callback(topic,payload,len-llen-3-tl);
                         }
                     }
                 } else if (type == MQTTPUBACK || type == MQTTPUBREC) {
-                    if (qoscallback) {
-                        // msgId only present for QOS==0
-                        if (len == 4 && (buffer[0]&0x06) == MQTTQOS0_HEADER_MASK) {
-                            msgId = (buffer[2]<<8)+buffer[3];
+                    // msgId only present for QOS==0
+                    if (len == 4 && (rxBuffer[0]&0x06) == MQTTQOS0_HEADER_MASK) {
+                        msgId = (rxBuffer[2]<<8)+rxBuffer[3];
+                        ackInflight(msgId);
+                        if (qoscallback) {
                             this->qoscallback(msgId);
                         }
                     }
+                } else if (type == MQTTPUBREL) {
+                    // The broker releases a QOS2 publish we sent PUBREC for
+                    if (len == 4) {
+                        msgId = (rxBuffer[2]<<8)+rxBuffer[3];
+                        txBuffer[0] = MQTTPUBCOMP;
+                        txBuffer[1] = 2;
+                        txBuffer[2] = (msgId >> 8);
+                        txBuffer[3] = (msgId & 0xFF);
+                        send(txBuffer,4);
+                        lastOutActivity = t;
+                    }
                 } else if (type == MQTTPUBCOMP) {
                     // TODO:if something...
                 } else if (type == MQTTSUBACK) {
                     // if something...
                 } else if (type == MQTTPINGREQ) {
-                    buffer[0] = MQTTPINGRESP;
-                    buffer[1] = 0;
-                    _client->write(buffer,2);
+                    txBuffer[0] = MQTTPINGRESP;
+                    txBuffer[1] = 0;
+                    send(txBuffer,2);
                 } else if (type == MQTTPINGRESP) {
+                    if (pingOutstanding) {
+                        stats.lastRttMillis = millis() - pingSentAt;
+                        rtt.record(stats.lastRttMillis);
+                    }
                     pingOutstanding = false;
                 }
             }
+            stats.parseMicros = micros() - start;
+            if (stats.parseMicros > stats.maxParseMicros) {
+                stats.maxParseMicros = stats.parseMicros;
+            }
+        }
+
+        // Write out what this update coalesced; a failed write drops the connection like a missed ping
+        if (!flush()) {
+            return false;
         }
         return true;
     }
@@ -288,47 +588,112 @@ bool MQTT::publish(const char* topic, const uint8_t* payload, unsigned int pleng
 
 bool MQTT::publish(const char* topic, const uint8_t* payload, unsigned int plength, bool retain, EMQTT_QOS qos, uint16_t *messageid) {
     if (isConnected()) {
-        // Leave room in the buffer for header and variable length field
+        // Leave room in the txBuffer for header and variable length field
         uint16_t length = 5;
-        memset(buffer, 0, sizeof(buffer));
+        length = writeString(topic, txBuffer, length);
+        return publishPayload(length, payload, plength, retain, qos, messageid);
+    }
+    return false;
+}
 
-        length = writeString(topic, buffer, length);
+bool MQTT::prepareTopic(const char* topic) {
+    uint16_t length = strlen(topic);
+    if (length > MQTT_MAX_TOPIC_SIZE) {
+        preparedTopicLength = 0;
+        return false;
+    }
 
-        if (qos == QOS2 || qos == QOS1) {
-            *messageid = nextMsgId++;
-            buffer[length++] = (*messageid >> 8);
-            buffer[length++] = (*messageid & 0xFF);
-        }
+    // Store the topic exactly as it is encoded in a PUBLISH packet
+    preparedTopic[0] = (length >> 8);
+    preparedTopic[1] = (length & 0xFF);
+    memcpy(preparedTopic+2, topic, length);
+    preparedTopicLength = length+2;
+    return true;
+}
 
-        for (uint16_t i=0; i < plength && length < MQTT_MAX_PACKET_SIZE; i++) {
-            buffer[length++] = payload[i];
-        }
+bool MQTT::publishPrepared(const uint8_t* payload, unsigned int plength, bool retain, EMQTT_QOS qos, uint16_t *messageid) {
+    if (preparedTopicLength == 0) {
+        return false;
+    }
 
-        uint8_t header = MQTTPUBLISH;
-        if (retain) {
-            header |= 1;
-        }
+    if (isConnected()) {
+        // Leave room in the txBuffer for header and variable length field
+        memcpy(txBuffer+5, preparedTopic, preparedTopicLength);
+        return publishPayload(5+preparedTopicLength, payload, plength, retain, qos, messageid);
+    }
+    return false;
+}
 
-        if (qos == QOS2)
-            header |= MQTTQOS2_HEADER_MASK;
-        else if (qos == QOS1)
-            header |= MQTTQOS1_HEADER_MASK;
-        else
-            header |= MQTTQOS0_HEADER_MASK;
+bool MQTT::publishPayload(uint16_t length, const uint8_t* payload, unsigned int plength, bool retain, EMQTT_QOS qos, uint16_t *messageid) {
+    if (qos == QOS2 || qos == QOS1) {
+        *messageid = nextMsgId++;
+        txBuffer[length++] = (*messageid >> 8);
+        txBuffer[length++] = (*messageid & 0xFF);
+    }
 
-        return write(header, buffer, length-5);
+    if (length >= txSize) {
+        plength = 0;
+    } else if (plength > (unsigned int)(txSize - length)) {
+        plength = txSize - length;
+    }
+    memcpy(txBuffer+length, payload, plength);
+    length += plength;
+
+    uint8_t header = MQTTPUBLISH;
+    if (retain) {
+        header |= 1;
+    }
+
+    if (qos == QOS2)
+        header |= MQTTQOS2_HEADER_MASK;
+    else if (qos == QOS1)
+        header |= MQTTQOS1_HEADER_MASK;
+    else
+        header |= MQTTQOS0_HEADER_MASK;
+
+    bool rc = write(header, txBuffer, length-5);
+    if (rc && qos != QOS0) {
+        trackInflight(*messageid);
+    }
+    return rc;
+}
+
+void MQTT::trackInflight(uint16_t messageid) {
+    // Use a free slot, or replace the oldest one if every slot is waiting
+    uint8_t slot = 0;
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (inflightIds[i] == 0) {
+            slot = i;
+            break;
+        }
+        if (now - inflightSentAt[i] > now - inflightSentAt[slot]) {
+            slot = i;
+        }
+    }
+    inflightIds[slot] = messageid;
+    inflightSentAt[slot] = now;
+}
+
+void MQTT::ackInflight(uint16_t messageid) {
+    for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (inflightIds[i] == messageid && messageid != 0) {
+            stats.lastAckMillis = millis() - inflightSentAt[i];
+            ackLatency.record(stats.lastAckMillis);
+            inflightIds[i] = 0;
+            return;
+        }
     }
-    return false;
 }
 
 bool MQTT::publishRelease(uint16_t messageid) {
     if (isConnected()) {
         uint16_t length = 0;
-        buffer[length++] = MQTTPUBREL | MQTTQOS1_HEADER_MASK;
-        buffer[length++] = 2;
-        buffer[length++] = (messageid >> 8);
-        buffer[length++] = (messageid & 0xFF);
-        return _client->write(buffer, length);
+        txBuffer[length++] = MQTTPUBREL | MQTTQOS1_HEADER_MASK;
+        txBuffer[length++] = 2;
+        txBuffer[length++] = (messageid >> 8);
+        txBuffer[length++] = (messageid & 0xFF);
+        return send(txBuffer, length) == length;
     }
     return false;
 }
@@ -355,12 +720,73 @@ bool MQTT::write(uint8_t header, uint8_t* buf, uint16_t length) {
     for (int i = 0; i < llen; i++) {
         buf[5-llen+i] = lenBuf[i];
     }
-    rc = _client->write(buf+(4-llen), length+1+llen);
+    rc = send(buf+(4-llen), length+1+llen);
 
     lastOutActivity = millis();
     return (rc == 1+llen+length);
 }
 
+uint16_t MQTT::send(const uint8_t* buf, uint16_t length) {
+    stats.packetsOut++;
+#if MQTT_OUTPUT_BUFFER_SIZE > 0
+    // Make room for the packet, sending it straight out if it could never fit.
+    // If the packets ahead of it can't be written, neither can this one.
+    if (outLength + length > MQTT_OUTPUT_BUFFER_SIZE) {
+        if (!flush()) {
+            return 0;
+        }
+        if (length > MQTT_OUTPUT_BUFFER_SIZE) {
+            return sendNow(buf, length);
+        }
+    }
+
+    memcpy(outBuffer+outLength, buf, length);
+    outLength += length;
+    if (outLength >= MQTT_OUTPUT_FLUSH_SIZE && !flush()) {
+        return 0;
+    }
+    return length;
+#else
+    return sendNow(buf, length);
+#endif
+}
+
+bool MQTT::flush() {
+#if MQTT_OUTPUT_BUFFER_SIZE > 0
+    if (outLength == 0) {
+        return true;
+    }
+
+    uint16_t length = outLength;
+    outLength = 0;
+    stats.flushes++;
+    if (sendNow(outBuffer, length) != length) {
+        // The stream may have been cut mid-packet and the coalesced packets are gone, so drop the
+        // connection rather than reporting it as connected and letting the client reconnect
+        _client->stop();
+        return false;
+    }
+    return true;
+#else
+    return true;
+#endif
+}
+
+uint16_t MQTT::sendNow(const uint8_t* buf, uint16_t length) {
+    unsigned long start = micros();
+    uint16_t rc = _client->write(buf, length);
+
+    stats.writeMicros = micros() - start;
+    if (stats.writeMicros > stats.maxWriteMicros) {
+        stats.maxWriteMicros = stats.writeMicros;
+    }
+    stats.bytesOut += rc;
+    if (rc != length) {
+        stats.writeErrors++;
+    }
+    return rc;
+}
+
 bool MQTT::subscribe(const char* topic) {
     return subscribe(topic, QOS0);
 }
@@ -370,17 +796,17 @@ bool MQTT::subscribe(const char* topic, EMQTT_QOS qos) {
         return false;
 
     if (isConnected()) {
-        // Leave room in the buffer for header and variable length field
+        // Leave room in the txBuffer for header and variable length field
         uint16_t length = 5;
         nextMsgId++;
         if (nextMsgId == 0) {
             nextMsgId = 1;
         }
-        buffer[length++] = (nextMsgId >> 8);
-        buffer[length++] = (nextMsgId & 0xFF);
-        length = writeString(topic, buffer,length);
-        buffer[length++] = qos;
-        return write(MQTTSUBSCRIBE | MQTTQOS1_HEADER_MASK,buffer,length-5);
+        txBuffer[length++] = (nextMsgId >> 8);
+        txBuffer[length++] = (nextMsgId & 0xFF);
+        length = writeString(topic, txBuffer,length);
+        txBuffer[length++] = qos;
+        return write(MQTTSUBSCRIBE | MQTTQOS1_HEADER_MASK,txBuffer,length-5);
     }
     return false;
 }
@@ -392,18 +818,21 @@ bool MQTT::unsubscribe(const char* topic) {
         if (nextMsgId == 0) {
             nextMsgId = 1;
         }
-        buffer[length++] = (nextMsgId >> 8);
-        buffer[length++] = (nextMsgId & 0xFF);
-        length = writeString(topic, buffer,length);
-        return write(MQTTUNSUBSCRIBE | MQTTQOS1_HEADER_MASK,buffer,length-5);
+        txBuffer[length++] = (nextMsgId >> 8);
+        txBuffer[length++] = (nextMsgId & 0xFF);
+        length = writeString(topic, txBuffer,length);
+        return write(MQTTUNSUBSCRIBE | MQTTQOS1_HEADER_MASK,txBuffer,length-5);
     }
     return false;
 }
 
 void MQTT::disconnect() {
-    buffer[0] = MQTTDISCONNECT;
-    buffer[1] = 0;
-    _client->write(buffer,2);
+    if (txBuffer != NULL) {
+        txBuffer[0] = MQTTDISCONNECT;
+        txBuffer[1] = 0;
+        send(txBuffer,2);
+        flush();
+    }
     _client->stop();
     lastInActivity = lastOutActivity = millis();
 }
@@ -412,7 +841,7 @@ uint16_t MQTT::writeString(const char* string, uint8_t* buf, uint16_t pos) {
     const char* idp = string;
     uint16_t i = 0;
     pos += 2;
-    while (*idp && pos < MQTT_MAX_PACKET_SIZE) {
+    while (*idp && pos < txSize) {
         buf[pos++] = *idp++;
         i++;
     }
@@ -428,6 +857,78 @@ bool MQTT::isConnected() {
     return rc;
 }
 
+// Takes effect on the next connect; a shorter keep alive is also used for pinging right away
 void MQTT::setKeepAlive(uint16_t seconds) {
   this->keepAlive = seconds;
 }
+
+void MQTT::setCleanSession(bool clean) {
+    this->cleanSession = clean;
+}
+
+void MQTT::setAddressCaching(bool cache) {
+    this->cacheAddress = cache;
+    if (!cache) {
+        this->addressCached = false;
+    }
+}
+
+#if defined(SPARK)
+bool MQTT::resolveAddress() {
+    if (!addressCached) {
+        IPAddress address = WiFi.resolve(this->domain);
+        if (!address) {
+            return false;
+        }
+        for (uint8_t i = 0; i < 4; i++) {
+            cachedAddress[i] = address[i];
+        }
+        addressCached = true;
+    }
+    return true;
+}
+#endif
+
+const MQTT::MQTT_STATS& MQTT::getStats() {
+    return stats;
+}
+
+void MQTT::resetStats() {
+    memset(&stats, 0, sizeof(stats));
+}
+
+const LatencyHistogram& MQTT::getRttHistogram() {
+    return rtt;
+}
+
+const LatencyHistogram& MQTT::getAckHistogram() {
+    return ackLatency;
+}
+
+void MQTT::resetLatency() {
+    rtt.reset();
+    ackLatency.reset();
+}
+
+uint16_t MQTT::getTxSize() {
+    return txSize;
+}
+
+uint16_t MQTT::getRxSize() {
+    return rxSize;
+}
+
+#if defined(SPARK)
+// Swaps the byte stream the client runs over (e.g. TLS) and takes ownership of it; use while disconnected
+void MQTT::setTransport(MQTTTransport *transport) {
+    if (_client == transport) {
+        return;
+    }
+    if (ownsTransport) {
+        _client->stop();
+        delete _client;
+    }
+    _client = transport;
+    ownsTransport = true;
+}
+#endif
@@ -63,8 +63,11 @@ sample code bearing this copyright.
 #include "spark_wiring_usbserial.h"
 #endif
 
+#include "MQTTTransport.h"
 
-// MQTT_MAX_PACKET_SIZE : Maximum packet size
+#include "LatencyHistogram.h"
+
+// MQTT_MAX_PACKET_SIZE : Maximum packet size (shared TX/RX buffer of the plain MQTT client, see MQTTSized)
 #ifndef MQTT_MAX_PACKET_SIZE
 #define MQTT_MAX_PACKET_SIZE 128
 #endif // Let this be overriden by build.h if present
@@ -74,6 +77,41 @@ sample code bearing this copyright.
 #define MQTT_KEEPALIVE 15
 #endif // Let this be overriden by build.h if present
 
+// MQTT_MAX_TOPIC_SIZE : Maximum length of a topic prepared with prepareTopic()
+#ifndef MQTT_MAX_TOPIC_SIZE
+#define MQTT_MAX_TOPIC_SIZE 64
+#endif // Let this be overriden by build.h if present
+
+// MQTT_MAX_DOMAIN_SIZE : Maximum length of the broker's host name (including the terminator)
+#ifndef MQTT_MAX_DOMAIN_SIZE
+#define MQTT_MAX_DOMAIN_SIZE 64
+#endif // Let this be overriden by build.h if present
+
+// MQTT_MAX_INFLIGHT : Number of QoS publishes tracked for acknowledgement latency
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 8
+#endif // Let this be overriden by build.h if present
+
+// MQTT_OUTPUT_BUFFER_SIZE : Size of the buffer that coalesces outbound packets into fewer writes (0 disables it)
+#ifndef MQTT_OUTPUT_BUFFER_SIZE
+#define MQTT_OUTPUT_BUFFER_SIZE 0
+#endif // Let this be overriden by build.h if present
+
+// MQTT_OUTPUT_FLUSH_SIZE : Number of coalesced bytes at which the output buffer is written out
+#ifndef MQTT_OUTPUT_FLUSH_SIZE
+#define MQTT_OUTPUT_FLUSH_SIZE MQTT_OUTPUT_BUFFER_SIZE
+#endif // Let this be overriden by build.h if present
+
+// MQTT_READ_BUFFER_SIZE : Size of the buffer that inbound bytes are read into in bulk from the socket
+#ifndef MQTT_READ_BUFFER_SIZE
+#define MQTT_READ_BUFFER_SIZE 64
+#endif // Let this be overriden by build.h if present
+
+// MQTT_READ_TIMEOUT : Milliseconds to wait for the rest of a packet before the connection is dropped
+#ifndef MQTT_READ_TIMEOUT
+#define MQTT_READ_TIMEOUT 5000
+#endif // Let this be overriden by build.h if present
+
 #define MQTTPROTOCOLVERSION 3
 #define MQTTCONNECT     1 << 4  // Client request to connect to Server
 #define MQTTCONNACK     2 << 4  // Connect Acknowledgment
@@ -100,27 +138,92 @@ typedef enum{
     QOS2 = 2,
 }EMQTT_QOS;
 
+// Traffic and timing counters collected by the client
+typedef struct{
+    uint32_t bytesIn;         // bytes read from the network
+    uint32_t reads;           // bulk reads from the network
+    uint32_t bytesOut;        // bytes written to the network
+    uint32_t packetsIn;       // complete packets read
+    uint32_t packetsOut;      // packets written
+    uint32_t packetsDropped;  // inbound packets discarded for exceeding MQTT_MAX_PACKET_SIZE
+    uint32_t packetsChunked;  // inbound publishes streamed to the chunk callback
+    uint32_t writeErrors;     // failed or short writes
+    uint32_t flushes;         // writes of the coalesced output buffer
+    uint32_t connects;        // successful connects
+    uint32_t connectFailures; // failed connect attempts
+    uint32_t loops;           // calls to loop() while connected
+    uint32_t connectMicros;   // duration of the last connect attempt
+    uint32_t parseMicros;     // duration of the last packet read/dispatch
+    uint32_t maxParseMicros;  // longest packet read/dispatch
+    uint32_t writeMicros;     // duration of the last write
+    uint32_t maxWriteMicros;  // longest write
+    uint32_t lastRttMillis;   // round trip time of the last ping
+    uint32_t lastAckMillis;   // acknowledgement latency of the last tracked QoS publish
+}MQTT_STATS;
+
 private:
 #if defined(ARDUINO)
     Client *_client;
 #elif defined(SPARK)
-    TCPClient *_client;
+    MQTTTransport *_client;
+    bool ownsTransport;
 #endif
-    uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+    uint8_t *txBuffer;
+    uint16_t txSize;
+    uint8_t *rxBuffer;
+    uint16_t rxSize;
+    bool ownsBuffers;
+    bool allocateBuffers();
     uint16_t nextMsgId;
     unsigned long lastOutActivity;
     unsigned long lastInActivity;
     bool pingOutstanding;
+    unsigned long pingSentAt;
+    uint16_t inflightIds[MQTT_MAX_INFLIGHT];
+    unsigned long inflightSentAt[MQTT_MAX_INFLIGHT];
+    LatencyHistogram rtt;
+    LatencyHistogram ackLatency;
+    void trackInflight(uint16_t messageid);
+    void ackInflight(uint16_t messageid);
     void (*callback)(char*,uint8_t*,unsigned int);
     void (*qoscallback)(unsigned int);
+    void (*chunkcallback)(char*,uint32_t,uint8_t*,uint16_t,uint32_t);
     uint16_t readPacket(uint8_t*);
+    void readChunkedPublish(uint8_t header, uint32_t length);
+    void sendPublishAck(uint8_t header, uint16_t msgId);
+    void skipBytes(uint32_t count);
     uint8_t readByte();
+    void readBytes(uint8_t* buf, uint32_t count);
+    bool fillReadBuffer();
+    bool dataAvailable();
+    uint8_t readBuffer[MQTT_READ_BUFFER_SIZE];
+    uint16_t readHead;
+    uint16_t readTail;
+    bool readFailed;
     bool write(uint8_t header, uint8_t* buf, uint16_t length);
+    uint16_t send(const uint8_t* buf, uint16_t length);
+    uint16_t sendNow(const uint8_t* buf, uint16_t length);
+#if MQTT_OUTPUT_BUFFER_SIZE > 0
+    uint8_t outBuffer[MQTT_OUTPUT_BUFFER_SIZE];
+    uint16_t outLength;
+#endif
     uint16_t writeString(const char* string, uint8_t* buf, uint16_t pos);
-    String domain;
+    bool publishPayload(uint16_t length, const uint8_t* payload, unsigned int plength, bool retain, EMQTT_QOS qos, uint16_t *messageid);
+    uint8_t preparedTopic[MQTT_MAX_TOPIC_SIZE+2];
+    uint16_t preparedTopicLength;
+    char domain[MQTT_MAX_DOMAIN_SIZE];
     uint8_t *ip;
     uint16_t port;
     uint16_t keepAlive;
+    uint16_t sessionKeepAlive;
+    bool cleanSession;
+    bool cacheAddress;
+    bool addressCached;
+    uint8_t cachedAddress[4];
+#if defined(SPARK)
+    bool resolveAddress();
+#endif
+    MQTT_STATS stats;
 
 public:
     MQTT();
@@ -135,6 +238,7 @@ public:
         , Client& client
 #endif
         );
+    ~MQTT();
 
     bool connect(const char *);
     bool connect(const char *, const char *, const char *);
@@ -148,15 +252,78 @@ public:
     bool publish(const char *, const uint8_t *, unsigned int, EMQTT_QOS, uint16_t *messageid);
     bool publish(const char *, const uint8_t *, unsigned int, bool);
     bool publish(const char *, const uint8_t *, unsigned int, bool, EMQTT_QOS, uint16_t *messageid);
+    bool prepareTopic(const char *);
+    bool publishPrepared(const uint8_t *, unsigned int, bool, EMQTT_QOS, uint16_t *messageid);
     void addQosCallback(void (*qoscallback)(unsigned int));
+    void addChunkCallback(void (*chunkcallback)(char*,uint32_t,uint8_t*,uint16_t,uint32_t));
     bool publishRelease(uint16_t messageid);
 
     bool subscribe(const char *);
     bool subscribe(const char *, EMQTT_QOS);
     bool unsubscribe(const char *);
     bool loop();
+    bool flush();
     bool isConnected();
     void setKeepAlive(uint16_t seconds);
+    void setCleanSession(bool clean);
+    void setAddressCaching(bool cache);
+    const MQTT_STATS& getStats();
+    void resetStats();
+    const LatencyHistogram& getRttHistogram();
+    const LatencyHistogram& getAckHistogram();
+    void resetLatency();
+    uint16_t getTxSize();
+    uint16_t getRxSize();
+#if defined(SPARK)
+    void setTransport(MQTTTransport *transport);
+#endif
+
+protected:
+    // Used by MQTTSized to hand over its own TX/RX storage instead of allocating MQTT_MAX_PACKET_SIZE for both
+    MQTT(char* domain, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int),
+#if defined(ARDUINO)
+        Client& client,
+#endif
+        uint8_t *txBuffer, uint16_t txSize, uint8_t *rxBuffer, uint16_t rxSize);
+    MQTT(uint8_t *, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int),
+#if defined(ARDUINO)
+        Client& client,
+#endif
+        uint8_t *txBuffer, uint16_t txSize, uint8_t *rxBuffer, uint16_t rxSize);
+};
+
+// MQTT client with separately sized transmit and receive buffers held in the object itself, so each
+// device profile spends exactly the RAM it needs. The TX buffer bounds outbound packets (topic and
+// payload of a publish), the RX buffer bounds inbound packets (larger publishes go to the chunk callback).
+template<uint16_t TX_SIZE, uint16_t RX_SIZE>
+class MQTTSized : public MQTT {
+    static_assert(TX_SIZE >= 32, "MQTT TX buffer must hold at least a CONNECT packet");
+    static_assert(RX_SIZE >= 8, "MQTT RX buffer must hold at least a CONNACK/PUBACK and a publish header");
+
+private:
+    uint8_t tx[TX_SIZE];
+    uint8_t rx[RX_SIZE];
+
+public:
+    MQTTSized(char* domain, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int)
+#if defined(ARDUINO)
+        , Client& client
+#endif
+        ) : MQTT(domain, port, callback,
+#if defined(ARDUINO)
+        client,
+#endif
+        tx, TX_SIZE, rx, RX_SIZE) {}
+
+    MQTTSized(uint8_t *ip, uint16_t port, void (*callback)(char*,uint8_t*,unsigned int)
+#if defined(ARDUINO)
+        , Client& client
+#endif
+        ) : MQTT(ip, port, callback,
+#if defined(ARDUINO)
+        client,
+#endif
+        tx, TX_SIZE, rx, RX_SIZE) {}
 };
 
 
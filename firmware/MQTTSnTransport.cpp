@@ -0,0 +1,669 @@
+#include "MQTTSnTransport.h"
+
+#if MQTT_USE_SN
+
+#if defined(SPARK)
+#include "application.h"
+#endif
+
+#include <string.h>
+
+#define MQTTSN_PROTOCOL_ID   0x01
+#define MQTTSN_FLAG_DUP      0x80
+#define MQTTSN_FLAG_QOS_N1   0x60 // QoS -1: publish without a connection
+#define MQTTSN_FLAG_RETAIN   0x10
+#define MQTTSN_FLAG_CLEAN    0x04
+#define MQTTSN_TOPIC_MASK    0x03
+#define MQTTSN_RC_ACCEPTED   0x00
+#define MQTTSN_RC_INVALID_ID 0x02
+#define MQTTSN_RC_NOT_SUPPORTED 0x03
+
+// Largest message body (after the length and type) that fits in a datagram
+#define MQTTSN_MAX_BODY (MQTT_SN_MAX_PACKET_SIZE-4)
+
+MQTTSnTransport::MQTTSnTransport() {
+    open = false;
+    connectionless = false;
+    nextMsgId = 1;
+    memset(topics, 0, sizeof(topics));
+    reset();
+}
+
+// Clears the per-connection state; topic registrations only last for one connection, predefined IDs are kept
+void MQTTSnTransport::reset() {
+    inHead = inTail = 0;
+    pendingLength = 0;
+    inboundMsgId = inboundTopicId = 0;
+    for (uint8_t i = 0; i < MQTT_SN_MAX_TOPICS; i++) {
+        if (topics[i].type != MQTTSN_TOPIC_PREDEFINED) {
+            memset(&topics[i], 0, sizeof(MQTTSN_TOPIC));
+        }
+    }
+}
+
+void MQTTSnTransport::setConnectionless(bool connectionless) {
+    this->connectionless = connectionless;
+}
+
+// Maps a topic to an ID agreed with the gateway in advance, so it is published without registering
+bool MQTTSnTransport::setPredefinedTopic(const char* topic, uint16_t id) {
+    uint16_t topicLength = strlen(topic);
+    int slot = findTopic(topic, topicLength);
+    if (slot < 0) {
+        slot = allocateTopic(topic, topicLength);
+    }
+    if (slot < 0) {
+        return false;
+    }
+    topics[slot].id = id;
+    topics[slot].type = MQTTSN_TOPIC_PREDEFINED;
+    topics[slot].awaiting = 0;
+    return true;
+}
+
+int MQTTSnTransport::connect(const char* host, uint16_t port) {
+    stop();
+    if (!openGateway(host, port)) {
+        return 0;
+    }
+    reset();
+    open = true;
+    return 1;
+}
+
+int MQTTSnTransport::connect(uint8_t* ip, uint16_t port) {
+    stop();
+    if (!openGateway(ip, port)) {
+        return 0;
+    }
+    reset();
+    open = true;
+    return 1;
+}
+
+uint8_t MQTTSnTransport::connected() {
+    return open;
+}
+
+void MQTTSnTransport::stop() {
+    if (open) {
+        closeGateway();
+        open = false;
+    }
+}
+
+// Translates each MQTT packet written (MQTT always writes whole packets) into an MQTT-SN message
+size_t MQTTSnTransport::write(const uint8_t* buf, size_t size) {
+    if (!open) {
+        return 0;
+    }
+
+    size_t pos = 0;
+    while (pos < size) {
+        uint32_t length = 0;
+        uint32_t multiplier = 1;
+        size_t i = pos + 1;
+        uint8_t digit;
+        do {
+            if (i >= size) {
+                return pos;
+            }
+            digit = buf[i++];
+            length += (digit & 127) * multiplier;
+            multiplier *= 128;
+        } while ((digit & 128) != 0 && i - pos <= 4);
+
+        if (i + length > size || !translateOutbound(buf[pos], buf + i, length)) {
+            return pos;
+        }
+        pos = i + length;
+    }
+    return pos;
+}
+
+int MQTTSnTransport::available() {
+    if (!open) {
+        return 0;
+    }
+    if (inHead == inTail) {
+        poll();
+    }
+    return inTail - inHead;
+}
+
+int MQTTSnTransport::read(uint8_t* buf, size_t size) {
+    if (available() == 0) {
+        return -1;
+    }
+
+    size_t n = inTail - inHead;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(buf, in + inHead, n);
+    inHead += n;
+    if (inHead == inTail) {
+        inHead = inTail = 0;
+    }
+    return n;
+}
+
+// Receives the next datagram from the gateway (if any) and queues it as MQTT
+void MQTTSnTransport::poll() {
+    uint8_t datagram[MQTT_SN_MAX_PACKET_SIZE];
+    int n = receiveDatagram(datagram, sizeof(datagram));
+    if (n > 0) {
+        translateInbound(datagram, n);
+    }
+}
+
+// Sends the message body already written to out+4, prefixed with its length and type
+bool MQTTSnTransport::sendOut(uint8_t type, uint16_t length) {
+    uint16_t total = length + 2;
+    if (total <= 255) {
+        out[2] = total;
+        out[3] = type;
+        return sendDatagram(out + 2, total);
+    }
+
+    // Long form: 0x01 followed by a two byte length
+    total += 2;
+    if (total > MQTT_SN_MAX_PACKET_SIZE) {
+        return false;
+    }
+    out[0] = 0x01;
+    out[1] = total >> 8;
+    out[2] = total & 0xFF;
+    out[3] = type;
+    return sendDatagram(out, total);
+}
+
+bool MQTTSnTransport::translateOutbound(uint8_t header, const uint8_t* body, uint32_t length) {
+    switch (header & 0xF0) {
+        case MQTTCONNECT:
+            return sendConnect(body, length);
+        case MQTTPUBLISH:
+            return sendPublish(header, body, length);
+        case MQTTPUBACK:
+            if (length < 2) return false;
+            // The MQTT-SN PUBACK also names the topic of the publish being acknowledged
+            return sendAck(MQTTSN_PUBACK, inboundTopicId, (body[0] << 8) | body[1], MQTTSN_RC_ACCEPTED);
+        case MQTTPUBREC:
+        case MQTTPUBREL:
+        case MQTTPUBCOMP:
+            if (length < 2) return false;
+            out[4] = body[0];
+            out[5] = body[1];
+            return sendOut((header & 0xF0) == MQTTPUBREC ? MQTTSN_PUBREC :
+                (header & 0xF0) == MQTTPUBREL ? MQTTSN_PUBREL : MQTTSN_PUBCOMP, 2);
+        case MQTTSUBSCRIBE:
+            return sendSubscribe(MQTTSN_SUBSCRIBE, body, length);
+        case MQTTUNSUBSCRIBE:
+            return sendSubscribe(MQTTSN_UNSUBSCRIBE, body, length);
+        case MQTTPINGREQ:
+            if (connectionless) {
+                return beginInbound(MQTTPINGRESP, 0);
+            }
+            return sendOut(MQTTSN_PINGREQ, 0);
+        case MQTTDISCONNECT:
+            if (connectionless) {
+                return true;
+            }
+            return sendOut(MQTTSN_DISCONNECT, 0);
+    }
+    return false;
+}
+
+bool MQTTSnTransport::sendConnect(const uint8_t* body, uint32_t length) {
+    // Skip the protocol name and level to the flags, keep alive and client ID
+    if (length < 2) return false;
+    uint32_t pos = 2 + ((body[0] << 8) | body[1]);
+    if (pos + 6 > length) return false;
+    uint8_t flags = body[pos+1];
+    uint16_t keepAlive = (body[pos+2] << 8) | body[pos+3];
+    uint16_t idLength = (body[pos+4] << 8) | body[pos+5];
+    pos += 6;
+    if (pos + idLength > length || 4 + idLength > MQTTSN_MAX_BODY) return false;
+
+    // Nothing to connect to, accept locally
+    if (connectionless) {
+        return queueInbound(MQTTCONNACK, 0);
+    }
+
+    uint8_t *msg = out + 4;
+    msg[0] = (flags & 0x02) ? MQTTSN_FLAG_CLEAN : 0;
+    msg[1] = MQTTSN_PROTOCOL_ID;
+    msg[2] = keepAlive >> 8;
+    msg[3] = keepAlive & 0xFF;
+    memcpy(msg + 4, body + pos, idLength);
+    return sendOut(MQTTSN_CONNECT, 4 + idLength);
+}
+
+bool MQTTSnTransport::sendPublish(uint8_t header, const uint8_t* body, uint32_t length) {
+    if (length < 2) return false;
+    uint16_t topicLength = (body[0] << 8) | body[1];
+    const char *topic = (const char*)body + 2;
+    uint32_t pos = 2 + topicLength;
+    uint8_t qos = (header >> 1) & 0x03;
+    uint16_t msgId = 0;
+    if (qos > 0) {
+        if (pos + 2 > length) return false;
+        msgId = (body[pos] << 8) | body[pos+1];
+        pos += 2;
+    }
+    if (pos > length || length - pos + 5 > MQTTSN_MAX_BODY) return false;
+
+    uint16_t topicId;
+    uint8_t type;
+    if (topicLength == 2) {
+        topicId = ((uint8_t)topic[0] << 8) | (uint8_t)topic[1];
+        type = MQTTSN_TOPIC_SHORT;
+    } else {
+        int slot = findTopic(topic, topicLength);
+        if (slot < 0 || topics[slot].id == 0) {
+            // Without a connection only predefined and short topics can be published
+            if (connectionless) return false;
+            return registerTopic(topic, topicLength, header, body, length);
+        }
+        topicId = topics[slot].id;
+        type = topics[slot].type;
+    }
+
+    uint8_t *msg = out + 4;
+    msg[0] = type | ((header & 0x01) ? MQTTSN_FLAG_RETAIN : 0) | ((header & 0x08) ? MQTTSN_FLAG_DUP : 0) |
+        (connectionless ? MQTTSN_FLAG_QOS_N1 : (qos << 5));
+    msg[1] = topicId >> 8;
+    msg[2] = topicId & 0xFF;
+    msg[3] = msgId >> 8;
+    msg[4] = msgId & 0xFF;
+    memcpy(msg + 5, body + pos, length - pos);
+    return sendOut(MQTTSN_PUBLISH, 5 + length - pos);
+}
+
+// Registers a topic with the gateway, holding the publish that needs it until the REGACK arrives
+bool MQTTSnTransport::registerTopic(const char* topic, uint16_t topicLength, uint8_t header, const uint8_t* body, uint32_t length) {
+    if (pendingLength > 0 || length > sizeof(pending) || 4 + topicLength > MQTTSN_MAX_BODY) {
+        return false;
+    }
+
+    int slot = allocateTopic(topic, topicLength);
+    if (slot < 0) {
+        return false;
+    }
+
+    if (++nextMsgId == 0) {
+        nextMsgId = 1;
+    }
+    topics[slot].msgId = nextMsgId;
+    topics[slot].awaiting = MQTTSN_REGACK;
+
+    uint8_t *msg = out + 4;
+    msg[0] = msg[1] = 0;
+    msg[2] = nextMsgId >> 8;
+    msg[3] = nextMsgId & 0xFF;
+    memcpy(msg + 4, topic, topicLength);
+    if (!sendOut(MQTTSN_REGISTER, 4 + topicLength)) {
+        topics[slot].awaiting = 0;
+        return false;
+    }
+
+    pendingHeader = header;
+    memcpy(pending, body, length);
+    pendingLength = length;
+    return true;
+}
+
+// Translates SUBSCRIBE and UNSUBSCRIBE (first topic only, as MQTT sends them)
+bool MQTTSnTransport::sendSubscribe(uint8_t type, const uint8_t* body, uint32_t length) {
+    if (length < 4) return false;
+    uint16_t topicLength = (body[2] << 8) | body[3];
+    const char *topic = (const char*)body + 4;
+    if (4U + topicLength > length || 3 + topicLength > MQTTSN_MAX_BODY) return false;
+    uint8_t qos = (type == MQTTSN_SUBSCRIBE && 4U + topicLength < length) ? body[4+topicLength] & 0x03 : 0;
+
+    // Without a connection there is nothing to subscribe with
+    if (connectionless) {
+        if (type == MQTTSN_SUBSCRIBE) {
+            uint8_t ack[3] = { body[0], body[1], 0x80 };
+            if (!beginInbound(MQTTSUBACK, 3)) return false;
+            appendInbound(ack, 3);
+            return true;
+        }
+        return queueInbound(MQTTUNSUBACK, (body[0] << 8) | body[1]);
+    }
+
+    bool isShort = topicLength == 2 && topic[0] != '#' && topic[0] != '+' && topic[1] != '#' && topic[1] != '+';
+
+    // Remember the topic name so publishes arriving with its ID can be delivered by name
+    if (type == MQTTSN_SUBSCRIBE && !isShort) {
+        int slot = findTopic(topic, topicLength);
+        if (slot < 0) {
+            slot = allocateTopic(topic, topicLength);
+        }
+        if (slot >= 0 && topics[slot].type != MQTTSN_TOPIC_PREDEFINED) {
+            topics[slot].msgId = (body[0] << 8) | body[1];
+            topics[slot].awaiting = MQTTSN_SUBACK;
+        }
+    }
+
+    uint8_t *msg = out + 4;
+    msg[0] = (qos << 5) | (isShort ? MQTTSN_TOPIC_SHORT : MQTTSN_TOPIC_NORMAL);
+    msg[1] = body[0];
+    msg[2] = body[1];
+    memcpy(msg + 3, topic, topicLength);
+    return sendOut(type, 3 + topicLength);
+}
+
+// Sends a PUBACK or REGACK
+bool MQTTSnTransport::sendAck(uint8_t type, uint16_t topicId, uint16_t msgId, uint8_t rc) {
+    uint8_t *msg = out + 4;
+    msg[0] = topicId >> 8;
+    msg[1] = topicId & 0xFF;
+    msg[2] = msgId >> 8;
+    msg[3] = msgId & 0xFF;
+    msg[4] = rc;
+    return sendOut(type, 5);
+}
+
+void MQTTSnTransport::translateInbound(const uint8_t* datagram, uint16_t size) {
+    uint16_t length;
+    uint8_t offset;
+    if (size < 2) return;
+    if (datagram[0] == 0x01) {
+        if (size < 4) return;
+        length = (datagram[1] << 8) | datagram[2];
+        offset = 3;
+    } else {
+        length = datagram[0];
+        offset = 1;
+    }
+    if (length > size || length <= offset) return;
+
+    uint8_t type = datagram[offset];
+    const uint8_t *msg = datagram + offset + 1;
+    uint16_t msgLength = length - offset - 1;
+
+    switch (type) {
+        case MQTTSN_CONNACK: {
+            if (msgLength < 1) return;
+            // Any rejection becomes "server unavailable"
+            uint8_t ack[2] = { 0, (uint8_t)(msg[0] == MQTTSN_RC_ACCEPTED ? 0 : 3) };
+            if (beginInbound(MQTTCONNACK, 2)) {
+                appendInbound(ack, 2);
+            }
+            break;
+        }
+        case MQTTSN_REGISTER: {
+            // The gateway names a topic matching a wildcard subscription
+            if (msgLength < 4) return;
+            uint16_t topicId = (msg[0] << 8) | msg[1];
+            int slot = allocateTopic((const char*)msg + 4, msgLength - 4);
+            if (slot >= 0) {
+                topics[slot].id = topicId;
+            }
+            sendAck(MQTTSN_REGACK, topicId, (msg[2] << 8) | msg[3], slot >= 0 ? MQTTSN_RC_ACCEPTED : MQTTSN_RC_NOT_SUPPORTED);
+            break;
+        }
+        case MQTTSN_REGACK: {
+            if (msgLength < 5) return;
+            uint16_t msgId = (msg[2] << 8) | msg[3];
+            for (uint8_t i = 0; i < MQTT_SN_MAX_TOPICS; i++) {
+                if (topics[i].awaiting == MQTTSN_REGACK && topics[i].msgId == msgId) {
+                    if (msg[4] == MQTTSN_RC_ACCEPTED) {
+                        topics[i].id = (msg[0] << 8) | msg[1];
+                        topics[i].awaiting = 0;
+                    } else {
+                        memset(&topics[i], 0, sizeof(MQTTSN_TOPIC));
+                    }
+
+                    // Send the publish that was waiting for the topic ID
+                    uint16_t held = pendingLength;
+                    pendingLength = 0;
+                    if (held > 0 && msg[4] == MQTTSN_RC_ACCEPTED) {
+                        sendPublish(pendingHeader, pending, held);
+                    }
+                    break;
+                }
+            }
+            break;
+        }
+        case MQTTSN_PUBLISH:
+            receivePublish(msg, msgLength);
+            break;
+        case MQTTSN_PUBACK: {
+            if (msgLength < 5) return;
+            uint16_t msgId = (msg[2] << 8) | msg[3];
+            if (msg[4] == MQTTSN_RC_INVALID_ID) {
+                // The gateway lost the registration, register again on the next publish
+                int slot = findTopicId((msg[0] << 8) | msg[1], MQTTSN_TOPIC_NORMAL);
+                if (slot >= 0) {
+                    memset(&topics[slot], 0, sizeof(MQTTSN_TOPIC));
+                }
+            }
+            if (msg[4] == MQTTSN_RC_ACCEPTED) {
+                queueInbound(MQTTPUBACK, msgId);
+            }
+            break;
+        }
+        case MQTTSN_PUBREC:
+        case MQTTSN_PUBREL:
+        case MQTTSN_PUBCOMP:
+            if (msgLength < 2) return;
+            // PUBREL is sent with the QoS 1 header flag
+            queueInbound(type == MQTTSN_PUBREC ? MQTTPUBREC : type == MQTTSN_PUBREL ? (MQTTPUBREL | 0x02) : MQTTPUBCOMP,
+                (msg[0] << 8) | msg[1]);
+            break;
+        case MQTTSN_SUBACK: {
+            if (msgLength < 6) return;
+            uint16_t topicId = (msg[1] << 8) | msg[2];
+            uint16_t msgId = (msg[3] << 8) | msg[4];
+            for (uint8_t i = 0; i < MQTT_SN_MAX_TOPICS; i++) {
+                if (topics[i].awaiting == MQTTSN_SUBACK && topics[i].msgId == msgId) {
+                    // Wildcard subscriptions get ID 0; their topics are registered by the gateway instead
+                    if (msg[5] == MQTTSN_RC_ACCEPTED && topicId != 0) {
+                        topics[i].id = topicId;
+                        topics[i].awaiting = 0;
+                    } else {
+                        memset(&topics[i], 0, sizeof(MQTTSN_TOPIC));
+                    }
+                    break;
+                }
+            }
+            uint8_t ack[3] = { msg[3], msg[4], (uint8_t)(msg[5] == MQTTSN_RC_ACCEPTED ? (msg[0] >> 5) & 0x03 : 0x80) };
+            if (beginInbound(MQTTSUBACK, 3)) {
+                appendInbound(ack, 3);
+            }
+            break;
+        }
+        case MQTTSN_UNSUBACK:
+            if (msgLength < 2) return;
+            queueInbound(MQTTUNSUBACK, (msg[0] << 8) | msg[1]);
+            break;
+        case MQTTSN_PINGREQ:
+            sendOut(MQTTSN_PINGRESP, 0);
+            break;
+        case MQTTSN_PINGRESP:
+            beginInbound(MQTTPINGRESP, 0);
+            break;
+        case MQTTSN_DISCONNECT:
+            // The gateway ended the session, let the client reconnect
+            stop();
+            break;
+    }
+}
+
+// Delivers an MQTT-SN publish as an MQTT PUBLISH, naming the topic from its ID
+void MQTTSnTransport::receivePublish(const uint8_t* msg, uint16_t length) {
+    if (length < 5) return;
+    uint8_t flags = msg[0];
+    uint16_t topicId = (msg[1] << 8) | msg[2];
+    uint16_t msgId = (msg[3] << 8) | msg[4];
+    uint8_t qos = (flags >> 5) & 0x03;
+    if (qos == 3) {
+        qos = 0;
+    }
+
+    const uint8_t *topic;
+    uint16_t topicLength;
+    if ((flags & MQTTSN_TOPIC_MASK) == MQTTSN_TOPIC_SHORT) {
+        topic = msg + 1;
+        topicLength = 2;
+    } else {
+        int slot = findTopicId(topicId, flags & MQTTSN_TOPIC_MASK);
+        if (slot < 0) {
+            if (qos > 0) {
+                sendAck(MQTTSN_PUBACK, topicId, msgId, MQTTSN_RC_INVALID_ID);
+            }
+            return;
+        }
+        topic = (const uint8_t*)topics[slot].name;
+        topicLength = strlen(topics[slot].name);
+    }
+
+    uint8_t header = MQTTPUBLISH | (qos << 1) | ((flags & MQTTSN_FLAG_RETAIN) ? 1 : 0) | ((flags & MQTTSN_FLAG_DUP) ? 0x08 : 0);
+    uint16_t dataLength = length - 5;
+    if (!beginInbound(header, 2 + topicLength + (qos > 0 ? 2 : 0) + dataLength)) {
+        return;
+    }
+
+    uint8_t field[2] = { (uint8_t)(topicLength >> 8), (uint8_t)(topicLength & 0xFF) };
+    appendInbound(field, 2);
+    appendInbound(topic, topicLength);
+    if (qos > 0) {
+        appendInbound(msg + 3, 2);
+        inboundMsgId = msgId;
+        inboundTopicId = topicId;
+    }
+    appendInbound(msg + 5, dataLength);
+}
+
+// Starts an inbound MQTT packet of the given remaining length, making room for it if needed
+bool MQTTSnTransport::beginInbound(uint8_t header, uint32_t length) {
+    if (inTail + 5 + length > sizeof(in) && inHead > 0) {
+        memmove(in, in + inHead, inTail - inHead);
+        inTail -= inHead;
+        inHead = 0;
+    }
+    if (inTail + 5 + length > sizeof(in)) {
+        return false;
+    }
+
+    in[inTail++] = header;
+    do {
+        uint8_t digit = length % 128;
+        length /= 128;
+        if (length > 0) {
+            digit |= 0x80;
+        }
+        in[inTail++] = digit;
+    } while (length > 0);
+    return true;
+}
+
+void MQTTSnTransport::appendInbound(const uint8_t* buf, uint16_t length) {
+    memcpy(in + inTail, buf, length);
+    inTail += length;
+}
+
+// Queues an inbound MQTT packet whose body is just a message ID (an accepted CONNACK when msgId is 0)
+bool MQTTSnTransport::queueInbound(uint8_t header, uint16_t msgId) {
+    if (!beginInbound(header, 2)) {
+        return false;
+    }
+    in[inTail++] = msgId >> 8;
+    in[inTail++] = msgId & 0xFF;
+    return true;
+}
+
+int MQTTSnTransport::findTopic(const char* topic, uint16_t topicLength) {
+    for (uint8_t i = 0; i < MQTT_SN_MAX_TOPICS; i++) {
+        if (topics[i].name[0] != 0 && strlen(topics[i].name) == topicLength &&
+                memcmp(topics[i].name, topic, topicLength) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int MQTTSnTransport::findTopicId(uint16_t id, uint8_t type) {
+    for (uint8_t i = 0; i < MQTT_SN_MAX_TOPICS; i++) {
+        if (topics[i].name[0] != 0 && topics[i].id == id && topics[i].type == type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Finds the entry for a topic or a free one, replacing a registered topic if all are in use
+int MQTTSnTransport::allocateTopic(const char* topic, uint16_t topicLength) {
+    if (topicLength == 0 || topicLength > MQTT_SN_MAX_TOPIC_LENGTH) {
+        return -1;
+    }
+
+    int slot = findTopic(topic, topicLength);
+    for (uint8_t i = 0; slot < 0 && i < MQTT_SN_MAX_TOPICS; i++) {
+        if (topics[i].name[0] == 0) {
+            slot = i;
+        }
+    }
+    for (uint8_t i = 0; slot < 0 && i < MQTT_SN_MAX_TOPICS; i++) {
+        if (topics[i].type == MQTTSN_TOPIC_NORMAL && topics[i].awaiting == 0) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        return -1;
+    }
+
+    if (topics[slot].type != MQTTSN_TOPIC_PREDEFINED) {
+        memset(&topics[slot], 0, sizeof(MQTTSN_TOPIC));
+        memcpy(topics[slot].name, topic, topicLength);
+    }
+    return slot;
+}
+
+#if defined(SPARK)
+bool MQTTSnUdpTransport::openGateway(const char* host, uint16_t port) {
+    IPAddress address = WiFi.resolve(host);
+    if (!address) {
+        return false;
+    }
+    gateway = address;
+    gatewayPort = port;
+    return udp.begin(MQTT_SN_LOCAL_PORT);
+}
+
+bool MQTTSnUdpTransport::openGateway(uint8_t* ip, uint16_t port) {
+    gateway = IPAddress(ip[0], ip[1], ip[2], ip[3]);
+    gatewayPort = port;
+    return udp.begin(MQTT_SN_LOCAL_PORT);
+}
+
+bool MQTTSnUdpTransport::sendDatagram(const uint8_t* buf, uint16_t length) {
+    if (!udp.beginPacket(gateway, gatewayPort)) {
+        return false;
+    }
+    udp.write(buf, length);
+    return udp.endPacket() > 0;
+}
+
+int MQTTSnUdpTransport::receiveDatagram(uint8_t* buf, uint16_t size) {
+    int n = udp.parsePacket();
+    if (n <= 0) {
+        return 0;
+    }
+
+    // Oversized datagrams can't be translated, drop them
+    if (n > size) {
+        udp.flush();
+        return 0;
+    }
+    return udp.read(buf, n);
+}
+
+void MQTTSnUdpTransport::closeGateway() {
+    udp.stop();
+}
+#endif
+
+#endif // MQTT_USE_SN
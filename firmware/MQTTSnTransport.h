@@ -0,0 +1,180 @@
+/*
+MQTT-SN transport for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MQTT_SN_TRANSPORT_h
+#define MQTT_SN_TRANSPORT_h
+
+// Load build configuration settings
+//#include "FathymBuild.h" // uncomment for local Particle Dev build
+#include "../FathymBuild.h"
+
+#include "MQTT.h"
+#include "MQTTTransport.h"
+
+#if defined(SPARK)
+#include "spark_wiring_udp.h"
+#endif
+
+// MQTT_USE_SN : Build the MQTT-SN (UDP) transport
+#ifndef MQTT_USE_SN
+#define MQTT_USE_SN false
+#endif // Let this be overriden by build.h if present
+
+// MQTT_SN_MAX_PACKET_SIZE : Largest MQTT-SN datagram sent or received
+#ifndef MQTT_SN_MAX_PACKET_SIZE
+#define MQTT_SN_MAX_PACKET_SIZE 512
+#endif // Let this be overriden by build.h if present
+
+// MQTT_SN_MAX_TOPICS : Number of topic IDs (predefined, registered or subscribed) that are remembered
+#ifndef MQTT_SN_MAX_TOPICS
+#define MQTT_SN_MAX_TOPICS 4
+#endif // Let this be overriden by build.h if present
+
+// MQTT_SN_MAX_TOPIC_LENGTH : Longest topic name that can be mapped to a topic ID
+#ifndef MQTT_SN_MAX_TOPIC_LENGTH
+#define MQTT_SN_MAX_TOPIC_LENGTH MQTT_MAX_TOPIC_SIZE
+#endif // Let this be overriden by build.h if present
+
+// MQTT_SN_LOCAL_PORT : Local UDP port the gateway's datagrams are received on
+#ifndef MQTT_SN_LOCAL_PORT
+#define MQTT_SN_LOCAL_PORT 1884
+#endif // Let this be overriden by build.h if present
+
+#if MQTT_USE_SN
+
+#define MQTTSN_CONNECT     0x04
+#define MQTTSN_CONNACK     0x05
+#define MQTTSN_REGISTER    0x0A
+#define MQTTSN_REGACK      0x0B
+#define MQTTSN_PUBLISH     0x0C
+#define MQTTSN_PUBACK      0x0D
+#define MQTTSN_PUBCOMP     0x0E
+#define MQTTSN_PUBREC      0x0F
+#define MQTTSN_PUBREL      0x10
+#define MQTTSN_SUBSCRIBE   0x12
+#define MQTTSN_SUBACK      0x13
+#define MQTTSN_UNSUBSCRIBE 0x14
+#define MQTTSN_UNSUBACK    0x15
+#define MQTTSN_PINGREQ     0x16
+#define MQTTSN_PINGRESP    0x17
+#define MQTTSN_DISCONNECT  0x18
+
+#define MQTTSN_TOPIC_NORMAL     0x00 // topic ID registered with the gateway
+#define MQTTSN_TOPIC_PREDEFINED 0x01 // topic ID agreed with the gateway in advance
+#define MQTTSN_TOPIC_SHORT      0x02 // two character topic name sent in place of an ID
+
+// MQTT over MQTT-SN: translates the MQTT packets the client writes into MQTT-SN datagrams and the
+// gateway's replies back into MQTT packets, so MQTT runs unchanged without a TCP connection.
+// Topics are sent as IDs: two character topics as short names, topics set with setPredefinedTopic()
+// by their predefined ID, and any other topic is registered with the gateway on its first publish.
+// In connectionless mode CONNECT, PINGREQ and DISCONNECT are answered locally and publishes go out
+// at QoS -1 (predefined and short topics only), so a duty-cycled sensor sends one datagram per
+// publish and nothing else. Username, password and will are not carried by MQTT-SN and are ignored.
+// The datagram I/O is left to a subclass (MQTTSnUdpTransport on the device) so the translation can
+// be run against a local gateway stand-in.
+class MQTTSnTransport : public MQTTTransport {
+private:
+    typedef struct{
+        uint16_t id;      // topic ID (0 while waiting for the gateway)
+        uint16_t msgId;   // message ID of the REGISTER/SUBSCRIBE awaiting an ID
+        uint8_t type;     // MQTTSN_TOPIC_* type of the ID
+        uint8_t awaiting; // MQTT-SN message type awaited (REGACK/SUBACK), 0 if none
+        char name[MQTT_SN_MAX_TOPIC_LENGTH+1];
+    }MQTTSN_TOPIC;
+
+    bool open;
+    bool connectionless;
+    uint16_t nextMsgId;
+    MQTTSN_TOPIC topics[MQTT_SN_MAX_TOPICS];
+    uint8_t out[MQTT_SN_MAX_PACKET_SIZE+4];
+    uint8_t in[MQTT_SN_MAX_PACKET_SIZE+MQTT_SN_MAX_TOPIC_LENGTH+8];
+    uint16_t inHead;
+    uint16_t inTail;
+    uint8_t pendingHeader;
+    uint8_t pending[MQTT_SN_MAX_PACKET_SIZE+MQTT_SN_MAX_TOPIC_LENGTH+4];
+    uint16_t pendingLength;
+    uint16_t inboundMsgId;
+    uint16_t inboundTopicId;
+
+    void reset();
+    void poll();
+    bool sendOut(uint8_t type, uint16_t length);
+    bool translateOutbound(uint8_t header, const uint8_t* body, uint32_t length);
+    bool sendConnect(const uint8_t* body, uint32_t length);
+    bool sendPublish(uint8_t header, const uint8_t* body, uint32_t length);
+    bool sendSubscribe(uint8_t type, const uint8_t* body, uint32_t length);
+    bool sendAck(uint8_t type, uint16_t topicId, uint16_t msgId, uint8_t rc);
+    bool registerTopic(const char* topic, uint16_t topicLength, uint8_t header, const uint8_t* body, uint32_t length);
+    void translateInbound(const uint8_t* datagram, uint16_t size);
+    void receivePublish(const uint8_t* msg, uint16_t length);
+    bool beginInbound(uint8_t header, uint32_t length);
+    void appendInbound(const uint8_t* buf, uint16_t length);
+    bool queueInbound(uint8_t header, uint16_t msgId);
+    int findTopic(const char* topic, uint16_t topicLength);
+    int findTopicId(uint16_t id, uint8_t type);
+    int allocateTopic(const char* topic, uint16_t topicLength);
+
+protected:
+    virtual bool openGateway(const char* host, uint16_t port) = 0;
+    virtual bool openGateway(uint8_t* ip, uint16_t port) = 0;
+    virtual bool sendDatagram(const uint8_t* buf, uint16_t length) = 0;
+    virtual int receiveDatagram(uint8_t* buf, uint16_t size) = 0;
+    virtual void closeGateway() = 0;
+
+public:
+    MQTTSnTransport();
+
+    int connect(const char* host, uint16_t port);
+    int connect(uint8_t* ip, uint16_t port);
+    size_t write(const uint8_t* buf, size_t size);
+    int available();
+    int read(uint8_t* buf, size_t size);
+    uint8_t connected();
+    void stop();
+
+    void setConnectionless(bool connectionless);
+    bool setPredefinedTopic(const char* topic, uint16_t id);
+};
+
+#if defined(SPARK)
+// MQTT-SN over UDP to a gateway
+class MQTTSnUdpTransport : public MQTTSnTransport {
+private:
+    UDP udp;
+    IPAddress gateway;
+    uint16_t gatewayPort;
+
+protected:
+    bool openGateway(const char* host, uint16_t port);
+    bool openGateway(uint8_t* ip, uint16_t port);
+    bool sendDatagram(const uint8_t* buf, uint16_t length);
+    int receiveDatagram(uint8_t* buf, uint16_t size);
+    void closeGateway();
+};
+#endif
+
+#endif // MQTT_USE_SN
+
+#endif
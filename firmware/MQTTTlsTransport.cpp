@@ -0,0 +1,280 @@
+#include "MQTTTlsTransport.h"
+
+#if MQTT_USE_TLS
+
+#if defined(SPARK)
+#include "application.h"
+#else
+#include <time.h>
+#endif
+
+#include <string.h>
+
+#if defined(SPARK)
+// Seeds the random generator from the hardware RNG
+static int hardwareEntropy(void* context, unsigned char* buf, size_t len) {
+    while (len > 0) {
+        uint32_t r = HAL_RNG_GetRandomNumber();
+        size_t n = len < sizeof(r) ? len : sizeof(r);
+        memcpy(buf, &r, n);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+#endif
+
+static unsigned long tlsMicros() {
+#if defined(SPARK)
+    return micros();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+#endif
+}
+
+// Takes ownership of inner. hostname is used for SNI and certificate checks; without a CA connecting fails
+// unless MQTT_TLS_INSECURE is set
+MQTTTlsTransport::MQTTTlsTransport(MQTTTransport *inner, const char *hostname, const char *caPem) {
+    this->inner = inner;
+    this->hostname = hostname;
+    this->caPem = caPem;
+    this->initialized = false;
+    this->ready = false;
+    this->hasSession = false;
+    memset(&stats, 0, sizeof(stats));
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_x509_crt_init(&ca);
+    mbedtls_ctr_drbg_init(&drbg);
+#if !defined(SPARK)
+    mbedtls_entropy_init(&entropy);
+#endif
+    mbedtls_ssl_session_init(&session);
+}
+
+MQTTTlsTransport::~MQTTTlsTransport() {
+    stop();
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_x509_crt_free(&ca);
+    mbedtls_ctr_drbg_free(&drbg);
+#if !defined(SPARK)
+    mbedtls_entropy_free(&entropy);
+#endif
+    delete inner;
+}
+
+// Sets up the TLS configuration on first use (kept for every later connection)
+bool MQTTTlsTransport::init() {
+    if (initialized) {
+        return true;
+    }
+
+#if defined(SPARK)
+    if (mbedtls_ctr_drbg_seed(&drbg, hardwareEntropy, NULL, NULL, 0) != 0) {
+        return false;
+    }
+#else
+    if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, NULL, 0) != 0) {
+        return false;
+    }
+#endif
+
+    if (mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        return false;
+    }
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+
+    if (caPem != NULL) {
+        if (mbedtls_x509_crt_parse(&ca, (const unsigned char*)caPem, strlen(caPem)+1) != 0) {
+            return false;
+        }
+        mbedtls_ssl_conf_ca_chain(&conf, &ca, NULL);
+        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else if (MQTT_TLS_INSECURE) {
+        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+    } else {
+        // Never send credentials to a server that hasn't been verified
+        return false;
+    }
+
+    // Ask for a session ticket so the server doesn't have to keep our session around
+    mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+    if (mbedtls_ssl_setup(&ssl, &conf) != 0) {
+        return false;
+    }
+
+    initialized = true;
+    return true;
+}
+
+int MQTTTlsTransport::connect(const char* host, uint16_t port) {
+    if (!init() || !inner->connect(host, port)) {
+        return 0;
+    }
+    return handshake();
+}
+
+int MQTTTlsTransport::connect(uint8_t* ip, uint16_t port) {
+    if (!init() || !inner->connect(ip, port)) {
+        return 0;
+    }
+    return handshake();
+}
+
+// Runs the TLS handshake over the connected inner transport, resuming the last session if there is one
+int MQTTTlsTransport::handshake() {
+    unsigned long start = tlsMicros();
+    mbedtls_ssl_session_reset(&ssl);
+    mbedtls_ssl_set_hostname(&ssl, hostname);
+    mbedtls_ssl_set_bio(&ssl, this, sendCallback, recvCallback, NULL);
+
+    bool offered = hasSession && mbedtls_ssl_set_session(&ssl, &session) == 0;
+
+    int rc;
+    do {
+        rc = mbedtls_ssl_handshake(&ssl);
+        if (tlsMicros() - start > MQTT_TLS_HANDSHAKE_TIMEOUT*1000UL) {
+            break;
+        }
+    } while (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+    if (rc != 0) {
+        // Don't offer a session the server may have rejected the handshake over
+        forgetSession();
+        inner->stop();
+        stats.failures++;
+        return 0;
+    }
+
+    uint32_t duration = tlsMicros() - start;
+    stats.handshakes++;
+
+    // The server resumed the session if it kept the master secret of the one we offered (a resumed
+    // ticket comes back with a new session ID, so the ID alone doesn't tell)
+    mbedtls_ssl_session fresh;
+    mbedtls_ssl_session_init(&fresh);
+    if (mbedtls_ssl_get_session(&ssl, &fresh) == 0) {
+        bool resumed = offered && memcmp(fresh.master, session.master, sizeof(fresh.master)) == 0;
+        if (resumed) {
+            stats.resumptions++;
+            stats.resumeMicros = duration;
+        } else {
+            stats.fullHandshakeMicros = duration;
+        }
+
+        // Keep the newest session (and any new ticket) for the next connect
+        mbedtls_ssl_session_free(&session);
+        session = fresh;
+        hasSession = true;
+    } else {
+        stats.fullHandshakeMicros = duration;
+        mbedtls_ssl_session_free(&fresh);
+    }
+
+    ready = true;
+    return 1;
+}
+
+size_t MQTTTlsTransport::write(const uint8_t* buf, size_t size) {
+    if (!ready) {
+        return 0;
+    }
+
+    // Give up on a connection that stops taking data instead of spinning inside publish
+    unsigned long start = tlsMicros();
+    size_t written = 0;
+    while (written < size) {
+        int rc = mbedtls_ssl_write(&ssl, buf+written, size-written);
+        if (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            if (tlsMicros() - start > MQTT_TLS_WRITE_TIMEOUT*1000UL) {
+                // A record may have been cut short, so the stream can't be used any more
+                stop();
+                break;
+            }
+            continue;
+        }
+        if (rc < 0) {
+            break;
+        }
+        written += rc;
+    }
+    return written;
+}
+
+// Decrypted bytes waiting, or raw bytes that will decrypt once read
+int MQTTTlsTransport::available() {
+    if (!ready) {
+        return 0;
+    }
+
+    int pending = mbedtls_ssl_get_bytes_avail(&ssl);
+    return pending > 0 ? pending : inner->available();
+}
+
+// Returns -1 when no application data is ready yet, like TCPClient
+int MQTTTlsTransport::read(uint8_t* buf, size_t size) {
+    if (!ready) {
+        return -1;
+    }
+
+    int rc = mbedtls_ssl_read(&ssl, buf, size);
+    if (rc > 0) {
+        return rc;
+    }
+
+    // The server closed the connection or the stream is broken
+    if (rc != MBEDTLS_ERR_SSL_WANT_READ && rc != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        stop();
+    }
+    return -1;
+}
+
+uint8_t MQTTTlsTransport::connected() {
+    return ready && inner->connected();
+}
+
+void MQTTTlsTransport::stop() {
+    if (ready) {
+        mbedtls_ssl_close_notify(&ssl);
+        ready = false;
+    }
+    inner->stop();
+}
+
+// Drops the kept session so the next connect does a full handshake
+void MQTTTlsTransport::forgetSession() {
+    if (hasSession) {
+        mbedtls_ssl_session_free(&session);
+        mbedtls_ssl_session_init(&session);
+        hasSession = false;
+    }
+}
+
+const MQTT_TLS_STATS& MQTTTlsTransport::getStats() {
+    return stats;
+}
+
+int MQTTTlsTransport::sendCallback(void* context, const unsigned char* buf, size_t len) {
+    MQTTTlsTransport *transport = (MQTTTlsTransport*)context;
+    if (!transport->inner->connected()) {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    size_t n = transport->inner->write(buf, len);
+    return n > 0 ? (int)n : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+int MQTTTlsTransport::recvCallback(void* context, unsigned char* buf, size_t len) {
+    MQTTTlsTransport *transport = (MQTTTlsTransport*)context;
+    if (!transport->inner->available()) {
+        return transport->inner->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    int n = transport->inner->read(buf, len);
+    return n > 0 ? n : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+#endif // MQTT_USE_TLS
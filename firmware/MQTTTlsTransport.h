@@ -0,0 +1,117 @@
+/*
+MQTT TLS transport for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MQTT_TLS_TRANSPORT_h
+#define MQTT_TLS_TRANSPORT_h
+
+// Load build configuration settings
+//#include "FathymBuild.h" // uncomment for local Particle Dev build
+#include "../FathymBuild.h"
+
+#include "MQTTTransport.h"
+
+// MQTT_USE_TLS : Build the TLS transport (needs mbedTLS available to the build)
+#ifndef MQTT_USE_TLS
+#define MQTT_USE_TLS false
+#endif // Let this be overriden by build.h if present
+
+// MQTT_TLS_HANDSHAKE_TIMEOUT : Milliseconds a TLS handshake may take before the connect fails
+#ifndef MQTT_TLS_HANDSHAKE_TIMEOUT
+#define MQTT_TLS_HANDSHAKE_TIMEOUT 15000
+#endif // Let this be overriden by build.h if present
+
+// MQTT_TLS_WRITE_TIMEOUT : Milliseconds a write may wait on a stalled connection before it fails
+#ifndef MQTT_TLS_WRITE_TIMEOUT
+#define MQTT_TLS_WRITE_TIMEOUT 5000
+#endif // Let this be overriden by build.h if present
+
+// MQTT_TLS_INSECURE : Connect without verifying the server when no CA certificate is given (testing only;
+// anyone on the path can then read the credentials). Otherwise connecting without a CA fails.
+#ifndef MQTT_TLS_INSECURE
+#define MQTT_TLS_INSECURE false
+#endif // Let this be overriden by build.h if present
+
+#if MQTT_USE_TLS
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/x509_crt.h"
+
+// Handshake counters and timings of the TLS transport
+typedef struct{
+    uint32_t handshakes;          // completed handshakes (full and resumed)
+    uint32_t resumptions;         // handshakes that resumed the previous session
+    uint32_t failures;            // failed handshakes
+    uint32_t fullHandshakeMicros; // duration of the last full handshake
+    uint32_t resumeMicros;        // duration of the last resumed handshake
+}MQTT_TLS_STATS;
+
+// TLS over another transport (normally MQTTTcpTransport) using mbedTLS. The session of each
+// connection is kept and offered on the next connect, so a reconnect to a server that supports
+// session tickets or session IDs skips the full handshake. Works over any MQTTTransport, so it
+// can also be run off the device (over MQTTSocketTransport) against a local TLS server.
+class MQTTTlsTransport : public MQTTTransport {
+private:
+    MQTTTransport *inner;
+    const char *hostname;
+    const char *caPem;
+    bool initialized;
+    bool ready;
+    bool hasSession;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt ca;
+    mbedtls_ctr_drbg_context drbg;
+#if !defined(SPARK)
+    mbedtls_entropy_context entropy;
+#endif
+    mbedtls_ssl_session session;
+    MQTT_TLS_STATS stats;
+    bool init();
+    int handshake();
+    static int sendCallback(void* context, const unsigned char* buf, size_t len);
+    static int recvCallback(void* context, unsigned char* buf, size_t len);
+
+public:
+    MQTTTlsTransport(MQTTTransport *inner, const char *hostname, const char *caPem);
+    ~MQTTTlsTransport();
+
+    int connect(const char* host, uint16_t port);
+    int connect(uint8_t* ip, uint16_t port);
+    size_t write(const uint8_t* buf, size_t size);
+    int available();
+    int read(uint8_t* buf, size_t size);
+    uint8_t connected();
+    void stop();
+
+    void forgetSession();
+    const MQTT_TLS_STATS& getStats();
+};
+
+#endif // MQTT_USE_TLS
+
+#endif
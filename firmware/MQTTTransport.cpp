@@ -0,0 +1,158 @@
+#include "MQTTTransport.h"
+
+#if defined(SPARK)
+#include "application.h"
+
+int MQTTTcpTransport::connect(const char* host, uint16_t port) {
+    return client.connect(host, port);
+}
+
+int MQTTTcpTransport::connect(uint8_t* ip, uint16_t port) {
+    return client.connect(ip, port);
+}
+
+size_t MQTTTcpTransport::write(const uint8_t* buf, size_t size) {
+    return client.write(buf, size);
+}
+
+int MQTTTcpTransport::available() {
+    return client.available();
+}
+
+int MQTTTcpTransport::read(uint8_t* buf, size_t size) {
+    return client.read(buf, size);
+}
+
+uint8_t MQTTTcpTransport::connected() {
+    return client.connected();
+}
+
+void MQTTTcpTransport::stop() {
+    client.stop();
+}
+#elif defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+MQTTSocketTransport::MQTTSocketTransport() {
+    fd = -1;
+}
+
+MQTTSocketTransport::~MQTTSocketTransport() {
+    stop();
+}
+
+// Connects (blocking) and then switches the socket to non-blocking, like TCPClient
+int MQTTSocketTransport::connect(const char* host, uint16_t port) {
+    stop();
+
+    char service[6];
+    snprintf(service, sizeof(service), "%u", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *addresses;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+        return 0;
+    }
+
+    for (struct addrinfo *address = addresses; address != NULL && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        return 0;
+    }
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return 1;
+}
+
+int MQTTSocketTransport::connect(uint8_t* ip, uint16_t port) {
+    char host[16];
+    snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    return connect(host, port);
+}
+
+// Writes what the socket takes without blocking (0 when it is full or broken)
+size_t MQTTSocketTransport::write(const uint8_t* buf, size_t size) {
+    if (fd < 0) {
+        return 0;
+    }
+
+    ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            stop();
+        }
+        return 0;
+    }
+    return (size_t)n;
+}
+
+int MQTTSocketTransport::available() {
+    int pending = 0;
+    if (fd < 0 || ioctl(fd, FIONREAD, &pending) != 0) {
+        return 0;
+    }
+    return pending;
+}
+
+// Returns -1 when nothing is waiting, like TCPClient
+int MQTTSocketTransport::read(uint8_t* buf, size_t size) {
+    if (fd < 0) {
+        return -1;
+    }
+
+    ssize_t n = recv(fd, buf, size, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // The peer closed the connection or it broke
+        stop();
+        return -1;
+    }
+    return n < 0 ? -1 : (int)n;
+}
+
+// Connected until the peer closes the connection (and everything it sent has been read)
+uint8_t MQTTSocketTransport::connected() {
+    if (fd < 0) {
+        return 0;
+    }
+
+    uint8_t peek;
+    ssize_t n = recv(fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void MQTTSocketTransport::stop() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+#endif
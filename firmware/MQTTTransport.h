@@ -0,0 +1,87 @@
+/*
+MQTT transports for the Fathym library for Particle Core & Photon
+This software is released under the MIT License.
+
+Copyright (c) 2016 Michael Everett
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MQTT_TRANSPORT_h
+#define MQTT_TRANSPORT_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(SPARK)
+#include "spark_wiring_tcpclient.h"
+#endif
+
+// The byte stream the MQTT client runs over. Follows the TCPClient API so the
+// plain TCP connection, TLS, or a stand-in for testing can be swapped in.
+class MQTTTransport {
+public:
+    virtual ~MQTTTransport() {}
+
+    virtual int connect(const char* host, uint16_t port) = 0;
+    virtual int connect(uint8_t* ip, uint16_t port) = 0;
+    virtual size_t write(const uint8_t* buf, size_t size) = 0;
+    virtual int available() = 0;
+    virtual int read(uint8_t* buf, size_t size) = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+};
+
+#if defined(SPARK)
+// Plain TCP transport (the default)
+class MQTTTcpTransport : public MQTTTransport {
+private:
+    TCPClient client;
+
+public:
+    int connect(const char* host, uint16_t port);
+    int connect(uint8_t* ip, uint16_t port);
+    size_t write(const uint8_t* buf, size_t size);
+    int available();
+    int read(uint8_t* buf, size_t size);
+    uint8_t connected();
+    void stop();
+};
+#elif defined(__unix__) || defined(__APPLE__)
+// Plain TCP transport over a POSIX socket, for running the client (and TLS) off the device,
+// e.g. against a local broker or TLS-terminating stand-in
+class MQTTSocketTransport : public MQTTTransport {
+private:
+    int fd;
+
+public:
+    MQTTSocketTransport();
+    ~MQTTSocketTransport();
+
+    int connect(const char* host, uint16_t port);
+    int connect(uint8_t* ip, uint16_t port);
+    size_t write(const uint8_t* buf, size_t size);
+    int available();
+    int read(uint8_t* buf, size_t size);
+    uint8_t connected();
+    void stop();
+};
+#endif
+
+#endif
@@ -4,12 +4,36 @@
 // The name of the device ID property to use
 #define FATHYM_ID_PROPERTY "id"
 
+// The maximum size in bytes of the cached message prefix holding the device ID and name
+#define FATHYM_MAX_PREFIX_SIZE 96
+
 // Whether or not to include the device's name
 #define FATHYM_ADD_DEVICE_NAME false
 
 // The name of the device name property to use
 #define FATHYM_DEVICE_NAME_PROPERTY "name"
 
+// The device name is asked for in the background and kept in EEPROM for the next boot, so startup
+// never waits for it: the maximum size of the name kept, its EEPROM address (after the boot id) and
+// how often (in seconds) to ask again until the cloud answers
+#define FATHYM_MAX_NAME_SIZE 32
+#define FATHYM_NAME_ADDRESS 24
+#define FATHYM_NAME_RETRY_RATE 30
+
+// The maximum number of values a message can hold
+#define FATHYM_MAX_FIELDS 32
+
+// The maximum number of values that can be aggregated between publishes
+#define FATHYM_MAX_AGGREGATES 8
+
+// The maximum number of compressed sample series a message can hold
+#define FATHYM_MAX_SERIES 2
+
+// The number of bytes of compressed samples each series can buffer. FATHYM_MAX_SERIES full series
+// (base64 encoded) have to fit a message of FATHYM_MQTT_TX_SIZE - MQTT_MAX_HEADER_SIZE bytes
+// (and over MQTT-SN of MQTT_SN_MAX_PACKET_SIZE - 8 bytes).
+#define FATHYM_SERIES_BUFFER_SIZE 192
+
 // The default number of decimal places to include from numbers with decimal values
 #define FATHYM_DEFAULT_DECIMAL_PLACES 6
 
@@ -37,12 +61,150 @@
 // The name of the free memory property to use
 #define FATHYM_FREE_MEMORY_PROPERTY "mem"
 
+// The rate (in seconds) at which system fields (free memory, battery) are sampled between publishes,
+// independent of the publish rate; publishing reads the last sampled values
+#define FATHYM_SYSTEM_SAMPLE_RATE 60
+
+// Whether or not values may be set from interrupts or another thread (e.g. a timer ISR sampling
+// a sensor) while publishing. Values set are double buffered and merged into the message while
+// waiting and when it is published, so each message is a consistent snapshot. Publish rules are
+// checked as they are merged rather than as they are set. aggregate() and series() must still be
+// called from the main loop.
+#define FATHYM_CONCURRENT_VALUES false
+
+// The maximum number of values that can be set between publishes when FATHYM_CONCURRENT_VALUES
+// is set (setting a value again updates its entry). Values beyond it are dropped and counted (valDrop).
+#define FATHYM_MAX_PENDING 8
+
+// The maximum number of series samples that can be set between publishes when FATHYM_CONCURRENT_VALUES
+// is set (each sample takes an entry, apart from the other values)
+#define FATHYM_MAX_PENDING_SAMPLES 16
+
+// The number of samples each capture channel holds between drains (a power of two). Channels are
+// drained every FATHYM_ALERT_POLL_RATE milliseconds while waiting between publishes, so this
+// needs to cover the samples taken in that time (e.g. 64 for up to 6.4 kHz at 10 ms).
+#define FATHYM_CHANNEL_SIZE 64
+
+// The maximum number of sample channels that can be captured into the message
+#define FATHYM_MAX_CHANNELS 4
+
+// Whether or not to number each published message ("boot" and "seq"), so the receiver can count
+// lost and duplicate messages without QoS 1. The number restarts from 1 with every boot; the boot
+// id is counted up in EEPROM on each startup (including each wake from deep sleep).
+#define FATHYM_ADD_SEQUENCE true
+
+// The names of the sequence number and boot id properties to use
+#define FATHYM_SEQUENCE_PROPERTY "seq"
+#define FATHYM_BOOT_PROPERTY "boot"
+
+// The EEPROM address the boot id is kept at (after the runtime settings)
+#define FATHYM_BOOT_ADDRESS 16
+
+// Whether or not to include the library's timing and traffic counters in the message
+#define FATHYM_ADD_STATS false
+
+// The name of the timing and traffic counters property to use
+#define FATHYM_STATS_PROPERTY "perf"
+
+// Whether or not to periodically publish network round trip and acknowledgement latency percentiles
+#define FATHYM_ADD_LATENCY false
+
+// The name of the network latency property to use
+#define FATHYM_LATENCY_PROPERTY "net"
+
+// The rate (in seconds) at which network latency percentiles are published
+#define FATHYM_LATENCY_REPORT_RATE 300
+
+// Whether or not to publish values keyed by small schema ids instead of their names and units.
+// The mapping of ids to names and units is published once after connecting and whenever it changes,
+// and values are only published by id once it has been. A value keeps its id until it is removed.
+#define FATHYM_USE_SCHEMA false
+
+// The name of the schema property to use
+#define FATHYM_SCHEMA_PROPERTY "schema"
+
+// The name of the schema version property to use
+#define FATHYM_SCHEMA_VERSION_PROPERTY "sv"
+
+// The MQTT QoS level (0 or 1) and retain flag for routine message data
+#define FATHYM_TELEMETRY_QOS 0
+#define FATHYM_TELEMETRY_RETAIN false
+
+// The MQTT QoS level (0 or 1) and retain flag for alerts, which are sent as soon as they are raised
+// instead of waiting for the next publish
+#define FATHYM_ALERT_QOS 1
+#define FATHYM_ALERT_RETAIN false
+
+// The name of the property that marks a message as an alert
+#define FATHYM_ALERT_PROPERTY "alert"
+
+// How often (in milliseconds) the wait between publishes checks for alerts raised from interrupts
+#define FATHYM_ALERT_POLL_RATE 10
+
+// The maximum number of alert values waiting to be sent together
+#define FATHYM_MAX_ALERTS 4
+
+// The number of alerts that can be raised from interrupts between checks (a power of two); more are dropped
+#define FATHYM_MAX_ISR_ALERTS 8
+
 // Whether or not the Fathym library will automatically handle publishing data or not
 #define FATHYM_AUTO_PUBLISH true
 
 // The publish rate (in seconds) for message data (applies when FATHYM_AUTO_PUBLISH is set to true)
 #define FATHYM_PUBLISH_RATE 10
 
+// The publish rate (in seconds) used once publish rules are added with publishWhen(): values are
+// still set every FATHYM_PUBLISH_RATE seconds, but only published as soon as a rule fires or this
+// long after the last publish
+#define FATHYM_BASELINE_RATE 300
+
+// The maximum number of publish rules (threshold or rate of change conditions on values)
+#define FATHYM_MAX_RULES 4
+
+// The maximum number of publish groups added with addGroup(), each sending the values moved into it
+// with group() to its own topic (the send topic, a dot and the group's suffix) at its own rate and QoS
+#define FATHYM_MAX_GROUPS 4
+
+// The maximum length of a publish group's topic
+#define FATHYM_MAX_TOPIC_SIZE 64
+
+// The maximum number of values that can be moved into publish groups
+#define FATHYM_MAX_GROUPED 16
+
+// Whether or not to slow the publish rate down when the network shows congestion (failed or slow writes,
+// reconnects, slow acknowledgements or pings) and speed it back up gradually once the link recovers.
+// Aggregated and series values keep collecting everything set in between, so a slower rate batches them.
+// Publish groups back off their own rates the same way when their publishes fail.
+#define FATHYM_ADAPTIVE_RATE true
+
+// The slowest publish rate (in seconds) the adaptive rate will back off to
+#define FATHYM_ADAPTIVE_MAX_RATE 600
+
+// A publish write, acknowledgement or ping taking longer than this (in milliseconds) counts as congestion
+#define FATHYM_ADAPTIVE_SLOW_MILLIS 2000
+
+// The number of uncongested publishes between each step back towards the configured publish rate
+#define FATHYM_ADAPTIVE_RECOVERY_CYCLES 3
+
+// Whether or not the publish rate, keep alive, decimal places and system fields can be changed at runtime
+// with a config command sent to the device's receive topic, e.g.
+// {"cmd":"config","rate":30,"ka":60,"dec":2,"uptime":true,"mem":false,"ts":true,"save":true}
+#define FATHYM_REMOTE_CONFIG true
+
+// The allowed range (in seconds) for a publish rate set by a config command
+#define FATHYM_MIN_PUBLISH_RATE 1
+#define FATHYM_MAX_PUBLISH_RATE 3600
+
+// Whether or not settings changed at runtime are saved to EEPROM and restored on startup
+#define FATHYM_PERSIST_CONFIG true
+
+// The EEPROM address the runtime settings are saved at
+#define FATHYM_CONFIG_ADDRESS 0
+
+// The names of the command and config properties of messages received by the device
+#define FATHYM_COMMAND_PROPERTY "cmd"
+#define FATHYM_CONFIG_PROPERTY "config"
+
 // The rate at which the MQTT communication loop updates in milliseconds.
 // This includes ping/keep alive/QoS/receiving messages. It runs on a
 // software timer independent of the main program loop.
@@ -53,6 +215,24 @@
 // 1 waiting message per update per update cycle.
 #define MQTT_MESSAGES_PER_UPDATE 10
 
+// The low-power mode to use between publishes: FATHYM_SLEEP_NONE stays awake,
+// FATHYM_SLEEP_RADIO turns the Wi-Fi radio off and FATHYM_SLEEP_STOP stops the MCU and radio
+#define FATHYM_SLEEP_MODE FATHYM_SLEEP_NONE
+
+// The shortest wait (in seconds) worth sleeping through, shorter waits stay awake
+#define FATHYM_MIN_SLEEP 5
+
+// The pin and edge that can wake the device early from FATHYM_SLEEP_STOP
+#define FATHYM_WAKE_PIN D1
+#define FATHYM_WAKE_EDGE RISING
+
+// The maximum time (in milliseconds) to wait for the network after waking
+#define FATHYM_WAKE_TIMEOUT 10000
+
+// Whether or not the broker keeps the MQTT session (and its subscription) between connections,
+// so QoS 1 messages sent while asleep are queued for the device (it still resubscribes on every connect)
+#define FATHYM_PERSISTENT_SESSION false
+
 // Default to standard MQTT port
 #define MQTT_DEFAULT_PORT 1883
 
@@ -64,10 +244,63 @@
 // The maximum size of the MQTT header in bytes
 #define MQTT_MAX_HEADER_SIZE 160
 
-// The reserved buffer size in bytes for MQTT data packet buffer.
+// The reserved buffer size in bytes for the outbound MQTT packet buffer.
 // The maximum buffer size available to serialize JSON messages to string
-// is determined by the MQTT_MAX_PACKET_SIZE - MQTT_MAX_HEADER_SIZE.
-#define MQTT_MAX_PACKET_SIZE 1024
+// is determined by the FATHYM_MQTT_TX_SIZE - MQTT_MAX_HEADER_SIZE.
+#define FATHYM_MQTT_TX_SIZE 1024
+
+// The reserved buffer size in bytes for the inbound MQTT packet buffer.
+// Larger inbound messages are only delivered through onChunk().
+#define FATHYM_MQTT_RX_SIZE 256
+
+// The size in bytes of the buffer that coalesces outbound MQTT packets (acks, pings and
+// small publishes) into fewer network writes; 0 writes every packet immediately.
+// The buffer is written out when it fills, at the end of each MQTT update, or on flush().
+#define MQTT_OUTPUT_BUFFER_SIZE 0
+
+// The size in bytes of the buffer that inbound MQTT data is read into with bulk socket reads
+#define MQTT_READ_BUFFER_SIZE 64
+
+// The maximum time (in milliseconds) to wait for the rest of an inbound MQTT packet; if the
+// connection closes or stalls part way through one, the packet is dropped and the client reconnects
+#define MQTT_READ_TIMEOUT 5000
+
+// The maximum length of the broker's host name, kept in a fixed buffer by the MQTT client
+#define MQTT_MAX_DOMAIN_SIZE 64
+
+// Whether or not to connect to the broker over TLS (requires the mbedTLS library).
+// The default port becomes 8883; set the broker's CA certificate with setCertificate().
+// The TLS session is kept between connections so reconnects resume it instead of
+// repeating the full handshake.
+#define MQTT_USE_TLS false
+
+// The maximum time (in milliseconds) a TLS handshake may take before the connect fails
+#define MQTT_TLS_HANDSHAKE_TIMEOUT 15000
+
+// The maximum time (in milliseconds) a TLS write may wait on a stalled connection before it fails
+#define MQTT_TLS_WRITE_TIMEOUT 5000
+
+// Whether or not to connect over TLS without verifying the broker when no CA certificate is set.
+// For testing only: anyone on the path can read the credentials. Otherwise connecting without
+// a CA certificate fails.
+#define MQTT_TLS_INSECURE false
+
+// Whether or not to publish through an MQTT-SN gateway over UDP instead of a TCP connection
+// to the broker (the default port becomes 1884). Topics are sent as short IDs, registered
+// with the gateway on first use unless a predefined ID is given below.
+#define MQTT_USE_SN false
+
+// The topic ID predefined on the gateway for the send topic (0 registers it on the first publish)
+#define FATHYM_SN_TOPIC_ID 0
+
+// Whether or not to publish without connecting to the gateway at all (MQTT-SN QoS -1): no
+// connect, keep alive or acknowledgements, just one datagram per publish. Needs a predefined
+// topic ID and disables receiving (remote commands and config).
+#define FATHYM_SN_CONNECTIONLESS false
+
+// The largest MQTT-SN datagram sent or received. Messages are cut down to fit one publish
+// datagram (MQTT_SN_MAX_PACKET_SIZE - 8 bytes) when that is smaller than the MQTT buffer allows.
+#define MQTT_SN_MAX_PACKET_SIZE 512
 
 // Whether or not to use the defined debug pin for Fathym visual status debugging
 #define FATHYM_USE_DEBUG_LED true
@@ -0,0 +1,2 @@
+// Build settings for the host tests. The library defaults apply to anything not set here; each test
+// target sets the options it exercises on the command line (see the Makefile).
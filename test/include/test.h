@@ -0,0 +1,26 @@
+// Minimal checks shared by the host tests
+#ifndef FATHYM_TEST_h
+#define FATHYM_TEST_h
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        testFailures++; \
+    } \
+} while (0)
+
+// Reports the result and gives the exit code
+static int testResult(const char *name) {
+    if (testFailures > 0) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, testFailures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif
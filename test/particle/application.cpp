@@ -0,0 +1,9 @@
+// Host stand-in (see application.h)
+#include "application.h"
+
+USBSerial Serial;
+WiFiClass WiFi;
+SystemClass System;
+TimeClass Time;
+CloudClass Particle;
+EEPROMClass EEPROM;
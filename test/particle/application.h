@@ -0,0 +1,352 @@
+// Host stand-in for the parts of the Particle firmware API the library uses, so Fathym and MQTT can be
+// built with SPARK defined and run off the device. Time is simulated: delay() moves the clock on and
+// fires any timers that come due. TCPClient talks to an in-memory broker that acknowledges what the
+// client sends. Nothing here allocates after construction, so allocation counts reflect the library.
+#ifndef FATHYM_TEST_APPLICATION_h
+#define FATHYM_TEST_APPLICATION_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t byte;
+typedef uint32_t system_tick_t;
+
+#define OUTPUT 1
+#define HIGH 1
+#define LOW 0
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+enum { D0, D1, D2, D3, D4, D5, D6, D7 };
+
+#define waitFor(condition, timeout) (condition())
+
+// The simulated uptime in microseconds. Reading the clock moves it on by a microsecond, as code takes
+// time to run on the device too (loops waiting for the clock to pass a time would never end otherwise).
+inline uint64_t & hostMicros() {
+    static uint64_t now = 0;
+    return now;
+}
+
+inline system_tick_t millis() {
+    return ++hostMicros() / 1000;
+}
+
+inline system_tick_t micros() {
+    return ++hostMicros();
+}
+
+inline void delay(unsigned long ms);
+
+inline void pinMode(uint16_t pin, int mode) {}
+inline void digitalWrite(uint16_t pin, uint8_t value) {}
+
+inline long random(long low, long high) {
+    return low + rand() % (high - low);
+}
+
+// Fixed-capacity stand-in for the Wiring String (only used for the device ID)
+class String {
+private:
+    char text[32];
+
+public:
+    String(const char* value = "") {
+        strncpy(text, value, sizeof(text) - 1);
+        text[sizeof(text) - 1] = 0;
+    }
+
+    const char* c_str() const {
+        return text;
+    }
+};
+
+class Print {
+public:
+    size_t print(const char* text) { return fputs(text, stdout) >= 0 ? strlen(text) : 0; }
+    size_t println(const char* text) { return print(text) + print("\n"); }
+    size_t println() { return print("\n"); }
+};
+
+class USBSerial : public Print {
+public:
+    void begin(long baud) {}
+};
+
+class IPAddress {
+private:
+    uint8_t octets[4];
+
+public:
+    IPAddress() { memset(octets, 0, sizeof(octets)); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { octets[0] = a; octets[1] = b; octets[2] = c; octets[3] = d; }
+    operator bool() const { return octets[0] != 0 || octets[1] != 0 || octets[2] != 0 || octets[3] != 0; }
+    uint8_t operator[](int i) const { return octets[i]; }
+    uint8_t& operator[](int i) { return octets[i]; }
+};
+
+// What the in-memory broker has seen
+typedef struct {
+    uint32_t connects;
+    uint32_t publishes;
+    uint32_t subscribes;
+    uint32_t pings;
+    bool refuse; // refuse connections (as if the network were down)
+} HostBroker;
+
+inline HostBroker & hostBroker() {
+    static HostBroker broker;
+    return broker;
+}
+
+// TCP connection to the in-memory broker: packets written are parsed and answered (CONNACK, PUBACK
+// for QoS 1, SUBACK and PINGRESP)
+class TCPClient {
+private:
+    bool open;
+    uint8_t sent[2048];
+    size_t sentLength;
+    uint8_t replies[256];
+    size_t replyHead;
+    size_t replyTail;
+
+    void reply(uint8_t header, uint16_t id, int extra) {
+        if (replyTail + 5 > sizeof(replies)) return;
+        replies[replyTail++] = header;
+        replies[replyTail++] = extra >= 0 ? 3 : 2;
+        replies[replyTail++] = id >> 8;
+        replies[replyTail++] = id & 0xFF;
+        if (extra >= 0) replies[replyTail++] = extra;
+    }
+
+    // Answers each whole packet received so far
+    void answer() {
+        for (;;) {
+            size_t pos = 1;
+            uint32_t length = 0;
+            uint32_t multiplier = 1;
+            uint8_t digit;
+            do {
+                if (pos >= sentLength) return;
+                digit = sent[pos++];
+                length += (digit & 127) * multiplier;
+                multiplier *= 128;
+            } while ((digit & 128) != 0);
+            if (pos + length > sentLength) return;
+
+            const uint8_t* body = sent + pos;
+            switch (sent[0] & 0xF0) {
+                case 0x10: // CONNECT
+                    hostBroker().connects++;
+                    reply(0x20, 0, -1);
+                    break;
+                case 0x30: { // PUBLISH
+                    hostBroker().publishes++;
+                    if (((sent[0] >> 1) & 0x03) > 0) {
+                        uint16_t topicLength = (body[0] << 8) | body[1];
+                        reply(0x40, (body[2 + topicLength] << 8) | body[3 + topicLength], -1);
+                    }
+                    break;
+                }
+                case 0x80: // SUBSCRIBE
+                    hostBroker().subscribes++;
+                    reply(0x90, (body[0] << 8) | body[1], 0);
+                    break;
+                case 0xC0: // PINGREQ
+                    hostBroker().pings++;
+                    if (replyTail + 2 <= sizeof(replies)) {
+                        replies[replyTail++] = 0xD0;
+                        replies[replyTail++] = 0;
+                    }
+                    break;
+            }
+
+            memmove(sent, sent + pos + length, sentLength - pos - length);
+            sentLength -= pos + length;
+        }
+    }
+
+public:
+    TCPClient() : open(false), sentLength(0), replyHead(0), replyTail(0) {}
+
+    int connect(const char* host, uint16_t port) {
+        if (hostBroker().refuse) return 0;
+        open = true;
+        sentLength = replyHead = replyTail = 0;
+        return 1;
+    }
+
+    int connect(IPAddress ip, uint16_t port) { return connect("", port); }
+    int connect(uint8_t* ip, uint16_t port) { return connect("", port); }
+
+    size_t write(const uint8_t* buf, size_t size) {
+        if (!open || sentLength + size > sizeof(sent)) return 0;
+        memcpy(sent + sentLength, buf, size);
+        sentLength += size;
+        answer();
+        return size;
+    }
+
+    size_t write(uint8_t b) { return write(&b, 1); }
+
+    int available() {
+        return open ? replyTail - replyHead : 0;
+    }
+
+    int read() {
+        if (available() == 0) return -1;
+        uint8_t b = replies[replyHead++];
+        if (replyHead == replyTail) replyHead = replyTail = 0;
+        return b;
+    }
+
+    int read(uint8_t* buf, size_t size) {
+        size_t n = available();
+        if (n == 0) return -1;
+        if (n > size) n = size;
+        memcpy(buf, replies + replyHead, n);
+        replyHead += n;
+        if (replyHead == replyTail) replyHead = replyTail = 0;
+        return n;
+    }
+
+    uint8_t connected() { return open; }
+    void stop() { open = false; }
+    void flush() {}
+};
+
+class WiFiClass {
+public:
+    IPAddress resolve(const char* host) { return IPAddress(127, 0, 0, 1); }
+    bool ready() { return true; }
+    void on() {}
+    void off() {}
+    void connect() {}
+};
+
+class SystemClass {
+public:
+    String deviceID() { return String("0123456789abcdef01234567"); }
+    uint32_t freeMemory() { return 60000; }
+    void sleep(long seconds) {}
+    void sleep(uint16_t pin, uint16_t edge, long seconds) {}
+};
+
+class TimeClass {
+public:
+    void zone(float offset) {}
+    time_t now() { return 1500000000 + hostMicros() / 1000000; }
+    bool isValid() { return true; }
+};
+
+enum PublishFlag { PRIVATE, PUBLIC };
+
+class CloudClass {
+public:
+    bool syncTime() { return true; }
+    bool connected() { return false; }
+    template<class T> bool subscribe(const char* name, void (T::*handler)(const char*, const char*), T* instance) { return true; }
+    bool publish(const char* name) { return true; }
+    void process() {}
+};
+
+// Software timer, fired by delay() as the simulated clock passes its period
+class Timer {
+private:
+    void* object;
+    char method[sizeof(void (Timer::*)())];
+    void (*call)(Timer* timer);
+    unsigned period;
+    system_tick_t due;
+    bool active;
+
+    template<class T> static void callMethod(Timer* timer) {
+        void (T::*handler)();
+        memcpy(&handler, timer->method, sizeof(handler));
+        (static_cast<T*>(timer->object)->*handler)();
+    }
+
+public:
+    template<class T> Timer(unsigned period, void (T::*handler)(), T& instance, bool oneShot = false) {
+        object = &instance;
+        memcpy(method, &handler, sizeof(handler));
+        call = &callMethod<T>;
+        this->period = period;
+        due = 0;
+        active = false;
+        all()[count()++ % 8] = this;
+    }
+
+    ~Timer() {
+        for (int i = 0; i < count() && i < 8; i++) {
+            if (all()[i] == this) all()[i] = NULL;
+        }
+    }
+
+    bool start() { due = millis() + period; active = true; return true; }
+    bool stop() { active = false; return true; }
+    bool isActive() { return active; }
+
+    // Fires the timers that have come due
+    static void fireDue() {
+        for (int i = 0; i < count() && i < 8; i++) {
+            Timer* timer = all()[i];
+            if (timer != NULL && timer->active && (int32_t)(millis() - timer->due) >= 0) {
+                timer->due += timer->period;
+                timer->call(timer);
+            }
+        }
+    }
+
+    static Timer** all() {
+        static Timer* timers[8];
+        return timers;
+    }
+
+    static int& count() {
+        static int timers = 0;
+        return timers;
+    }
+};
+
+inline void delay(unsigned long ms) {
+    hostMicros() += ms * 1000;
+    Timer::fireDue();
+}
+
+// EEPROM emulated in memory
+class EEPROMClass {
+private:
+    static uint8_t* bytes() {
+        static uint8_t memory[2048];
+        return memory;
+    }
+
+public:
+    template<class T> T& get(int address, T& value) {
+        memcpy(&value, bytes() + address, sizeof(T));
+        return value;
+    }
+
+    template<class T> const T& put(int address, const T& value) {
+        memcpy(bytes() + address, &value, sizeof(T));
+        return value;
+    }
+
+    uint8_t read(int address) { return bytes()[address]; }
+    void write(int address, uint8_t value) { bytes()[address] = value; }
+    size_t length() { return 2048; }
+};
+
+extern USBSerial Serial;
+extern WiFiClass WiFi;
+extern SystemClass System;
+extern TimeClass Time;
+extern CloudClass Particle;
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,2 @@
+// Host stand-in (see application.h)
+#include "application.h"
@@ -0,0 +1,128 @@
+// Runs Fathym over the host stand-ins for the Particle API (particle/) with an in-memory broker and
+// counts heap allocations: once warmed up, update cycles that set, aggregate, sample, capture, group,
+// alert and publish values must not allocate at all.
+//
+// Usage: test_alloc
+
+#include "Fathym.h"
+#include "test.h"
+
+#include <new>
+
+#define WARM_UP_CYCLES 5
+#define COUNTED_CYCLES 60
+
+static bool counting = false;
+static unsigned long allocations = 0;
+
+#if defined(__GLIBC__)
+// Count malloc() as well as new, for anything allocating through the C library
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+extern "C" void* malloc(size_t size) __THROW {
+    if (counting) allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) __THROW {
+    if (counting) allocations++;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) __THROW {
+    if (counting) allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr) __THROW {
+    __libc_free(ptr);
+}
+#define HOST_ALLOC __libc_malloc
+#define HOST_FREE __libc_free
+#else
+#define HOST_ALLOC malloc
+#define HOST_FREE free
+#endif
+
+void* operator new(size_t size) {
+    if (counting) allocations++;
+    void* ptr = HOST_ALLOC(size > 0 ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    HOST_FREE(ptr);
+}
+
+static Fathym fathym;
+static FathymChannel level;
+
+// One update cycle of a sketch using most of the library
+static void cycle(int n) {
+    fathym.beginUpdate();
+
+    // Crosses the rule's threshold every 20 cycles
+    fathym.set("temp", 20.0f + n % 20);
+    fathym.set("vib", (double)(n % 7) / 3, "g");
+    fathym.set("rpm", (long)(1000 + n));
+    fathym.set("door", n % 2 == 0);
+    fathym.set("state", "running");
+    fathym.setFixed("volts", 1200 + n % 50, 2, "V");
+
+    for (int i = 0; i < 10; i++) {
+        level.push(i * 0.5f);
+    }
+
+    if (n % 9 == 0) {
+        fathym.alert("overheat", 80.5);
+    }
+
+    fathym.endUpdate();
+}
+
+int main(int argc, char **argv) {
+    static char server[] = "broker";
+    static char username[] = "user";
+    static char password[] = "password";
+
+    fathym.setup();
+    CHECK(fathym.connect(server, username, password));
+
+    fathym.aggregate("temp", "C");
+    fathym.series("vib");
+    CHECK(fathym.publishWhen("temp", FATHYM_RULE_ABOVE, 35, 1));
+    fathym.setBaselineRate(30);
+    uint8_t group = fathym.addGroup("fast", 3, 1);
+    CHECK(group != 0);
+    CHECK(fathym.group("rpm", group));
+    fathym.aggregate("level");
+    CHECK(fathym.capture("level", level));
+
+    for (int n = 0; n < WARM_UP_CYCLES; n++) {
+        cycle(n);
+    }
+
+    HostBroker before = hostBroker();
+    counting = true;
+    for (int n = WARM_UP_CYCLES; n < WARM_UP_CYCLES + COUNTED_CYCLES; n++) {
+        cycle(n);
+    }
+    counting = false;
+
+    if (allocations > 0) {
+        fprintf(stderr, "%lu allocation(s) in %d cycles\n", allocations, COUNTED_CYCLES);
+    }
+    CHECK(allocations == 0);
+
+    // The cycles did publish (rules, baseline, group and alerts) over the same connection
+    CHECK(fathym.isConnected());
+    CHECK(hostBroker().connects == before.connects);
+    CHECK(hostBroker().publishes - before.publishes >= COUNTED_CYCLES);
+    CHECK(fathym.getStats().publishFailures == 0);
+
+    return testResult("test_alloc");
+}
@@ -0,0 +1,209 @@
+// Runs the MQTT client over the Particle API stand-ins (particle/) with a scripted transport that plays
+// the broker's side: packets cut short by the connection closing or stalling, and
+// inbound publishes at each QoS, whole and in chunks.
+//
+// Usage: test_mqtt
+
+#include "MQTT.h"
+#include "test.h"
+
+#include <unistd.h>
+
+// Transport fed from a script of broker bytes, recording what the client writes
+class ScriptedTransport : public MQTTTransport {
+public:
+    uint8_t in[1024];
+    size_t inHead;
+    size_t inTail;
+    uint8_t out[1024];
+    size_t outLength;
+    bool open;
+    bool closing; // the broker closes the connection once what it sent has been read
+
+    ScriptedTransport() : inHead(0), inTail(0), outLength(0), open(false), closing(false) {}
+
+    // Queues bytes for the client to read
+    void queue(const uint8_t *data, size_t length) {
+        memcpy(in + inTail, data, length);
+        inTail += length;
+    }
+
+    int connect(const char *host, uint16_t port) {
+        static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        open = true;
+        closing = false;
+        inHead = inTail = outLength = 0;
+        queue(connack, sizeof(connack));
+        return 1;
+    }
+
+    int connect(uint8_t *ip, uint16_t port) { return connect("", port); }
+
+    size_t write(const uint8_t *buf, size_t size) {
+        if (!open || outLength + size > sizeof(out)) return 0;
+        memcpy(out + outLength, buf, size);
+        outLength += size;
+        return size;
+    }
+
+    int available() { return open ? inTail - inHead : 0; }
+
+    int read(uint8_t *buf, size_t size) {
+        size_t n = available();
+        if (n == 0) return -1;
+        if (n > size) n = size;
+        memcpy(buf, in + inHead, n);
+        inHead += n;
+        return n;
+    }
+
+    uint8_t connected() {
+        if (closing && inHead == inTail) open = false;
+        return open;
+    }
+
+    void stop() { open = false; }
+};
+
+static char topic[64];
+static uint8_t payload[512];
+static unsigned int payloadLength;
+static int received = 0;
+
+static void onMessage(char *t, uint8_t *p, unsigned int length) {
+    strncpy(topic, t, sizeof(topic) - 1);
+    memcpy(payload, p, length < sizeof(payload) ? length : sizeof(payload));
+    payloadLength = length;
+    received++;
+}
+
+static char chunkTopic[64];
+static uint8_t chunked[512];
+static uint32_t chunkedLength;
+
+static void onChunk(char *t, uint32_t offset, uint8_t *p, uint16_t length, uint32_t total) {
+    strncpy(chunkTopic, t, sizeof(chunkTopic) - 1);
+    if (offset + length <= sizeof(chunked)) memcpy(chunked + offset, p, length);
+    chunkedLength = offset + length;
+}
+
+static ScriptedTransport *transport;
+
+// Connects the client afresh, taking the CONNECT it writes out of the way
+static bool connect(MQTT &client) {
+    if (client.isConnected()) client.disconnect();
+    if (!client.connect("test")) return false;
+    transport->outLength = 0;
+    return true;
+}
+
+// A packet cut short by the broker closing the connection fails instead of waiting forever
+static void checkClosedMidPacket(MQTT &client) {
+    CHECK(connect(client));
+    static const uint8_t partial[] = { 0x30, 0x14, 0x00, 0x01, 't', 'a' };
+    transport->queue(partial, sizeof(partial));
+    transport->closing = true;
+
+    received = 0;
+    client.loop();
+    CHECK(!client.isConnected());
+    CHECK(received == 0);
+}
+
+// A packet cut short by a stalled connection fails after MQTT_READ_TIMEOUT
+static void checkStalledMidPacket(MQTT &client) {
+    CHECK(connect(client));
+    static const uint8_t partial[] = { 0x30, 0x14, 0x00, 0x01, 't', 'a' };
+    transport->queue(partial, sizeof(partial));
+
+    received = 0;
+    unsigned long start = millis();
+    client.loop();
+    CHECK(millis() - start >= MQTT_READ_TIMEOUT);
+    CHECK(!client.isConnected());
+    CHECK(received == 0);
+
+    // The next connection starts clean
+    CHECK(connect(client));
+    static const uint8_t publish[] = { 0x30, 0x05, 0x00, 0x01, 't', 'h', 'i' };
+    transport->queue(publish, sizeof(publish));
+    CHECK(client.loop());
+    CHECK(received == 1);
+    CHECK(strcmp(topic, "t") == 0);
+    CHECK(payloadLength == 2 && memcmp(payload, "hi", 2) == 0);
+}
+
+// QoS 1 and 2 publishes keep their message id out of the payload and are acknowledged with PUBACK and
+// PUBREC; the PUBREL that follows a PUBREC gets PUBCOMP
+static void checkAcknowledged(MQTT &client) {
+    CHECK(connect(client));
+    static const uint8_t qos1[] = { 0x32, 0x07, 0x00, 0x01, 't', 0x12, 0x34, 'h', 'i' };
+    transport->queue(qos1, sizeof(qos1));
+    received = 0;
+    CHECK(client.loop());
+    CHECK(received == 1);
+    CHECK(payloadLength == 2 && memcmp(payload, "hi", 2) == 0);
+    static const uint8_t puback[] = { 0x40, 0x02, 0x12, 0x34 };
+    CHECK(transport->outLength == 4 && memcmp(transport->out, puback, 4) == 0);
+
+    transport->outLength = 0;
+    static const uint8_t qos2[] = { 0x34, 0x08, 0x00, 0x01, 't', 0x56, 0x78, 'y', 'o', 'u' };
+    transport->queue(qos2, sizeof(qos2));
+    CHECK(client.loop());
+    CHECK(received == 2);
+    CHECK(payloadLength == 3 && memcmp(payload, "you", 3) == 0);
+    static const uint8_t pubrec[] = { 0x50, 0x02, 0x56, 0x78 };
+    CHECK(transport->outLength == 4 && memcmp(transport->out, pubrec, 4) == 0);
+
+    transport->outLength = 0;
+    static const uint8_t pubrel[] = { 0x62, 0x02, 0x56, 0x78 };
+    transport->queue(pubrel, sizeof(pubrel));
+    CHECK(client.loop());
+    CHECK(received == 2);
+    static const uint8_t pubcomp[] = { 0x70, 0x02, 0x56, 0x78 };
+    CHECK(transport->outLength == 4 && memcmp(transport->out, pubcomp, 4) == 0);
+}
+
+// A QoS 2 publish too large for the buffer reaches the chunk callback without its message id
+static void checkChunkedQos2(MQTT &client) {
+    CHECK(connect(client));
+    uint8_t packet[3 + 2 + 3 + 2 + 300];
+    size_t length = 2 + 3 + 2 + 300;
+    packet[0] = 0x34;
+    packet[1] = 0x80 | (length & 0x7F);
+    packet[2] = length >> 7;
+    packet[3] = 0x00;
+    packet[4] = 0x03;
+    memcpy(packet + 5, "big", 3);
+    packet[8] = 0x9A;
+    packet[9] = 0xBC;
+    for (int i = 0; i < 300; i++) packet[10 + i] = 'a' + i % 26;
+    transport->queue(packet, sizeof(packet));
+
+    chunkedLength = 0;
+    CHECK(client.loop());
+    CHECK(strcmp(chunkTopic, "big") == 0);
+    CHECK(chunkedLength == 300);
+    CHECK(memcmp(chunked, packet + 10, 300) == 0);
+    static const uint8_t pubrec[] = { 0x50, 0x02, 0x9A, 0xBC };
+    CHECK(transport->outLength == 4 && memcmp(transport->out, pubrec, 4) == 0);
+}
+
+int main(int argc, char **argv) {
+    // Reads that never give up would hang the test, so end it instead
+    alarm(10);
+
+    static char domain[] = "broker";
+    MQTT client(domain, 1883, onMessage);
+    transport = new ScriptedTransport();
+    client.setTransport(transport);
+
+    checkClosedMidPacket(client);
+    checkStalledMidPacket(client);
+    checkAcknowledged(client);
+
+    client.addChunkCallback(onChunk);
+    checkChunkedQos2(client);
+
+    return testResult("test_mqtt");
+}
@@ -0,0 +1,174 @@
+// Checks the publish rules (thresholds with hysteresis, rate of change, firing on start and clear) and
+// the receive-side sequence tracking (new, gap, late, duplicate, stale and restart).
+//
+// Usage: test_rules
+
+#include "FathymRules.h"
+#include "FathymSequence.h"
+#include "test.h"
+
+// A rule fires when its condition starts to hold and again when it clears, not while it holds
+static void checkAbove() {
+    FathymRules rules;
+    CHECK(rules.add("temp", FATHYM_RULE_ABOVE, 30, 0));
+
+    CHECK(!rules.check("temp", 29, 0));
+    CHECK(!rules.check("temp", 30, 1)); // not above yet
+    CHECK(rules.check("temp", 30.5f, 2)); // starts
+    CHECK(!rules.check("temp", 35, 3));
+    CHECK(!rules.check("temp", 30.1f, 4));
+    CHECK(rules.check("temp", 29.9f, 5)); // clears
+    CHECK(!rules.check("temp", 20, 6));
+    CHECK(rules.fired() == 2);
+
+    // Other values don't touch the rule
+    CHECK(!rules.check("humidity", 100, 7));
+    CHECK(rules.fired() == 2);
+}
+
+// Once the condition holds, the value has to go back past the threshold by more than the hysteresis
+static void checkHysteresis() {
+    FathymRules above;
+    CHECK(above.add("temp", FATHYM_RULE_ABOVE, 30, 2));
+    CHECK(above.check("temp", 31, 0));
+    CHECK(!above.check("temp", 29, 1)); // within the hysteresis
+    CHECK(!above.check("temp", 28, 2)); // on its edge
+    CHECK(!above.check("temp", 30.5f, 3));
+    CHECK(above.check("temp", 27.9f, 4)); // clears
+    CHECK(!above.check("temp", 29.5f, 5)); // the threshold itself applies again
+    CHECK(!above.check("temp", 30, 6));
+    CHECK(above.check("temp", 30.1f, 7));
+    CHECK(above.fired() == 3);
+
+    FathymRules below;
+    CHECK(below.add("battery", FATHYM_RULE_BELOW, 10, 1));
+    CHECK(!below.check("battery", 10, 0)); // not below yet
+    CHECK(below.check("battery", 9.9f, 1));
+    CHECK(!below.check("battery", 10.8f, 2));
+    CHECK(!below.check("battery", 11, 3)); // on its edge
+    CHECK(below.check("battery", 11.2f, 4));
+    CHECK(!below.check("battery", 10.5f, 5));
+
+    // A negative hysteresis is taken as its size
+    FathymRules negative;
+    CHECK(negative.add("temp", FATHYM_RULE_ABOVE, 30, -2));
+    CHECK(negative.check("temp", 31, 0));
+    CHECK(!negative.check("temp", 29, 1));
+    CHECK(negative.check("temp", 27, 2));
+}
+
+// Rate of change is per second between samples at different times
+static void checkChange() {
+    FathymRules rules;
+    CHECK(rules.add("level", FATHYM_RULE_CHANGE, 5, 1));
+
+    // The first sample only primes the rule, however far it is from zero
+    CHECK(!rules.check("level", 100, 1000));
+
+    // A sample in the same millisecond has no rate and is skipped, so it doesn't become the reference
+    CHECK(!rules.check("level", 1000, 1000));
+
+    // 10 per second, either way
+    CHECK(rules.check("level", 110, 2000));
+    CHECK(!rules.check("level", 105, 3000)); // 5 per second, within the hysteresis
+    CHECK(!rules.check("level", 105, 3000));
+    CHECK(rules.check("level", 101.5f, 4000)); // 3.5 per second clears it
+    CHECK(rules.check("level", 95, 4500)); // 13 per second down
+    CHECK(!rules.check("level", 95, 4500));
+    CHECK(rules.check("level", 95, 5500));
+    CHECK(rules.fired() == 4);
+
+    // Time wrapping around is still a positive interval
+    FathymRules wrapped;
+    CHECK(wrapped.add("level", FATHYM_RULE_CHANGE, 5, 0));
+    CHECK(!wrapped.check("level", 0, 0xFFFFFE0CUL)); // 500 ms before wrapping
+    CHECK(wrapped.check("level", 10, 500)); // 10 per second
+}
+
+// Several rules on a value fire together as one check; the table is bounded
+static void checkTable() {
+    FathymRules rules;
+    CHECK(rules.add("temp", FATHYM_RULE_ABOVE, 30, 0));
+    CHECK(rules.add("temp", FATHYM_RULE_ABOVE, 40, 0));
+    CHECK(rules.add("level", FATHYM_RULE_BELOW, 5, 0));
+    CHECK(!rules.add("temp", FATHYM_RULE_CHANGE + 1, 0, 0));
+    CHECK(rules.count() == 3);
+
+    CHECK(rules.check("temp", 45, 0));
+    CHECK(rules.fired() == 1);
+    CHECK(rules.check("temp", 35, 1)); // only the higher rule clears
+    CHECK(!rules.check("temp", 35, 2));
+
+    rules.remove("temp");
+    CHECK(rules.count() == 1);
+    CHECK(!rules.check("temp", 10, 3));
+    CHECK(rules.check("level", 1, 4));
+
+    rules.clear();
+    CHECK(rules.count() == 0);
+    for (int i = 0; i < FATHYM_MAX_RULES; i++) {
+        CHECK(rules.add("temp", FATHYM_RULE_ABOVE, i, 0));
+    }
+    CHECK(!rules.add("temp", FATHYM_RULE_ABOVE, 100, 0));
+}
+
+// Follows a sender's sequence numbers through gaps, reordering, duplicates and restarts
+static void checkSequence() {
+    FathymSequence sequence;
+    CHECK(sequence.check(7, 1) == FATHYM_SEQUENCE_RESTART);
+    CHECK(sequence.check(7, 2) == FATHYM_SEQUENCE_NEW);
+    CHECK(sequence.check(7, 3) == FATHYM_SEQUENCE_NEW);
+    CHECK(sequence.received() == 3 && sequence.lost() == 0);
+
+    // 4 and 5 skipped, then 4 turns up late (once)
+    CHECK(sequence.check(7, 6) == FATHYM_SEQUENCE_GAP);
+    CHECK(sequence.lost() == 2);
+    CHECK(sequence.check(7, 4) == FATHYM_SEQUENCE_LATE);
+    CHECK(sequence.lost() == 1);
+    CHECK(sequence.check(7, 4) == FATHYM_SEQUENCE_DUPLICATE);
+    CHECK(sequence.check(7, 6) == FATHYM_SEQUENCE_DUPLICATE);
+    CHECK(sequence.check(7, 1) == FATHYM_SEQUENCE_DUPLICATE);
+    CHECK(sequence.duplicates() == 3);
+    CHECK(sequence.received() == 5);
+    CHECK(sequence.last() == 6);
+
+    // The window reaches back 31 messages; older ones can't be told apart
+    CHECK(sequence.check(7, 37) == FATHYM_SEQUENCE_GAP);
+    CHECK(sequence.lost() == 1 + 30);
+    CHECK(sequence.check(7, 6) == FATHYM_SEQUENCE_DUPLICATE); // age 31
+    CHECK(sequence.check(7, 5) == FATHYM_SEQUENCE_STALE); // age 32
+    CHECK(sequence.lost() == 31);
+
+    // A jump past the window forgets it
+    CHECK(sequence.check(7, 100) == FATHYM_SEQUENCE_GAP);
+    CHECK(sequence.lost() == 31 + 62);
+    CHECK(sequence.check(7, 99) == FATHYM_SEQUENCE_LATE);
+    CHECK(sequence.check(7, 37) == FATHYM_SEQUENCE_STALE);
+
+    // A new boot starts over; the messages before the first one received are lost, unless they turn up
+    CHECK(sequence.check(8, 3) == FATHYM_SEQUENCE_RESTART);
+    CHECK(sequence.boot() == 8 && sequence.last() == 3);
+    CHECK(sequence.lost() == 92 + 2);
+    CHECK(sequence.check(8, 1) == FATHYM_SEQUENCE_LATE);
+    CHECK(sequence.lost() == 92 + 1);
+    CHECK(sequence.check(8, 4) == FATHYM_SEQUENCE_NEW);
+
+    // Left over from the previous boot
+    CHECK(sequence.check(7, 101) == FATHYM_SEQUENCE_STALE);
+    CHECK(sequence.boot() == 8);
+
+    sequence.reset();
+    CHECK(sequence.received() == 0 && sequence.lost() == 0 && sequence.duplicates() == 0);
+    CHECK(sequence.check(3, 1) == FATHYM_SEQUENCE_RESTART);
+    CHECK(sequence.lost() == 0);
+}
+
+int main(int argc, char **argv) {
+    checkAbove();
+    checkHysteresis();
+    checkChange();
+    checkTable();
+    checkSequence();
+
+    return testResult("test_rules");
+}
@@ -0,0 +1,226 @@
+// Decodes what FathymSeries compresses with a reference decoder written from the format described in
+// FathymSeries.h, and checks that every timestamp and value comes back exactly: constant, smooth and
+// noisy values, every delta-of-delta range and its edges, time going backwards, and a full buffer.
+//
+// Usage: test_series
+
+#include "FathymSeries.h"
+#include "test.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SAMPLES 2048
+
+// Reads bits MSB first, as the series writes them
+class BitReader {
+private:
+    const uint8_t *data;
+    size_t bits;
+    size_t pos;
+
+public:
+    bool overrun;
+
+    BitReader(const uint8_t *data, size_t size) : data(data), bits(size * 8), pos(0), overrun(false) {}
+
+    uint32_t read(uint8_t count) {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            if (pos >= bits) {
+                overrun = true;
+                return 0;
+            }
+            value = (value << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1);
+            pos++;
+        }
+        return value;
+    }
+};
+
+// Decodes the samples of a series (false if the data ran out first)
+static bool decode(const FathymSeries &series, uint32_t *times, float *values) {
+    BitReader reader(series.data(), series.size());
+    uint32_t time = series.start();
+    int32_t delta = 0;
+    uint32_t value = 0;
+    uint8_t leading = 0;
+    uint8_t length = 0;
+
+    for (uint16_t i = 0; i < series.count(); i++) {
+        if (i == 0) {
+            value = reader.read(32);
+        }
+        else {
+            int32_t deltaOfDelta;
+            if (reader.read(1) == 0) deltaOfDelta = 0;
+            else if (reader.read(1) == 0) deltaOfDelta = (int32_t)reader.read(7) - 63;
+            else if (reader.read(1) == 0) deltaOfDelta = (int32_t)reader.read(9) - 255;
+            else if (reader.read(1) == 0) deltaOfDelta = (int32_t)reader.read(12) - 2047;
+            else deltaOfDelta = (int32_t)reader.read(32);
+            delta += deltaOfDelta;
+            time += delta;
+
+            if (reader.read(1) == 1) {
+                if (reader.read(1) == 1) {
+                    leading = reader.read(5);
+                    length = reader.read(5) + 1;
+                }
+                uint8_t trailing = 32 - leading - length;
+                value ^= reader.read(length) << trailing;
+            }
+        }
+
+        times[i] = time;
+        memcpy(&values[i], &value, sizeof(value));
+    }
+
+    return !reader.overrun;
+}
+
+// Appends the samples and checks the ones kept decode to the same timestamps and values
+static void roundTrip(const char *name, const uint32_t *times, const float *values, int count) {
+    static uint32_t keptTimes[MAX_SAMPLES];
+    static float keptValues[MAX_SAMPLES];
+    FathymSeries series;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (series.append(times[i], values[i])) {
+            keptTimes[kept] = times[i];
+            keptValues[kept] = values[i];
+            kept++;
+        }
+    }
+
+    static uint32_t decodedTimes[MAX_SAMPLES];
+    static float decodedValues[MAX_SAMPLES];
+    CHECK(series.count() == kept);
+    CHECK(series.dropped() == count - kept);
+    CHECK(decode(series, decodedTimes, decodedValues));
+
+    int mismatches = 0;
+    for (int i = 0; i < series.count(); i++) {
+        if (decodedTimes[i] != keptTimes[i] || memcmp(&decodedValues[i], &keptValues[i], sizeof(float)) != 0) {
+            if (mismatches++ == 0) {
+                fprintf(stderr, "%s: sample %d decoded as %u %g, appended %u %g\n", name, i,
+                    decodedTimes[i], decodedValues[i], keptTimes[i], keptValues[i]);
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+static uint32_t times[MAX_SAMPLES];
+static float values[MAX_SAMPLES];
+
+// The same value at a steady rate takes a bit each for time and value
+static void checkConstant() {
+    for (int i = 0; i < 100; i++) {
+        times[i] = 5000 + i * 1000;
+        values[i] = 21.5f;
+    }
+    roundTrip("constant", times, values, 100);
+
+    // The first interval is a change from none
+    FathymSeries series;
+    for (int i = 0; i < 100; i++) series.append(times[i], values[i]);
+    CHECK(series.size() == (32 + 16 + 1 + 98 * 2 + 7) / 8);
+}
+
+// A slowly changing value with jittery sample times
+static void checkSmooth() {
+    uint32_t time = 123456;
+    for (int i = 0; i < 200; i++) {
+        time += 100 + (i % 5) - 2;
+        times[i] = time;
+        values[i] = 20.0f + 5.0f * sinf(i * 0.05f);
+    }
+    roundTrip("smooth", times, values, 200);
+}
+
+// Random values (including zero, negatives and infinity) and irregular times
+static void checkNoisy() {
+    srand(42);
+    uint32_t time = 0;
+    for (int i = 0; i < 300; i++) {
+        time += rand() % 5000;
+        times[i] = time;
+        switch (rand() % 8) {
+            case 0: values[i] = 0.0f; break;
+            case 1: values[i] = i > 0 ? -values[i - 1] : -1.0f; break;
+            case 2: values[i] = INFINITY; break;
+            case 3: { uint32_t bits = (uint32_t)rand() ^ ((uint32_t)rand() << 16); memcpy(&values[i], &bits, sizeof(bits)); break; }
+            default: values[i] = (rand() % 100000) / 7.0f - 5000.0f;
+        }
+    }
+    roundTrip("noisy", times, values, 300);
+}
+
+// Each delta-of-delta range and the values either side of its edges
+static void checkTimeRanges() {
+    static const int32_t changes[] = {
+        0, 1, -1, 64, -63, 65, -64, 256, -255, 257, -256, 2048, -2047, 2049, -2048,
+        100000, -100000, 2000000000, -2000000000, 0, 0
+    };
+    int count = sizeof(changes) / sizeof(changes[0]);
+
+    uint32_t time = 1000000;
+    int32_t delta = 3000;
+    times[0] = time;
+    values[0] = 1.0f;
+    for (int i = 1; i < count; i++) {
+        delta += changes[i];
+        time += delta;
+        times[i] = time;
+        values[i] = (float)i;
+    }
+    roundTrip("time ranges", times, values, count);
+}
+
+// Time going backwards (e.g. a clock that was reset) is a negative interval
+static void checkBackwards() {
+    uint32_t sequence[] = { 10000, 11000, 12000, 9000, 9500, 9500, 20000, 5, 4294967000U, 100 };
+    int count = sizeof(sequence) / sizeof(sequence[0]);
+    for (int i = 0; i < count; i++) {
+        times[i] = sequence[i];
+        values[i] = i * 0.25f;
+    }
+    roundTrip("backwards", times, values, count);
+}
+
+// Samples that don't fit are dropped whole, and what did fit still decodes
+static void checkFull() {
+    srand(7);
+    int count = FATHYM_SERIES_BUFFER_SIZE; // far more than fits: random values take 40+ bits each
+    for (int i = 0; i < count; i++) {
+        times[i] = i * 10;
+        uint32_t bits = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+        memcpy(&values[i], &bits, sizeof(bits));
+    }
+    roundTrip("full", times, values, count);
+
+    FathymSeries series;
+    for (int i = 0; i < count; i++) {
+        series.append(times[i], values[i]);
+    }
+    CHECK(series.dropped() > 0);
+    CHECK(series.size() <= FATHYM_SERIES_BUFFER_SIZE);
+    CHECK(series.count() + series.dropped() == count);
+
+    series.clear();
+    CHECK(series.count() == 0 && series.dropped() == 0 && series.size() == 0);
+    CHECK(series.append(5, 1.0f));
+    CHECK(series.start() == 5);
+}
+
+int main(int argc, char **argv) {
+    checkConstant();
+    checkSmooth();
+    checkNoisy();
+    checkTimeRanges();
+    checkBackwards();
+    checkFull();
+
+    return testResult("test_series");
+}
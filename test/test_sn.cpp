@@ -0,0 +1,275 @@
+// Runs MQTTSnTransport against a gateway stand-in: MQTT packets written to the transport have to
+// come out as the right MQTT-SN datagrams, and the gateway's replies have to be read back as MQTT.
+//
+// Usage: test_sn
+
+#include "MQTTSnTransport.h"
+#include "test.h"
+
+#include <string.h>
+
+#define GATEWAY_REGISTERED_ID 0x0101
+#define GATEWAY_SUBSCRIBED_ID 0x0201
+
+// Answers datagrams the way an MQTT-SN gateway would and keeps the last one sent
+class GatewayStandIn : public MQTTSnTransport {
+public:
+    bool opened;
+    int sent;
+    uint8_t last[MQTT_SN_MAX_PACKET_SIZE];
+    uint16_t lastLength;
+    uint8_t replies[8][MQTT_SN_MAX_PACKET_SIZE];
+    uint16_t replyLengths[8];
+    int replyHead;
+    int replyTail;
+
+    GatewayStandIn() : opened(false), sent(0), lastLength(0), replyHead(0), replyTail(0) {}
+
+    // Queues a datagram for the transport to receive
+    void reply(uint8_t type, const uint8_t* body, uint16_t length) {
+        uint8_t *datagram = replies[replyTail % 8];
+        datagram[0] = length + 2;
+        datagram[1] = type;
+        if (length > 0) {
+            memcpy(datagram + 2, body, length);
+        }
+        replyLengths[replyTail++ % 8] = length + 2;
+    }
+
+protected:
+    bool openGateway(const char* host, uint16_t port) {
+        opened = strcmp(host, "gateway") == 0 && port == 1884;
+        return opened;
+    }
+
+    bool openGateway(uint8_t* ip, uint16_t port) {
+        opened = true;
+        return true;
+    }
+
+    bool sendDatagram(const uint8_t* buf, uint16_t length) {
+        sent++;
+        memcpy(last, buf, length);
+        lastLength = length;
+
+        const uint8_t *msg = buf + 2;
+        switch (buf[1]) {
+            case MQTTSN_CONNECT: {
+                uint8_t ack[1] = { 0 };
+                reply(MQTTSN_CONNACK, ack, 1);
+                break;
+            }
+            case MQTTSN_REGISTER: {
+                uint8_t ack[5] = { GATEWAY_REGISTERED_ID >> 8, GATEWAY_REGISTERED_ID & 0xFF, msg[2], msg[3], 0 };
+                reply(MQTTSN_REGACK, ack, 5);
+                break;
+            }
+            case MQTTSN_PUBLISH:
+                if ((msg[0] & 0x60) == 0x20) {
+                    uint8_t ack[5] = { msg[1], msg[2], msg[3], msg[4], 0 };
+                    reply(MQTTSN_PUBACK, ack, 5);
+                }
+                break;
+            case MQTTSN_SUBSCRIBE: {
+                uint8_t ack[6] = { 0x20, GATEWAY_SUBSCRIBED_ID >> 8, GATEWAY_SUBSCRIBED_ID & 0xFF, msg[1], msg[2], 0 };
+                reply(MQTTSN_SUBACK, ack, 6);
+                break;
+            }
+            case MQTTSN_PINGREQ:
+                reply(MQTTSN_PINGRESP, NULL, 0);
+                break;
+        }
+        return true;
+    }
+
+    int receiveDatagram(uint8_t* buf, uint16_t size) {
+        if (replyHead == replyTail) {
+            return 0;
+        }
+        uint16_t length = replyLengths[replyHead % 8];
+        memcpy(buf, replies[replyHead++ % 8], length);
+        return length;
+    }
+
+    void closeGateway() {
+        opened = false;
+    }
+};
+
+// Builds an MQTT packet from its header and body
+static size_t packet(uint8_t* buf, uint8_t header, const uint8_t* body, size_t length) {
+    size_t pos = 0;
+    buf[pos++] = header;
+    size_t remaining = length;
+    do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        buf[pos++] = digit | (remaining > 0 ? 0x80 : 0);
+    } while (remaining > 0);
+    memcpy(buf + pos, body, length);
+    return pos + length;
+}
+
+// Builds a PUBLISH of the given topic and payload (with a message ID above QoS 0)
+static size_t publish(uint8_t* buf, const char* topic, uint8_t qos, uint16_t msgId, const char* payload, size_t payloadLength) {
+    static uint8_t body[MQTT_SN_MAX_PACKET_SIZE * 2];
+    size_t length = 0;
+    size_t topicLength = strlen(topic);
+    body[length++] = topicLength >> 8;
+    body[length++] = topicLength & 0xFF;
+    memcpy(body + length, topic, topicLength);
+    length += topicLength;
+    if (qos > 0) {
+        body[length++] = msgId >> 8;
+        body[length++] = msgId & 0xFF;
+    }
+    memcpy(body + length, payload, payloadLength);
+    length += payloadLength;
+    return packet(buf, MQTTPUBLISH | (qos << 1), body, length);
+}
+
+// Writes a whole packet to the transport
+static bool send(MQTTSnTransport &transport, const uint8_t* buf, size_t length) {
+    return transport.write(buf, length) == length;
+}
+
+// Reads what the transport has received and compares it with the expected MQTT bytes
+static bool receives(MQTTSnTransport &transport, const uint8_t* expected, size_t length) {
+    uint8_t buf[MQTT_SN_MAX_PACKET_SIZE * 2];
+    size_t count = 0;
+    while (transport.available() > 0 && count < sizeof(buf)) {
+        int n = transport.read(buf + count, sizeof(buf) - count);
+        if (n <= 0) break;
+        count += n;
+    }
+    return count == length && (length == 0 || memcmp(buf, expected, length) == 0);
+}
+
+static const uint8_t connectBody[] = { 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 20, 0, 3, 'd', 'e', 'v' };
+
+// Connects, registers a topic on its first publish, publishes at QoS 0 and 1, subscribes and pings
+static void checkGateway() {
+    GatewayStandIn gateway;
+    uint8_t buf[MQTT_SN_MAX_PACKET_SIZE * 2];
+    size_t length;
+
+    CHECK(gateway.connect("gateway", 1884) == 1);
+    CHECK(gateway.opened);
+    CHECK(gateway.setPredefinedTopic("fixed/topic", 42));
+
+    // CONNECT: clean session flag, protocol ID, keep alive and client ID
+    length = packet(buf, MQTTCONNECT, connectBody, sizeof(connectBody));
+    CHECK(send(gateway, buf, length));
+    static const uint8_t snConnect[] = { 9, MQTTSN_CONNECT, 0x04, 0x01, 0, 20, 'd', 'e', 'v' };
+    CHECK(gateway.lastLength == sizeof(snConnect) && memcmp(gateway.last, snConnect, sizeof(snConnect)) == 0);
+    static const uint8_t connack[] = { MQTTCONNACK, 2, 0, 0 };
+    CHECK(receives(gateway, connack, sizeof(connack)));
+
+    // The first publish to a long topic registers it and is held until the REGACK
+    length = publish(buf, "devices/dev/data", 1, 7, "{\"a\":1}", 7);
+    CHECK(send(gateway, buf, length));
+    CHECK(gateway.sent == 2);
+    CHECK(gateway.last[1] == MQTTSN_REGISTER);
+    CHECK(gateway.lastLength == 6 + 16 && memcmp(gateway.last + 6, "devices/dev/data", 16) == 0);
+    CHECK(receives(gateway, NULL, 0));
+    CHECK(gateway.sent == 3);
+    static const uint8_t snPublish[] = { 14, MQTTSN_PUBLISH, 0x20, 0x01, 0x01, 0, 7, '{', '"', 'a', '"', ':', '1', '}' };
+    CHECK(gateway.lastLength == sizeof(snPublish) && memcmp(gateway.last, snPublish, sizeof(snPublish)) == 0);
+    static const uint8_t puback[] = { MQTTPUBACK, 2, 0, 7 };
+    CHECK(receives(gateway, puback, sizeof(puback)));
+
+    // Once registered the topic goes out by its ID straight away
+    length = publish(buf, "devices/dev/data", 0, 0, "x", 1);
+    CHECK(send(gateway, buf, length));
+    CHECK(gateway.sent == 4);
+    static const uint8_t snRegistered[] = { 8, MQTTSN_PUBLISH, 0x00, 0x01, 0x01, 0, 0, 'x' };
+    CHECK(gateway.lastLength == sizeof(snRegistered) && memcmp(gateway.last, snRegistered, sizeof(snRegistered)) == 0);
+
+    // Two character topics are sent as short names, predefined topics by their ID
+    length = publish(buf, "ab", 0, 0, "y", 1);
+    CHECK(send(gateway, buf, length));
+    static const uint8_t snShort[] = { 8, MQTTSN_PUBLISH, 0x02, 'a', 'b', 0, 0, 'y' };
+    CHECK(gateway.lastLength == sizeof(snShort) && memcmp(gateway.last, snShort, sizeof(snShort)) == 0);
+
+    length = publish(buf, "fixed/topic", 0, 0, "z", 1);
+    CHECK(send(gateway, buf, length));
+    static const uint8_t snPredefined[] = { 8, MQTTSN_PUBLISH, 0x01, 0, 42, 0, 0, 'z' };
+    CHECK(gateway.lastLength == sizeof(snPredefined) && memcmp(gateway.last, snPredefined, sizeof(snPredefined)) == 0);
+
+    // A subscription's topic ID names the publishes the gateway sends for it
+    static const uint8_t subscribeBody[] = { 0, 9, 0, 7, 'c', 'm', 'd', '/', 'd', 'e', 'v', 1 };
+    length = packet(buf, MQTTSUBSCRIBE | 0x02, subscribeBody, sizeof(subscribeBody));
+    CHECK(send(gateway, buf, length));
+    CHECK(gateway.last[1] == MQTTSN_SUBSCRIBE && gateway.last[2] == 0x20);
+    static const uint8_t suback[] = { MQTTSUBACK, 3, 0, 9, 1 };
+    CHECK(receives(gateway, suback, sizeof(suback)));
+
+    static const uint8_t snInbound[] = { 0x00, GATEWAY_SUBSCRIBED_ID >> 8, GATEWAY_SUBSCRIBED_ID & 0xFF, 0, 0, 'h', 'i' };
+    gateway.reply(MQTTSN_PUBLISH, snInbound, sizeof(snInbound));
+    static const uint8_t inbound[] = { MQTTPUBLISH, 11, 0, 7, 'c', 'm', 'd', '/', 'd', 'e', 'v', 'h', 'i' };
+    CHECK(receives(gateway, inbound, sizeof(inbound)));
+
+    static const uint8_t pingreq[] = { MQTTPINGREQ, 0 };
+    CHECK(send(gateway, pingreq, sizeof(pingreq)));
+    CHECK(gateway.last[1] == MQTTSN_PINGREQ);
+    static const uint8_t pingresp[] = { MQTTPINGRESP, 0 };
+    CHECK(receives(gateway, pingresp, sizeof(pingresp)));
+
+    // A publish has to fit one datagram: MQTT_SN_MAX_PACKET_SIZE - 9 bytes of payload, which is
+    // what FATHYM_MAX_MESSAGE_SIZE leaves a message (its buffer holds the terminator too)
+    static char payload[MQTT_SN_MAX_PACKET_SIZE];
+    memset(payload, 'p', sizeof(payload));
+    int sent = gateway.sent;
+    length = publish(buf, "ab", 0, 0, payload, MQTT_SN_MAX_PACKET_SIZE - 9);
+    CHECK(send(gateway, buf, length));
+    CHECK(gateway.sent == sent + 1);
+    CHECK(gateway.lastLength == MQTT_SN_MAX_PACKET_SIZE);
+    length = publish(buf, "ab", 0, 0, payload, MQTT_SN_MAX_PACKET_SIZE - 8);
+    CHECK(!send(gateway, buf, length));
+    CHECK(gateway.sent == sent + 1);
+
+    // The gateway ending the session closes the transport
+    gateway.reply(MQTTSN_DISCONNECT, NULL, 0);
+    CHECK(gateway.available() == 0);
+    CHECK(!gateway.connected());
+    CHECK(!gateway.opened);
+}
+
+// Without a connection CONNECT and PINGREQ are answered locally and publishes go out at QoS -1
+static void checkConnectionless() {
+    GatewayStandIn gateway;
+    uint8_t buf[MQTT_SN_MAX_PACKET_SIZE * 2];
+    size_t length;
+
+    gateway.setConnectionless(true);
+    CHECK(gateway.setPredefinedTopic("fixed/topic", 42));
+    CHECK(gateway.connect("gateway", 1884) == 1);
+
+    length = packet(buf, MQTTCONNECT, connectBody, sizeof(connectBody));
+    CHECK(send(gateway, buf, length));
+    static const uint8_t connack[] = { MQTTCONNACK, 2, 0, 0 };
+    CHECK(receives(gateway, connack, sizeof(connack)));
+    CHECK(gateway.sent == 0);
+
+    length = publish(buf, "fixed/topic", 0, 0, "z", 1);
+    CHECK(send(gateway, buf, length));
+    static const uint8_t snPredefined[] = { 8, MQTTSN_PUBLISH, 0x61, 0, 42, 0, 0, 'z' };
+    CHECK(gateway.lastLength == sizeof(snPredefined) && memcmp(gateway.last, snPredefined, sizeof(snPredefined)) == 0);
+
+    // Topics can't be registered without a connection
+    length = publish(buf, "devices/dev/data", 0, 0, "x", 1);
+    CHECK(!send(gateway, buf, length));
+    CHECK(gateway.sent == 1);
+
+    static const uint8_t pingreq[] = { MQTTPINGREQ, 0 };
+    CHECK(send(gateway, pingreq, sizeof(pingreq)));
+    static const uint8_t pingresp[] = { MQTTPINGRESP, 0 };
+    CHECK(receives(gateway, pingresp, sizeof(pingresp)));
+    CHECK(gateway.sent == 1);
+}
+
+int main(int argc, char **argv) {
+    checkGateway();
+    checkConnectionless();
+    return testResult("test_sn");
+}
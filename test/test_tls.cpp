@@ -0,0 +1,199 @@
+// Runs MQTTTlsTransport over a POSIX socket against a local `openssl s_server -rev` (which sends each
+// line back reversed): certificate checks, the echo, full vs resumed handshakes with session tickets
+// and with the server's session cache, and the write timeout on a stalled connection.
+//
+// Usage: test_tls <openssl> <directory with ca.pem, server.pem and server.key>
+
+#include "MQTTTlsTransport.h"
+#include "test.h"
+
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static char caPem[8192];
+
+static unsigned long nowMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
+
+// Socket transport whose writes can be made to stall, as on a congested link
+class StallingTransport : public MQTTSocketTransport {
+public:
+    bool stalled;
+
+    StallingTransport() : stalled(false) {}
+
+    size_t write(const uint8_t* buf, size_t size) {
+        return stalled ? 0 : MQTTSocketTransport::write(buf, size);
+    }
+};
+
+// Finds a free local port for the server
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr*)&address, sizeof(address));
+
+    socklen_t length = sizeof(address);
+    getsockname(fd, (struct sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+// Starts the server, waiting until it accepts connections
+static pid_t startServer(const char *openssl, const char *dir, uint16_t port, bool tickets) {
+    char accept[8], cert[512], key[512];
+    snprintf(accept, sizeof(accept), "%u", port);
+    snprintf(cert, sizeof(cert), "%s/server.pem", dir);
+    snprintf(key, sizeof(key), "%s/server.key", dir);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        freopen("/dev/null", "r", stdin);
+        if (tickets) {
+            execlp(openssl, openssl, "s_server", "-accept", accept, "-cert", cert, "-key", key, "-rev", "-quiet", (char*)NULL);
+        } else {
+            execlp(openssl, openssl, "s_server", "-accept", accept, "-cert", cert, "-key", key, "-rev", "-quiet", "-no_ticket", (char*)NULL);
+        }
+        _exit(127);
+    }
+
+    unsigned long start = nowMillis();
+    while (nowMillis() - start < 10000) {
+        MQTTSocketTransport probe;
+        if (probe.connect("localhost", port)) {
+            return pid;
+        }
+        usleep(50000);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static void stopServer(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+// Sends a line and checks that it comes back reversed
+static bool echoes(MQTTTlsTransport &tls, const char *line, const char *reversed) {
+    size_t length = strlen(line);
+    if (tls.write((const uint8_t*)line, length) != length) {
+        return false;
+    }
+
+    char received[64];
+    size_t count = 0;
+    unsigned long start = nowMillis();
+    while (count < strlen(reversed) && nowMillis() - start < 5000) {
+        if (tls.available()) {
+            int n = tls.read((uint8_t*)received + count, sizeof(received) - 1 - count);
+            if (n > 0) count += n;
+        } else {
+            usleep(1000);
+        }
+    }
+    received[count] = 0;
+    return strcmp(received, reversed) == 0;
+}
+
+// Connects three times: a full handshake, a resumed one, and a full one after forgetting the session
+static void checkResumption(uint16_t port) {
+    StallingTransport *socket = new StallingTransport();
+    MQTTTlsTransport tls(socket, "localhost", caPem);
+
+    CHECK(tls.connect("localhost", port) == 1);
+    CHECK(tls.connected());
+    CHECK(echoes(tls, "hello\n", "olleh\n"));
+    CHECK(tls.getStats().handshakes == 1);
+    CHECK(tls.getStats().resumptions == 0);
+    CHECK(tls.getStats().fullHandshakeMicros > 0);
+    tls.stop();
+    CHECK(!tls.connected());
+
+    CHECK(tls.connect("localhost", port) == 1);
+    CHECK(echoes(tls, "again\n", "niaga\n"));
+    CHECK(tls.getStats().handshakes == 2);
+    CHECK(tls.getStats().resumptions == 1);
+    CHECK(tls.getStats().resumeMicros > 0);
+    tls.stop();
+
+    tls.forgetSession();
+    CHECK(tls.connect("localhost", port) == 1);
+    CHECK(tls.getStats().handshakes == 3);
+    CHECK(tls.getStats().resumptions == 1);
+
+    // A stalled connection fails the write within MQTT_TLS_WRITE_TIMEOUT instead of spinning, and is closed
+    uint8_t data[256];
+    memset(data, 'x', sizeof(data));
+    socket->stalled = true;
+    unsigned long start = nowMillis();
+    CHECK(tls.write(data, sizeof(data)) < sizeof(data));
+    CHECK(nowMillis() - start >= MQTT_TLS_WRITE_TIMEOUT);
+    CHECK(nowMillis() - start < MQTT_TLS_WRITE_TIMEOUT + 2000);
+    CHECK(!tls.connected());
+    CHECK(tls.getStats().failures == 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <openssl> <certificate directory>\n", argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/ca.pem", argv[2]);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "can't read %s\n", path);
+        return 2;
+    }
+    caPem[fread(caPem, 1, sizeof(caPem) - 1, file)] = 0;
+    fclose(file);
+
+    // Without a CA the transport refuses to connect (MQTT_TLS_INSECURE isn't set)
+    MQTTTlsTransport unverified(new MQTTSocketTransport(), "localhost", NULL);
+    CHECK(unverified.connect("localhost", 1) == 0);
+
+    // Resumption through a session ticket, then through the server's session cache
+    for (int tickets = 1; tickets >= 0; tickets--) {
+        uint16_t port = freePort();
+        pid_t server = startServer(argv[1], argv[2], port, tickets);
+        CHECK(server > 0);
+        if (server > 0) {
+            checkResumption(port);
+            stopServer(server);
+        }
+    }
+
+    // A server that can't be verified fails the handshake
+    uint16_t port = freePort();
+    pid_t server = startServer(argv[1], argv[2], port, true);
+    if (server > 0) {
+        static const char *other = "-----BEGIN CERTIFICATE-----\nMIIB\n-----END CERTIFICATE-----\n";
+        MQTTTlsTransport wrongCa(new MQTTSocketTransport(), "localhost", other);
+        CHECK(wrongCa.connect("localhost", port) == 0);
+
+        MQTTTlsTransport wrongHost(new MQTTSocketTransport(), "example.com", caPem);
+        CHECK(wrongHost.connect("localhost", port) == 0);
+        CHECK(wrongHost.getStats().failures == 1);
+        stopServer(server);
+    }
+
+    return testResult("test_tls");
+}
@@ -0,0 +1,199 @@
+// Checks the numbers FathymWriter formats: rounding, signs, values past 32 bits once scaled, the
+// exponent fallback, trailing zeros, NaN/Inf, and that an overflowing message is reported by finish().
+//
+// Usage: test_writer
+
+#include "FathymWriter.h"
+#include "test.h"
+
+#include <math.h>
+#include <string.h>
+
+static char output[128];
+
+// Formats a double with the given decimal places
+static const char *formatDouble(double value, uint8_t decimals) {
+    FathymWriter writer(output, sizeof(output));
+    writer.writeDouble(value, decimals);
+    return writer.finish() > 0 ? output : "(overflow)";
+}
+
+// Formats a scaled integer with the given decimal places
+static const char *formatFixed(int64_t value, uint8_t decimals) {
+    FathymWriter writer(output, sizeof(output));
+    writer.writeFixed(value, decimals);
+    return writer.finish() > 0 ? output : "(overflow)";
+}
+
+// Formats an unsigned integer
+static const char *formatUnsigned(uint64_t value) {
+    FathymWriter writer(output, sizeof(output));
+    writer.writeUnsigned(value);
+    return writer.finish() > 0 ? output : "(overflow)";
+}
+
+#define CHECK_FORMAT(formatted, expected) do { \
+    const char *text = (formatted); \
+    if (strcmp(text, expected) != 0) fprintf(stderr, "got %s, expected %s\n", text, expected); \
+    CHECK(strcmp(text, expected) == 0); \
+} while (0)
+
+// Rounds to the decimal places asked for
+static void checkRounding() {
+    // Halves (exact in binary) round away from zero
+    CHECK_FORMAT(formatDouble(0.5, 0), "1");
+    CHECK_FORMAT(formatDouble(2.5, 0), "3");
+    CHECK_FORMAT(formatDouble(-2.5, 0), "-3");
+    CHECK_FORMAT(formatDouble(1.25, 1), "1.3");
+    CHECK_FORMAT(formatDouble(0.125, 2), "0.13");
+    CHECK_FORMAT(formatDouble(0.49, 0), "0");
+
+    // Rounding carries into the whole part
+    CHECK_FORMAT(formatDouble(9.996, 2), "10");
+    CHECK_FORMAT(formatDouble(-0.999, 2), "-1");
+
+    CHECK_FORMAT(formatDouble(21.53, 2), "21.53");
+    CHECK_FORMAT(formatDouble(3.14159265, 4), "3.1416");
+    CHECK_FORMAT(formatDouble(0.1, 9), "0.1");
+
+    // More decimal places than the writer formats are clamped
+    CHECK_FORMAT(formatDouble(0.1234567891234, 12), "0.123456789");
+}
+
+// Writes the sign only when something non-zero is left
+static void checkSigns() {
+    // Negative values that round to zero are written without the sign
+    CHECK_FORMAT(formatDouble(-0.004, 2), "0");
+    CHECK_FORMAT(formatDouble(-0.4, 0), "0");
+    CHECK_FORMAT(formatDouble(-0.0, 3), "0");
+    CHECK_FORMAT(formatDouble(-0.006, 2), "-0.01");
+    CHECK_FORMAT(formatFixed(-5, 3), "-0.005");
+    CHECK_FORMAT(formatFixed(0, 3), "0");
+}
+
+// Drops trailing zeros from the fraction
+static void checkTrailingZeros() {
+    CHECK_FORMAT(formatDouble(1.5, 4), "1.5");
+    CHECK_FORMAT(formatDouble(2.0, 3), "2");
+    CHECK_FORMAT(formatDouble(100.0, 2), "100");
+    CHECK_FORMAT(formatFixed(1200, 2), "12");
+    CHECK_FORMAT(formatFixed(1050, 3), "1.05");
+    CHECK_FORMAT(formatFixed(12345, 2), "123.45");
+
+    // Zeros inside the fraction stay
+    CHECK_FORMAT(formatFixed(1005, 3), "1.005");
+    CHECK_FORMAT(formatDouble(0.0625, 4), "0.0625");
+}
+
+// JSON has no NaN or infinity
+static void checkNotNumbers() {
+    CHECK_FORMAT(formatDouble(NAN, 2), "null");
+    CHECK_FORMAT(formatDouble(INFINITY, 2), "null");
+    CHECK_FORMAT(formatDouble(-INFINITY, 0), "null");
+}
+
+// Values whose scaled form no longer fits 32 bits take the 64 bit path
+static void checkLarge() {
+    CHECK_FORMAT(formatDouble(4294967295.0, 0), "4294967295");
+    CHECK_FORMAT(formatDouble(4294967296.0, 0), "4294967296");
+    CHECK_FORMAT(formatDouble(5000000000.0, 0), "5000000000");
+    CHECK_FORMAT(formatDouble(12345678.9, 3), "12345678.9");
+    CHECK_FORMAT(formatDouble(-4294967296.25, 2), "-4294967296.25");
+    CHECK_FORMAT(formatDouble(42949.67296, 5), "42949.67296");
+
+    // Decimal places are shed rather than writing digits past the double's precision
+    CHECK_FORMAT(formatDouble(1e12, 9), "1000000000000");
+    CHECK_FORMAT(formatDouble(123456789012.5, 9), "123456789012.5");
+    CHECK_FORMAT(formatDouble(1e17, 2), "100000000000000000");
+
+    CHECK_FORMAT(formatFixed(12345678901234LL, 4), "1234567890.1234");
+    CHECK_FORMAT(formatFixed(-12345678901234LL, 4), "-1234567890.1234");
+    CHECK_FORMAT(formatFixed(4294967296LL, 0), "4294967296");
+
+    CHECK_FORMAT(formatUnsigned(0), "0");
+    CHECK_FORMAT(formatUnsigned(1000000000ULL), "1000000000");
+    CHECK_FORMAT(formatUnsigned(4294967296ULL), "4294967296");
+    CHECK_FORMAT(formatUnsigned(1000000000000000000ULL), "1000000000000000000");
+    CHECK_FORMAT(formatUnsigned(18446744073709551615ULL), "18446744073709551615");
+}
+
+// Values too large for 64 bits even without decimals fall back to exponent notation
+static void checkExponent() {
+    CHECK_FORMAT(formatDouble(1e30, 2), "1e30");
+    CHECK_FORMAT(formatDouble(1.5e20, 0), "1.5e20");
+    CHECK_FORMAT(formatDouble(-2.5e25, 3), "-2.5e25");
+    CHECK_FORMAT(formatDouble(1.2345e300, 2), "1.2345e300");
+}
+
+// Reports an output that didn't fit the buffer from finish()
+static void checkOverflow() {
+    char buffer[8];
+
+    // The last byte is kept for the terminator
+    FathymWriter fits(buffer, sizeof(buffer));
+    fits.write("abcdefg");
+    CHECK(!fits.overflowed());
+    CHECK(fits.finish() == 7);
+    CHECK(strcmp(buffer, "abcdefg") == 0);
+
+    FathymWriter full(buffer, sizeof(buffer));
+    full.write("abcdefgh");
+    CHECK(full.overflowed());
+    CHECK(full.finish() == 0);
+
+    // A number cut short overflows the message, even if later writes would fit
+    FathymWriter number(buffer, sizeof(buffer));
+    number.write("{\"v\":");
+    number.writeDouble(123.25, 2);
+    number.write('}');
+    CHECK(number.overflowed());
+    CHECK(number.finish() == 0);
+    CHECK(strlen(buffer) < sizeof(buffer));
+
+    FathymWriter escaped(buffer, sizeof(buffer));
+    escaped.writeString("a\"b\\c");
+    CHECK(escaped.finish() == 0);
+
+    FathymWriter empty(buffer, 0);
+    CHECK(empty.finish() == 0);
+}
+
+// Escapes strings and writes the other value types
+static void checkStrings() {
+    FathymWriter writer(output, sizeof(output));
+    writer.write('{');
+    writer.writeKey("name");
+    writer.writeString("a\"b\\c\n\x01");
+    writer.write(',');
+    writer.writeKey("none");
+    writer.writeString(NULL);
+    writer.write(',');
+    writer.writeKey("on");
+    writer.writeBool(true);
+    writer.write(',');
+    writer.writeKey("n");
+    writer.writeLong(-42);
+    writer.write(',');
+    writer.writeKey("b");
+    writer.writeBase64((const uint8_t *)"Man", 3);
+    writer.write(',');
+    writer.writeBase64((const uint8_t *)"Ma", 2);
+    writer.write(',');
+    writer.writeBase64((const uint8_t *)"M", 1);
+    writer.write('}');
+    CHECK(writer.finish() > 0);
+    CHECK_FORMAT(output, "{\"name\":\"a\\\"b\\\\c\\n\\u0001\",\"none\":null,\"on\":true,\"n\":-42,\"b\":\"TWFu\",\"TWE=\",\"TQ==\"}");
+}
+
+int main(int argc, char **argv) {
+    checkRounding();
+    checkSigns();
+    checkTrailingZeros();
+    checkNotNumbers();
+    checkLarge();
+    checkExponent();
+    checkOverflow();
+    checkStrings();
+
+    return testResult("test_writer");
+}